@@ -0,0 +1,173 @@
+/*
+ * Threaded against switch dispatch in the interpreter
+ *
+ * Usage: interp [runs]
+ *
+ * Parses a few Brainfuck programs with the frontend, at -O0 and at -O1, and
+ * runs each one with Interpreter::THREADED and Interpreter::SWITCH
+ * dispatch, reporting the best of the given number of runs (three by
+ * default). The programs are the repository's hello.bf repeated, for
+ * straight-line code, and two made for this: four nested loops which count
+ * down in fives, so that the frontend can't turn them into multiplications,
+ * and three nested loops writing 16M bytes. -O2 is left out since partial
+ * evaluation runs programs which read no input while compiling them. Output
+ * goes to a temporary file, and both dispatches must write the same thing.
+ * The speedup is the switch time over the threaded time.
+ */
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "decoder.hpp"
+#include "frontend.hpp"
+#include "interpreter.hpp"
+#include "object.hpp"
+#include "passes.hpp"
+
+namespace {
+	/*
+	 * Returns the contents of a file, or an empty string if it can't be read
+	 */
+	std::string slurp(const std::string &file) {
+		std::ifstream in(file, std::ios::binary);
+
+		return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	/*
+	 * Parse a source and run passes over it
+	 */
+	std::vector<std::uint8_t> build(std::string &file, const std::vector<std::string> &passes) {
+		BrainfuckFrontend frontend;
+		std::vector<std::uint8_t> object = frontend.parse(file);
+
+		if (passes.empty()) return object;
+
+		PassManager manager;
+
+		for (const std::string &name : passes) {
+			manager.add(name);
+		}
+
+		IR::Program program = IR::disassemble(IR::ObjectView(object));
+		manager.run(program);
+
+		return program.assemble();
+	}
+
+	/*
+	 * Run an object with stdout sent to a file, which is emptied first
+	 *
+	 * Returns the time taken in seconds.
+	 */
+	double time(Interpreter &interpreter, Interpreter::Dispatch dispatch, const std::string &output) {
+		int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+		if (fd < 0) {
+			throw std::runtime_error("could not open " + output);
+		}
+
+		int saved = dup(STDOUT_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+
+		auto start = std::chrono::steady_clock::now();
+		interpreter.run(1024 * 1024, dispatch);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+
+		return elapsed.count();
+	}
+}
+
+int main(int argc, char **argv) {
+	int runs = argc > 1 ? std::stoi(argv[1]) : 3;
+
+	std::string hello = slurp("hello.bf");
+	std::string repeated;
+
+	for (int i=0; i < 2000; ++i) {
+		repeated += hello;
+	}
+
+	struct Case {
+		const char *name;
+		std::string source;
+	} cases[] = {
+		{"hello", repeated},
+		{"loops", "-[>-[>-[>-[>+>-<<-----]<-----]<-----]<-----]"},
+		{"output", "-[>-[>-[.-]<-]<-]"}
+	};
+
+	struct Level {
+		const char *name;
+		unsigned level;
+	} levels[] = {
+		{"-O0", 0},
+		{"-O1", 1}
+	};
+
+	std::string base = (std::filesystem::temp_directory_path() / ("abc-bench-interp-" + std::to_string(getpid()))).string();
+	std::string source = base + ".bf", threadedOut = base + ".threaded", switchOut = base + ".switch";
+
+	std::cout << std::left << std::setw(10) << "program" << std::setw(6) << "level" << std::right
+		<< std::setw(14) << "instructions" << std::setw(14) << "threaded ms" << std::setw(12) << "switch ms"
+		<< std::setw(10) << "speedup" << std::endl;
+
+	for (const Case &c : cases) {
+		if (c.source.empty()) continue;
+
+		std::ofstream(source, std::ios::out | std::ios::trunc | std::ios::binary) << c.source;
+
+		for (const Level &l : levels) {
+			std::vector<std::uint8_t> object = build(source, PassManager::level(l.level));
+			IR::ObjectView view(object);
+			Interpreter interpreter(view);
+
+			double threaded = 0, switched = 0;
+
+			// A threaded run after a switched one fills the handlers in again,
+			// so each dispatch gets all its runs in a row
+			for (int i=0; i < runs; ++i) {
+				double t = time(interpreter, Interpreter::THREADED, threadedOut);
+				if (i == 0 || t < threaded) threaded = t;
+			}
+
+			for (int i=0; i < runs; ++i) {
+				double s = time(interpreter, Interpreter::SWITCH, switchOut);
+				if (i == 0 || s < switched) switched = s;
+			}
+
+			if (slurp(threadedOut) != slurp(switchOut)) {
+				std::cerr << c.name << " " << l.name << ": the dispatches wrote different output" << std::endl;
+				return 1;
+			}
+
+			std::cout << std::left << std::setw(10) << c.name << std::setw(6) << l.name << std::right
+				<< std::setw(14) << interpreter.size() << std::fixed << std::setprecision(1)
+				<< std::setw(14) << threaded * 1e3 << std::setw(12) << switched * 1e3
+				<< std::setprecision(2) << std::setw(9) << (threaded > 0 ? switched / threaded : 0) << "x"
+				<< std::endl;
+		}
+	}
+
+	std::remove(source.c_str());
+	std::remove(threadedOut.c_str());
+	std::remove(switchOut.c_str());
+
+	return 0;
+}
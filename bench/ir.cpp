@@ -0,0 +1,162 @@
+/*
+ * Memory use and build time of IR programs
+ *
+ * Usage: ir [instructions]
+ *
+ * Builds a long straight-line program (5M instructions by default) of the
+ * kind the Brainfuck frontend emits, once with IR::Program and once with the
+ * representation it replaced: one heap allocated instruction per
+ * IR instruction, holding optional operands which in turn hold a variant
+ * with a std::string for symbols. Reports the time taken and how much heap
+ * each one uses.
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <malloc.h>
+
+#include "ir.hpp"
+
+namespace {
+	/*
+	 * The instruction representation IR::Program used to have
+	 */
+	struct LegacyOperand {
+		enum {
+			REGISTER,
+			INDIRECT,
+			SYMBOL,
+			LITERAL
+		} type;
+		std::variant<IR::Register, std::string, std::uintmax_t> value;
+	};
+
+	struct LegacyInstruction {
+		IR::Opcode opcode;
+
+		std::optional<IR::OperandSize> size;
+		std::optional<IR::Condition> cc;
+		std::optional<LegacyOperand> op1;
+		std::optional<LegacyOperand> op2;
+
+		bool useOpSize = false;
+		bool useCC = false;
+		bool useOp1 = false;
+		bool useOp2 = false;
+
+		LegacyInstruction(IR::Opcode opcode) : opcode(opcode) {}
+	};
+
+	/*
+	 * Returns the bytes currently allocated on the heap
+	 */
+	std::size_t heapUsed() {
+		struct mallinfo2 info = mallinfo2();
+		return info.uordblks + info.hblkhd;
+	}
+
+	struct Result {
+		double seconds;
+		std::size_t bytes;
+	};
+
+	/*
+	 * Measure building a program with build, which must leave it alive in
+	 * whatever it returns until the result is destroyed
+	 */
+	template<typename F>
+	Result measure(F build) {
+		std::size_t before = heapUsed();
+		auto start = std::chrono::steady_clock::now();
+
+		auto program = build();
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return {elapsed.count(), heapUsed() - before};
+	}
+}
+
+int main(int argc, char **argv) {
+	std::size_t n = argc > 1 ? std::stoull(argv[1]) : 5000000;
+
+	// add byte [ar+k],k / add ar,1 / ... with a call putc every 8
+	Result compact = measure([n]() {
+		IR::Program program;
+		IR::Symbol putc = program.symbols().intern("putc");
+
+		program.label("main");
+
+		for (std::size_t i=0; i < n; ++i) {
+			if (i % 8 == 7) {
+				program(IR::CALL) (putc);
+			} else if (i % 2) {
+				program(IR::ADD) (IR::AR)(1);
+			} else {
+				program(IR::ADD) (IR::BYTE) [IR::AR + static_cast<std::int32_t>(i % 16)](i % 16);
+			}
+		}
+
+		return program;
+	});
+
+	Result legacy = measure([n]() {
+		std::vector<LegacyInstruction *> program;
+
+		for (std::size_t i=0; i < n; ++i) {
+			LegacyInstruction *instr;
+
+			if (i % 8 == 7) {
+				instr = new LegacyInstruction(IR::CALL);
+				instr->op2 = LegacyOperand{LegacyOperand::SYMBOL, std::string("putc")};
+				instr->useOp2 = true;
+			} else if (i % 2) {
+				instr = new LegacyInstruction(IR::ADD);
+				instr->op1 = LegacyOperand{LegacyOperand::REGISTER, IR::AR};
+				instr->op2 = LegacyOperand{LegacyOperand::LITERAL, std::uintmax_t(1)};
+				instr->useOp1 = instr->useOp2 = true;
+			} else {
+				instr = new LegacyInstruction(IR::ADD);
+				instr->size = IR::BYTE;
+				instr->op1 = LegacyOperand{LegacyOperand::INDIRECT, IR::AR};
+				instr->op2 = LegacyOperand{LegacyOperand::LITERAL, std::uintmax_t(i % 16)};
+				instr->useOpSize = instr->useOp1 = instr->useOp2 = true;
+			}
+
+			program.push_back(instr);
+		}
+
+		// Freed by the unique_ptr after the measurement
+		struct Owner {
+			std::vector<LegacyInstruction *> instructions;
+
+			~Owner() {
+				for (LegacyInstruction *instr : instructions) delete instr;
+			}
+		};
+
+		return std::make_unique<Owner>(std::move(program));
+	});
+
+	std::cout << n << " instructions" << std::endl;
+	std::cout << std::left << std::setw(10) << "form" << std::right << std::setw(10) << "ms"
+		<< std::setw(14) << "heap (MiB)" << std::setw(14) << "bytes/instr" << std::endl;
+
+	for (auto [name, result] : {std::pair{"compact", compact}, std::pair{"legacy", legacy}}) {
+		std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(10) << result.seconds * 1e3 << std::setw(14) << result.bytes / double(1 << 20)
+			<< std::setw(14) << double(result.bytes) / n << std::endl;
+	}
+
+	std::cout << "legacy / compact: " << std::setprecision(1) << legacy.seconds / compact.seconds << "x time, "
+		<< double(legacy.bytes) / compact.bytes << "x memory" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Parse throughput of the Brainfuck frontend on large inputs
+ *
+ * Usage: parse [MiB]
+ *
+ * Generates sources of the given size (256 MiB by default) in the temporary
+ * directory, and reports how fast the frontend turns each one into an IR
+ * object, best of three. Like the generated sources this is for, both are
+ * mostly comments: one has a command in every line or so, and the other has
+ * hardly any, so that it mostly measures the comment filter.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "frontend.hpp"
+#include "object.hpp"
+
+namespace {
+	/*
+	 * Write a source of size bytes to file, with one command in every
+	 * spacing bytes and comments in between
+	 */
+	void generate(const std::string &file, std::size_t size, std::size_t spacing) {
+		static const char COMMANDS[] = "+-<>+-<>.";
+		static const char COMMENT[] = "the quick brown fox jumps over the lazy dog\n";
+
+		std::mt19937 random(size ^ spacing);
+		std::string block(1 << 20, ' ');
+		std::ofstream out(file, std::ios::out | std::ios::trunc | std::ios::binary);
+
+		for (std::size_t written = 0; written < size; written += block.size()) {
+			for (std::size_t i=0; i < block.size(); ++i) {
+				block[i] = i % spacing == 0 ? COMMANDS[random() % (sizeof(COMMANDS) - 1)]
+					: COMMENT[i % (sizeof(COMMENT) - 1)];
+			}
+
+			out.write(block.data(), std::min(block.size(), size - written));
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	std::size_t size = (argc > 1 ? std::stoull(argv[1]) : 256) << 20;
+
+	struct Case {
+		const char *name;
+		std::size_t spacing;
+	} cases[] = {
+		{"commented", 64},
+		{"sparse", 4096}
+	};
+
+	std::cout << std::left << std::setw(12) << "source" << std::right << std::setw(10) << "MiB"
+		<< std::setw(14) << "instructions" << std::setw(10) << "ms" << std::setw(10) << "GB/s" << std::endl;
+
+	for (const Case &c : cases) {
+		std::string file = (std::filesystem::temp_directory_path()
+			/ ("abc-bench-parse-" + std::to_string(getpid()) + ".bf")).string();
+
+		generate(file, size, c.spacing);
+
+		double best = 0;
+		std::uint32_t instructions = 0;
+
+		for (int i=0; i < 3; ++i) {
+			BrainfuckFrontend frontend;
+
+			auto start = std::chrono::steady_clock::now();
+			std::vector<std::uint8_t> object = frontend.parse(file);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+			if (i == 0 || elapsed.count() < best) best = elapsed.count();
+			instructions = IR::ObjectView(object).instructions();
+		}
+
+		std::filesystem::remove(file);
+
+		std::cout << std::left << std::setw(12) << c.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(10) << size / double(1 << 20) << std::setw(14) << instructions
+			<< std::setw(10) << best * 1e3 << std::setprecision(2) << std::setw(10) << size / best / 1e9
+			<< std::endl;
+	}
+
+	return 0;
+}
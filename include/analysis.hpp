@@ -0,0 +1,366 @@
+#ifndef _ANALYSIS_HPP_
+#define _ANALYSIS_HPP_
+
+#include <span>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ir.hpp"
+#include "object.hpp"
+
+/*
+ * Analyses of IR programs
+ *
+ * Analyses are computed from a Program and describe it without changing it.
+ * Passes get them from an AnalysisManager (see passes.hpp), which caches them
+ * until a pass changes the program in a way that invalidates them. Results
+ * are kept in flat arrays indexed by instruction or block, so that they stay
+ * cheap on programs with millions of instructions.
+ *
+ * The CFG can also be built straight from the bytecode of an object, for
+ * backends which don't disassemble it. Dominators and Loops only need a CFG,
+ * so they work on either; the interpreter uses them on the bytecode to find
+ * the loops it compiles when execution is tiered.
+ */
+
+namespace IR {
+	/*
+	 * The control flow graph of a program, as basic blocks. Blocks are
+	 * numbered in program order; a new block starts at every label and after
+	 * every jump.
+	 */
+	class CFG {
+	public:
+		typedef std::uint32_t BlockID;
+
+		// The successor of a block which leaves the program
+		static constexpr BlockID EXIT = 0xFFFFFFFF;
+
+	private:
+		// The first instruction of each block, followed by the size of the
+		// program
+		std::vector<std::uint32_t> starts;
+
+		// The block each instruction is in
+		std::vector<BlockID> blocks;
+
+		// Where control goes after each block when its last instruction does
+		// not jump, and when it does. Either may be EXIT.
+		std::vector<BlockID> fallthroughs;
+		std::vector<BlockID> branches;
+
+		// Set for blocks which end in a jump whose target is not known, such
+		// as a jump through a register
+		std::vector<bool> unknownBranches;
+
+		// The predecessors of block b are preds[predStarts[b]:predStarts[b+1]]
+		std::vector<std::uint32_t> predStarts;
+		std::vector<BlockID> preds;
+
+		BlockID entryBlock = EXIT;
+
+		// Used by build for instructions which don't end a block, and jumps
+		// whose target isn't known
+		static constexpr std::uint32_t NOT_JUMP = 0xFFFFFFFF;
+		static constexpr std::uint32_t UNKNOWN_TARGET = 0xFFFFFFFE;
+
+		/*
+		 * Build the graph from where each instruction jumps
+		 *
+		 * leaders		Set for each instruction which starts a block because a
+		 *				label points at it. Has an extra entry for the end.
+		 * targets		The instruction each jump goes to, which may be the
+		 *				end of the program, or NOT_JUMP or UNKNOWN_TARGET
+		 * conditional	Set for each jump which can fall through
+		 * entry		The first instruction of main, or NOT_JUMP
+		 */
+		void build(std::vector<bool> &leaders, const std::vector<std::uint32_t> &targets,
+				   const std::vector<bool> &conditional, std::uint32_t entry);
+
+	public:
+		/*
+		 * Build the control flow graph of a program
+		 */
+		CFG(const Program &program);
+
+		/*
+		 * Build the control flow graph of the code in an object. Blocks are
+		 * numbered the same way, and instructions are indexed in the order
+		 * they are decoded.
+		 *
+		 * Throws InvalidInstructionException if a jump goes into the middle
+		 * of an instruction.
+		 */
+		CFG(const ObjectView &object);
+
+		/*
+		 * Returns the number of blocks
+		 */
+		std::size_t size() const;
+
+		/*
+		 * Returns the block containing main, or the first block if there is
+		 * no main, or EXIT if the program is empty
+		 */
+		BlockID entry() const;
+
+		/*
+		 * Returns the index of the first instruction in a block
+		 */
+		std::size_t begin(BlockID block) const;
+
+		/*
+		 * Returns the index one past the last instruction in a block
+		 */
+		std::size_t end(BlockID block) const;
+
+		/*
+		 * Returns the block an instruction is in
+		 */
+		BlockID block(std::size_t instruction) const;
+
+		/*
+		 * Returns the block control reaches by falling through the end of a
+		 * block. This is EXIT if it falls off the end of the program, or
+		 * if the block always jumps.
+		 */
+		BlockID fallthrough(BlockID block) const;
+
+		/*
+		 * Returns the block control reaches when the jump at the end of a
+		 * block is taken. This is EXIT if the block does not end in a jump,
+		 * or the target is not a block.
+		 */
+		BlockID branch(BlockID block) const;
+
+		/*
+		 * Returns true if a block ends in a jump whose target is not a label
+		 * in the program
+		 */
+		bool unknownBranch(BlockID block) const;
+
+		/*
+		 * Returns the blocks which can pass control to a block
+		 */
+		std::span<const BlockID> predecessors(BlockID block) const;
+	};
+
+	/*
+	 * The dominator tree of a CFG, rooted at its entry. Blocks which can't be
+	 * reached from the entry are not in the tree.
+	 */
+	class Dominators {
+	private:
+		// The immediate dominator of each block, or EXIT for the entry and
+		// unreachable blocks
+		std::vector<CFG::BlockID> idoms;
+
+		// The reachable blocks in reverse postorder
+		std::vector<CFG::BlockID> order;
+
+		// Where each block is in a walk of the dominator tree, so that
+		// dominance can be checked in constant time. Zero for unreachable
+		// blocks.
+		std::vector<std::uint32_t> preorder;
+		std::vector<std::uint32_t> postorder;
+
+	public:
+		Dominators(const CFG &cfg);
+
+		/*
+		 * Returns true if a block can be reached from the entry
+		 */
+		bool reachable(CFG::BlockID block) const;
+
+		/*
+		 * Returns the immediate dominator of a block, or EXIT if it is the
+		 * entry or can't be reached
+		 */
+		CFG::BlockID idom(CFG::BlockID block) const;
+
+		/*
+		 * Returns true if every path from the entry to b goes through a. A
+		 * block dominates itself.
+		 */
+		bool dominates(CFG::BlockID a, CFG::BlockID b) const;
+
+		/*
+		 * Returns the reachable blocks in reverse postorder, so that each
+		 * block comes before its successors, other than along back edges
+		 */
+		std::span<const CFG::BlockID> reversePostorder() const;
+	};
+
+	/*
+	 * The natural loops of a CFG, and how they nest. A loop is found for each
+	 * block which is jumped back to from a block it dominates; every
+	 * Brainfuck loop is one. Loops are numbered so that inner loops come
+	 * before the loops they are in.
+	 */
+	class Loops {
+	public:
+		typedef std::uint32_t LoopID;
+
+		// The loop of a block which isn't in one, and the parent of an
+		// outermost loop
+		static constexpr LoopID NO_LOOP = 0xFFFFFFFF;
+
+	private:
+		std::vector<CFG::BlockID> headers;
+		std::vector<LoopID> parents;
+		std::vector<std::uint32_t> depths;
+
+		// The innermost loop each block is in
+		std::vector<LoopID> blockLoops;
+
+	public:
+		Loops(const CFG &cfg, const Dominators &dominators);
+
+		/*
+		 * Returns the number of loops
+		 */
+		std::size_t size() const;
+
+		/*
+		 * Returns the block at the start of a loop, which every path into the
+		 * loop goes through
+		 */
+		CFG::BlockID header(LoopID loop) const;
+
+		/*
+		 * Returns the loop a loop is in, or NO_LOOP
+		 */
+		LoopID parent(LoopID loop) const;
+
+		/*
+		 * Returns how many loops a loop is in, counting itself, so that an
+		 * outermost loop has depth 1
+		 */
+		std::uint32_t depth(LoopID loop) const;
+
+		/*
+		 * Returns the innermost loop a block is in, or NO_LOOP
+		 */
+		LoopID loop(CFG::BlockID block) const;
+
+		/*
+		 * Returns true if a block is in a loop, or in one of its inner loops
+		 */
+		bool contains(LoopID loop, CFG::BlockID block) const;
+	};
+
+	/*
+	 * Where AR points relative to the start of each block. This is known
+	 * until something moves AR by an amount that can't be determined
+	 * statically, such as call scan.
+	 */
+	class CellOffsets {
+	public:
+		// An offset which is not known
+		static constexpr std::int64_t UNKNOWN = INT64_MIN;
+
+	private:
+		// AR relative to the start of its block before each instruction
+		std::vector<std::int64_t> offsets;
+
+		// The net movement of AR over each block
+		std::vector<std::int64_t> deltas;
+
+	public:
+		CellOffsets(const Program &program, const CFG &cfg);
+
+		/*
+		 * Returns the offset of AR from where it pointed at the start of the
+		 * instruction's block, just before the instruction runs, or UNKNOWN
+		 */
+		std::int64_t offset(std::size_t instruction) const;
+
+		/*
+		 * Returns how far AR moves over a block, or UNKNOWN
+		 */
+		std::int64_t delta(CFG::BlockID block) const;
+	};
+
+	/*
+	 * What is known about the values of cells at the start of each block,
+	 * found by running the blocks on the known values until nothing changes.
+	 * Only edges which can be taken given those values are followed, so this
+	 * also finds the blocks which can never run and the jumps which always or
+	 * never go one way.
+	 *
+	 * The program starts at main with the memory at AR holding its image, and
+	 * zero past the end of it. Nothing is known at the other places code can
+	 * be entered: named labels and labels used as an operand other than a
+	 * jump target.
+	 */
+	class CellValues {
+	public:
+		// The value of a cell which is not known
+		static constexpr int UNKNOWN = -1;
+
+		// The most cells tracked at once; more than this and the ones
+		// furthest from AR are forgotten
+		static constexpr std::size_t MAX_CELLS = 32;
+
+	private:
+		std::vector<bool> reached;
+		std::vector<bool> fallthroughs;
+		std::vector<bool> branches;
+
+		// The cells known at the start of block b are cells[starts[b]:starts[b+1]],
+		// sorted by offset from AR, with their values. Where images[b] is not
+		// NO_IMAGE, cells which are not listed still hold the image, offset by
+		// images[b]; listed cells may be UNKNOWN.
+		static constexpr std::int64_t NO_IMAGE = INT64_MIN;
+
+		std::vector<std::uint32_t> starts;
+		std::vector<std::int64_t> cells;
+		std::vector<std::int16_t> values;
+		std::vector<std::int64_t> images;
+
+		const std::vector<std::uint8_t> &image;
+
+		// What is known at one point while the analysis runs
+		struct State;
+
+		/*
+		 * Returns the value of the image at an offset from its start
+		 */
+		int imageValue(std::int64_t address) const;
+
+	public:
+		/*
+		 * Analyse a program. The program must outlive this.
+		 */
+		CellValues(const Program &program, const CFG &cfg, const CellOffsets &offsets);
+
+		/*
+		 * Returns true if a block can run
+		 */
+		bool reachable(CFG::BlockID block) const;
+
+		/*
+		 * Returns true if control can leave a block by falling through, or by
+		 * taking the jump at its end. Always false for unreachable blocks.
+		 */
+		bool fallthroughTaken(CFG::BlockID block) const;
+		bool branchTaken(CFG::BlockID block) const;
+
+		/*
+		 * Returns the value of a cell when control enters a block, or UNKNOWN
+		 *
+		 * cell		The offset of the cell from AR at the start of the block
+		 */
+		int value(CFG::BlockID block, std::int64_t cell) const;
+
+		/*
+		 * Returns true if a cell is known to be zero when control enters a
+		 * block
+		 */
+		bool isZero(CFG::BlockID block, std::int64_t cell) const;
+	};
+}
+
+#endif  // _ANALYSIS_HPP_
@@ -1,43 +1,202 @@
-#ifndef _BACKEND_HPP_
-#define _BACKEND_HPP_
-
-#include <string>
-#include <vector>
-
-class IBackend {
-public:
-	/*
-	 * Apply options specified on the command line to the frontend.
-	 *
-	 * option	The character code of the option. Unrecognised options are
-	 *			ignored.
-	 * values	The values of the options. These values should either be flags
-	 *			(in the form "name") or settings (in the form "name=value").
-	 *			Flags may be prefixed with "no-" to disable the flag.
-	 *			Unrecognised values are ignored.
-	 */
-	virtual void applyOptions(char option, std::vector<std::string> &values) = 0;
-
-	/*
-	 * Return a help string. This should document all user-facing features
-	 * of the frontend.
-	 */
-	virtual std::string helpStr() = 0;
-
-	/*
-	 * Enable/disable verbose output. If enabled, parse should describe what
-	 * its doing in stdout.
-	 *
-	 * verbosity	The new verbosity.
-	 */
-	virtual void setVerbosity(bool verbosity) = 0;
-
-	virtual void compile(std::vector<std::uint8_t> &ir) = 0;
-
-	virtual ~IBackend() {}
-};
-
-/* Backends */
-
-
-#endif  // _BACKEND_HPP_
+#ifndef _BACKEND_HPP_
+#define _BACKEND_HPP_
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pipeline.hpp"
+
+class IBackend {
+public:
+	/*
+	 * Apply options specified on the command line to the backend.
+	 *
+	 * option	The character code of the option. Unrecognised options are
+	 *			ignored.
+	 * values	The values of the options. These values should either be flags
+	 *			(in the form "name") or settings (in the form "name=value").
+	 *			Flags may be prefixed with "no-" to disable the flag.
+	 *			Unrecognised values are ignored.
+	 */
+	virtual void applyOptions(char option, std::vector<std::string> &values) = 0;
+
+	/*
+	 * Return a help string. This should document all user-facing features
+	 * of the backend.
+	 */
+	virtual std::string helpStr() = 0;
+
+	/*
+	 * Return the name of the architecture this backend targets. This
+	 * identifies the backend in cache keys, so it must be unique.
+	 */
+	virtual std::string name() = 0;
+
+	/*
+	 * Return the extension given to files compile produces, including the dot
+	 */
+	virtual std::string extension() = 0;
+
+	/*
+	 * Return whether the files compile produces are programs, which should
+	 * be made executable once written
+	 */
+	virtual bool executable() = 0;
+
+	/*
+	 * Enable/disable verbose output. If enabled, compile should describe what
+	 * its doing in stdout.
+	 *
+	 * verbosity	The new verbosity.
+	 */
+	virtual void setVerbosity(bool verbosity) = 0;
+
+	/*
+	 * Compile an IR object into code for the target. Like IFrontend::parse,
+	 * this may be called on several backend instances from different threads
+	 * at once.
+	 *
+	 * object	The IR object to compile
+	 * Returns the contents of the output file.
+	 * Throws std::runtime_error if the object uses something the backend
+	 * can't generate code for, and IR::InvalidInstructionException if the
+	 * bytecode is malformed.
+	 */
+	virtual std::vector<std::uint8_t> compile(const std::vector<std::uint8_t> &object) = 0;
+
+	/*
+	 * Run an IR object in this process. The program reads stdin and writes
+	 * stdout directly, and has finished with both when this returns.
+	 *
+	 * object	The IR object to run
+	 * Throws std::runtime_error if the backend can't run the object in
+	 * process, and IR::InvalidInstructionException if the bytecode is
+	 * malformed.
+	 */
+	virtual void run(const std::vector<std::uint8_t> &object) = 0;
+
+	virtual ~IBackend() {}
+};
+
+/*
+ * An outlet which runs a backend over the IR object flowing out of the
+ * pipeline, and writes what it produces to the destination file.
+ */
+class BackendOutlet : public IOutlet {
+private:
+	IBackend *backend;
+
+public:
+	/*
+	 * Construct a new outlet around a backend.
+	 *
+	 * backend	The backend to compile with. The outlet takes ownership of it.
+	 */
+	BackendOutlet(IBackend *backend);
+
+	BackendOutlet(BackendOutlet const&) = delete;
+	void operator=(BackendOutlet const&) = delete;
+
+	/*
+	 * Throws std::runtime_error if the file cannot be written.
+	 */
+	void deliver(std::string &file, Coupling::Source &source);
+
+	~BackendOutlet();
+};
+
+/*
+ * An outlet which runs the IR object flowing out of the pipeline with a
+ * backend, rather than writing anything out.
+ */
+class RunOutlet : public IOutlet {
+private:
+	IBackend *backend;
+
+public:
+	/*
+	 * Construct a new outlet around a backend.
+	 *
+	 * backend	The backend to run with. The outlet takes ownership of it.
+	 */
+	RunOutlet(IBackend *backend);
+
+	RunOutlet(RunOutlet const&) = delete;
+	void operator=(RunOutlet const&) = delete;
+
+	/*
+	 * The file is ignored.
+	 */
+	void deliver(std::string &file, Coupling::Source &source);
+
+	~RunOutlet();
+};
+
+/* Backends */
+class X86_64Backend : public IBackend {
+private:
+	bool verbose = false;
+
+	// The size of the tape, in bytes
+	std::size_t tapeSize = 1024 * 1024;
+
+	// How many times a loop goes round before run compiles it, or 0 to
+	// compile the whole program first
+	std::uint32_t jitThreshold = 1000;
+
+	// What compile produces
+	enum Format {
+		EXECUTABLE, OBJECT, ASSEMBLY
+	} format = EXECUTABLE;
+
+public:
+	void applyOptions(char option, std::vector<std::string> &values);
+
+	std::string helpStr();
+
+	std::string name();
+
+	std::string extension();
+
+	bool executable();
+
+	void setVerbosity(bool verbosity);
+
+	std::vector<std::uint8_t> compile(const std::vector<std::uint8_t> &object);
+
+	void run(const std::vector<std::uint8_t> &object);
+};
+
+/*
+ * Runs programs without generating machine code, on any machine. It can only
+ * run them; what it compiles is the IR object, unchanged.
+ */
+class InterpreterBackend : public IBackend {
+private:
+	bool verbose = false;
+
+	// The size of the tape, in bytes
+	std::size_t tapeSize = 1024 * 1024;
+
+public:
+	void applyOptions(char option, std::vector<std::string> &values);
+
+	std::string helpStr();
+
+	std::string name();
+
+	std::string extension();
+
+	bool executable();
+
+	void setVerbosity(bool verbosity);
+
+	std::vector<std::uint8_t> compile(const std::vector<std::uint8_t> &object);
+
+	void run(const std::vector<std::uint8_t> &object);
+};
+
+#endif  // _BACKEND_HPP_
@@ -0,0 +1,96 @@
+#ifndef _CACHE_HPP_
+#define _CACHE_HPP_
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * A content-addressed cache of compiler output on disk.
+ *
+ * Each entry is keyed by a hash of everything that determines the output:
+ * the source bytes, the frontend, the flags, the pipeline's components, and
+ * the compiler and object format versions. Entries are written to a
+ * temporary file and renamed into place, so several compilers can safely
+ * share a cache directory. Once the cache grows past its size limit, the
+ * least recently used entries are removed by trim.
+ */
+class Cache {
+private:
+	std::filesystem::path dir;
+	std::uintmax_t maxSize;
+
+	std::atomic<std::uint64_t> hitCount = 0;
+	std::atomic<std::uint64_t> missCount = 0;
+
+	// Makes temporary file names unique within this process
+	std::atomic<std::uint64_t> tmpCounter = 0;
+
+	/*
+	 * Returns the path of an entry in the cache
+	 */
+	std::filesystem::path entryPath(const std::string &key) const;
+
+	/*
+	 * Copy a file to dst by way of a temporary file next to it, so that dst
+	 * is never seen half written.
+	 *
+	 * Returns false if the copy failed.
+	 */
+	bool copyAtomic(const std::filesystem::path &src, const std::filesystem::path &dst);
+
+public:
+	/*
+	 * Open a cache directory, creating it if it does not exist.
+	 *
+	 * dir		The directory to keep the cache in
+	 * maxSize	The size in bytes that trim will shrink the cache to
+	 * Throws std::filesystem::filesystem_error if the directory cannot be
+	 * created.
+	 */
+	Cache(std::filesystem::path dir, std::uintmax_t maxSize);
+
+	Cache(Cache const&) = delete;
+	void operator=(Cache const&) = delete;
+
+	/*
+	 * Compute the key of a compilation.
+	 *
+	 * source		The source bytes
+	 * size			The number of source bytes
+	 * components	Everything else that affects the output, such as the
+	 *				frontend, flags and pipeline components, in a fixed
+	 *				order
+	 * Returns the key as a hex string.
+	 */
+	static std::string key(const char *source, std::size_t size, const std::vector<std::string> &components);
+
+	/*
+	 * Look up an entry and, if it exists, copy it to dstFile. Counts a hit or
+	 * a miss.
+	 *
+	 * Returns true on a hit.
+	 */
+	bool fetch(const std::string &key, const std::string &dstFile);
+
+	/*
+	 * Add the compiled output in srcFile to the cache under key. Failing to
+	 * store an entry is not an error, since the cache is only an optimisation.
+	 */
+	void store(const std::string &key, const std::string &srcFile);
+
+	/*
+	 * Remove the least recently used entries until the cache is no larger
+	 * than its size limit.
+	 */
+	void trim();
+
+	std::uint64_t hits() const;
+	std::uint64_t misses() const;
+};
+
+#endif  // _CACHE_HPP_
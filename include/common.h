@@ -1,10 +1,29 @@
-#ifndef _COMMON_H_
-#define _COMMON_H_
-
-// https://sourceforge.net/p/predef/wiki/Architectures/
-
-#if defined(__alpha__)
-	#define ARCHITECTURE "alpha"
-#elif 
-
-#endif  // _COMMON_H_
+#ifndef _COMMON_H_
+#define _COMMON_H_
+
+/*
+ * The architecture of the machine the compiler is built for, named the way
+ * --arch takes it. Left undefined for architectures not listed here.
+ */
+
+// https://sourceforge.net/p/predef/wiki/Architectures/
+
+#if defined(__alpha__)
+	#define ARCHITECTURE "alpha"
+#elif defined(__x86_64__) || defined(__amd64__) || defined(_M_X64) || defined(_M_AMD64)
+	#define ARCHITECTURE "x86_64"
+#elif defined(__i386__) || defined(_M_IX86)
+	#define ARCHITECTURE "i386"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#define ARCHITECTURE "aarch64"
+#elif defined(__arm__) || defined(_M_ARM)
+	#define ARCHITECTURE "arm"
+#elif defined(__riscv)
+	#define ARCHITECTURE "riscv"
+#elif defined(__powerpc64__) || defined(__ppc64__)
+	#define ARCHITECTURE "ppc64"
+#elif defined(__powerpc__) || defined(__ppc__)
+	#define ARCHITECTURE "ppc"
+#endif
+
+#endif  // _COMMON_H_
@@ -0,0 +1,164 @@
+#ifndef _DECODER_HPP_
+#define _DECODER_HPP_
+
+#include <iterator>
+#include <optional>
+#include <string_view>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ir.hpp"
+#include "object.hpp"
+
+/*
+ * Decoding IR bytecode
+ *
+ * A Decoder reads the bytecode in an IR object without copying it or
+ * allocating. Iterating over a Decoder yields each instruction in turn:
+ *
+ * for (const IR::DecodedInstruction &instr : IR::Decoder(IR::ObjectView(object))) {
+ *   if (instr.opcode == IR::JMP && instr.op2.type == IR::SYMBOL) ...
+ * }
+ *
+ * The decoded instructions point into the object, so the object must outlive
+ * them.
+ */
+
+namespace IR {
+	/*
+	 * A decoded instruction operand. Which fields are valid depends on type.
+	 */
+	struct DecodedOperand {
+		OperandType type = REGISTER;
+
+		// REGISTER and INDIRECT
+		Register reg = R0;
+
+		// LITERAL
+		std::uintmax_t literal = 0;
+
+		// SYMBOL. External symbols have an index into the object's symbol
+		// table, and a name if the decoder has an object to look it up in;
+		// local symbols have the address of the label in the bytecode.
+		bool external = false;
+		std::uint32_t address = 0;
+		std::uint32_t symbol = 0;
+		std::string_view name;
+	};
+
+	/*
+	 * A decoded instruction. Fields which do not apply to the opcode are left
+	 * at their defaults.
+	 */
+	struct DecodedInstruction {
+		// Where the instruction is in the bytecode, and its length in bytes
+		std::size_t offset = 0;
+		std::size_t length = 0;
+
+		Opcode opcode = JMP;
+
+		bool hasSize = false;
+		OperandSize size = WORD;
+
+		bool hasCC = false;
+		Condition cc = AL;
+
+		bool hasOp1 = false;
+		DecodedOperand op1;
+
+		bool hasOp2 = false;
+		DecodedOperand op2;
+
+		// The displacement of the register indirect operands
+		std::int32_t displacement = 0;
+	};
+
+	/*
+	 * A view over IR bytecode which decodes it one instruction at a time.
+	 */
+	class Decoder {
+	private:
+		const std::uint8_t *code;
+		std::size_t codeSize;
+
+		// the object the code is from, for looking up symbol names
+		std::optional<ObjectView> object;
+
+	public:
+		/*
+		 * Iterates over the instructions in the bytecode, in order.
+		 */
+		class iterator {
+			friend class Decoder;
+
+		private:
+			const Decoder *decoder;
+			DecodedInstruction current;
+
+			iterator(const Decoder *decoder, std::size_t offset);
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = DecodedInstruction;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const DecodedInstruction *;
+			using reference = const DecodedInstruction &;
+
+			iterator();
+
+			reference operator*() const;
+			pointer operator->() const;
+
+			iterator &operator++();
+			iterator operator++(int);
+
+			bool operator==(const iterator &other) const;
+		};
+
+		/*
+		 * Construct a decoder over the code section of an object
+		 */
+		Decoder(const ObjectView &object);
+
+		/*
+		 * Construct a decoder over bare bytecode. External symbols decoded
+		 * this way have no names.
+		 *
+		 * code		The bytecode to decode
+		 * size		The size of the bytecode in bytes
+		 */
+		Decoder(const std::uint8_t *code, std::size_t size);
+
+		/*
+		 * Decode a single instruction.
+		 *
+		 * offset	The position of the instruction in the bytecode
+		 * Throws InvalidInstructionException if the instruction is malformed
+		 * or runs past the end of the bytecode.
+		 */
+		DecodedInstruction decode(std::size_t offset) const;
+
+		iterator begin() const;
+		iterator end() const;
+
+		/*
+		 * Returns the size of the bytecode in bytes
+		 */
+		std::size_t size() const;
+	};
+
+	/*
+	 * Rebuild a Program from an IR object. Every local symbol address becomes
+	 * a label, which is named if the object's symbol table names it and
+	 * anonymous otherwise. External symbols are interned by name and the
+	 * source map is carried over. Assembling the result yields the original
+	 * object.
+	 *
+	 * Throws InvalidInstructionException if the bytecode is malformed, or if
+	 * a symbol points into the middle of an instruction.
+	 */
+	Program disassemble(const ObjectView &object);
+}
+
+#endif  // _DECODER_HPP_
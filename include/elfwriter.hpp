@@ -0,0 +1,98 @@
+#ifndef _ELFWRITER_HPP_
+#define _ELFWRITER_HPP_
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Writes machine code and data out as an x86-64 Linux ELF64 file, either a
+ * static executable or a relocatable object to be linked with ld.
+ *
+ * The file has a .text, a .rodata and a .bss section, in that order. In an
+ * executable they are loaded at fixed addresses, which addresses gives so
+ * that the code can be resolved before it is written.
+ */
+class ElfWriter {
+public:
+	enum Section {
+		TEXT, RODATA, BSS
+	};
+
+	/*
+	 * A global symbol
+	 */
+	struct Symbol {
+		std::string name;
+		Section section;
+		std::uint64_t offset;
+	};
+
+	/*
+	 * A 32-bit pc-relative field in .text to be filled in by the linker with
+	 * the address of a section plus addend, less the address of the field
+	 * (R_X86_64_PC32)
+	 */
+	struct Relocation {
+		std::uint64_t offset;	// of the field in .text
+		Section target;
+		std::int64_t addend;
+	};
+
+private:
+	const std::vector<std::uint8_t> &text;
+	const std::vector<std::uint8_t> &rodata;
+	std::uint64_t bssSize;
+
+	std::vector<Symbol> symbols;
+	std::vector<Relocation> relocations;
+
+public:
+	/*
+	 * Construct a writer for the given sections. The contents are not
+	 * copied, so they must outlive the writer.
+	 *
+	 * text		The contents of .text
+	 * rodata	The contents of .rodata
+	 * bssSize	The size of .bss
+	 */
+	ElfWriter(const std::vector<std::uint8_t> &text, const std::vector<std::uint8_t> &rodata,
+			  std::uint64_t bssSize);
+
+	/*
+	 * Add a global symbol to the symbol table
+	 */
+	void addSymbol(const Symbol &symbol);
+
+	/*
+	 * Add a relocation. Only objects have relocations; they are ignored when
+	 * writing an executable.
+	 */
+	void addRelocation(const Relocation &relocation);
+
+	/*
+	 * Returns the address each section is loaded at in an executable,
+	 * indexed by Section.
+	 *
+	 * textSize		The size of .text
+	 * rodataSize	The size of .rodata
+	 */
+	static std::array<std::uint64_t, 3> addresses(std::uint64_t textSize, std::uint64_t rodataSize);
+
+	/*
+	 * Returns a static executable.
+	 *
+	 * entry	The address execution starts at
+	 */
+	std::vector<std::uint8_t> executable(std::uint64_t entry) const;
+
+	/*
+	 * Returns a relocatable object
+	 */
+	std::vector<std::uint8_t> object() const;
+};
+
+#endif  // _ELFWRITER_HPP_
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "ir.hpp"
+#include "pipeline.hpp"
 
 /*
  * A compiler front-end.
@@ -26,9 +27,11 @@ public:
 
 	/*
 	 * Use the front-end to parse a file into a program.
-	 * This function is outward-facing. This means it "takes control" of the
-	 * program, and thus may write directly to output streams and terminate the
-	 * program.
+	 * This function is outward-facing. This means it may write directly to
+	 * output streams. It may be called on several frontend instances from
+	 * different threads at once, so it must not terminate the program.
+	 * Throws std::runtime_error if the file cannot be read or is not a valid
+	 * program, such as one with unmatched brackets.
 	 */
 	virtual std::vector<std::uint8_t> parse(std::string &file) = 0;
 
@@ -38,6 +41,12 @@ public:
 	 */
 	virtual std::string helpStr() = 0;
 
+	/*
+	 * Return the name of the language this frontend parses. This identifies
+	 * the frontend in cache keys, so it must be unique.
+	 */
+	virtual std::string name() = 0;
+
 	/*
 	 * Enable/disable verbose output. If enabled, parse should describe what
 	 * its doing in stdout.
@@ -49,10 +58,53 @@ public:
 	virtual ~IFrontend() {}
 };
 
+/*
+ * An inlet which runs a frontend over the source file and injects the IR
+ * object it produces into the pipeline.
+ */
+class FrontendInlet : public IInlet {
+private:
+	IFrontend *frontend;
+
+public:
+	/*
+	 * Construct a new inlet around a frontend.
+	 *
+	 * frontend	The frontend to parse with. The inlet takes ownership of it.
+	 */
+	FrontendInlet(IFrontend *frontend);
+
+	FrontendInlet(FrontendInlet const&) = delete;
+	void operator=(FrontendInlet const&) = delete;
 
+	void inject(std::string &file, Coupling::Drain &drain);
+
+	~FrontendInlet();
+};
+
+/*
+ * An inlet which injects an IR object that has already been compiled, such
+ * as one written with -S. The file is mapped rather than read, and only its
+ * header is checked, so nothing is parsed however large it is. The object is
+ * copied into a single chunk once, which the later stages take over whole.
+ */
+class ObjectInlet : public IInlet {
+public:
+	/*
+	 * Throws std::runtime_error if the file cannot be read or is not an IR
+	 * object.
+	 */
+	void inject(std::string &file, Coupling::Drain &drain);
+};
 
 /* Frontends */
 class BrainfuckFrontend : public IFrontend {
+private:
+	bool verbose = false;
+
+	// Record where each instruction came from in the source file
+	bool sourceMap = false;
+
 public:
 	void applyOptions(char option, std::vector<std::string> &values);
 
@@ -60,6 +112,8 @@ public:
 
 	std::string helpStr();
 
+	std::string name();
+
 	void setVerbosity(bool verbosity);
 };
 
@@ -0,0 +1,205 @@
+#ifndef _INTERPRETER_HPP_
+#define _INTERPRETER_HPP_
+
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "object.hpp"
+
+/*
+ * Runs an IR object without generating machine code, for machines where
+ * nothing can be mapped executable.
+ *
+ * The variable length bytecode is decoded once, up front, into fixed width
+ * instructions with their jump targets resolved to indices. Each instruction
+ * is specialised by opcode, operand size and operand kinds, and points
+ * straight at the code which runs it, so dispatch is one indirect jump at
+ * the end of each handler (computed goto) rather than a trip through a
+ * switch.
+ *
+ * The program sees the same machine as compiled code: registers hold host
+ * addresses, AR starts at the tape with the object's image copied to it,
+ * and output is buffered and flushed before reading input and at the end.
+ * Code addresses, as held in LR or taken from a label, are instruction
+ * indices.
+ *
+ * Given a loop compiler, execution is tiered: taken jumps back to the top of
+ * a natural loop (as found by IR::Loops) are counted, and once a loop has
+ * gone round often enough it is compiled and the jump enters the compiled
+ * code at the top of the loop instead. The compiled code runs until it
+ * leaves the loop, then hands back to the interpreter.
+ */
+class Interpreter {
+public:
+	/*
+	 * A decoded instruction. The operation picks the handler, which knows
+	 * which of the other fields it uses.
+	 */
+	struct Instruction {
+		// The handler, filled in the first time the program runs
+		const void *handler;
+
+		// Literal operands, already masked to the operand size
+		std::uint64_t literal;
+
+		std::int32_t displacement;
+
+		// The index of the instruction a local jump or call goes to
+		std::uint32_t target;
+
+		std::uint16_t operation;
+
+		// The registers of the first and second operands
+		std::uint8_t op1;
+		std::uint8_t op2;
+
+		std::uint8_t cc;
+		std::uint8_t size;
+	};
+
+	/*
+	 * The machine as a compiled loop sees it when it is entered, and leaves
+	 * it when it exits
+	 */
+	struct State {
+		std::uint64_t registers[8];
+
+		// Z, N, C and V, from the lowest bit up
+		std::uint8_t flags;
+
+		// The output buffer, of BUFFER_SIZE bytes, and how much of it is used
+		std::uint8_t *buffer;
+		std::size_t used;
+	};
+
+	static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+	/*
+	 * How the next handler is found. SWITCH goes back through one switch on
+	 * the operation after each instruction, as a naive interpreter would,
+	 * and is only there to measure THREADED against.
+	 */
+	enum Dispatch {
+		THREADED, SWITCH
+	};
+
+	/*
+	 * A loop compiled to native code
+	 */
+	class ICompiledLoop {
+	public:
+		/*
+		 * Run the loop from the top until it leaves
+		 *
+		 * state	The machine, which is updated in place
+		 * Returns the bytecode address execution continues at.
+		 */
+		virtual std::uint32_t run(State &state) = 0;
+
+		virtual ~ICompiledLoop() {}
+	};
+
+	/*
+	 * Compiles hot loops
+	 */
+	class ILoopCompiler {
+	public:
+		/*
+		 * Compile the loop made by the instructions from start up to end, a
+		 * jump back to start being the last of them.
+		 *
+		 * start	The bytecode address of the top of the loop
+		 * end		The bytecode address just past the jump back
+		 * Returns the compiled loop, or nullptr if the loop can't be
+		 * compiled. Throws std::system_error if memory cannot be mapped.
+		 */
+		virtual ICompiledLoop *compile(std::uint32_t start, std::uint32_t end) = 0;
+
+		virtual ~ILoopCompiler() {}
+	};
+
+private:
+	std::vector<Instruction> code;
+	std::vector<std::uint8_t> image;
+	std::vector<std::uint8_t> output;
+
+	// The index of the instruction the program starts at
+	std::uint32_t entry = 0;
+
+	// Where each instruction is in the bytecode, and the end of it
+	std::vector<std::uint32_t> offsets;
+
+	// Compiles loops, if execution is tiered; not owned
+	ILoopCompiler *compiler = nullptr;
+
+	// How many times a jump back must be taken before its loop is compiled
+	std::uint32_t threshold = 0;
+
+	std::vector<std::unique_ptr<ICompiledLoop>> loops;
+
+	// Set once every handler has been filled in
+	bool threaded = false;
+
+	/*
+	 * Fill in each instruction's handler from its operation. Only the
+	 * function with the handlers in it knows where they are.
+	 */
+	void thread(const void *const *handlers);
+
+	/*
+	 * Run the program on a tape, going through a switch after each
+	 * instruction if Switched
+	 */
+	template<bool Switched>
+	void execute(std::uint8_t *tape);
+
+	/*
+	 * Returns the index of the instruction at a bytecode address
+	 *
+	 * Throws InvalidInstructionException if address is not the start of an
+	 * instruction or the end of the code.
+	 */
+	std::uint32_t index(std::uint32_t address) const;
+
+public:
+	/*
+	 * Decode an object.
+	 *
+	 * Throws InvalidInstructionException if the bytecode is malformed, and
+	 * std::runtime_error if the program calls an external the interpreter
+	 * does not provide.
+	 *
+	 * object		The object to run
+	 * compiler		Compiles hot loops, or nullptr to only interpret. It must
+	 *				outlive the interpreter.
+	 * threshold	How many times a loop goes round before it is compiled
+	 */
+	Interpreter(const IR::ObjectView &object, ILoopCompiler *compiler = nullptr, std::uint32_t threshold = 0);
+
+	/*
+	 * Run the program on a fresh tape. It reads stdin and writes stdout
+	 * directly, and its output is written out by the time this returns.
+	 *
+	 * tapeSize		The size of the tape in bytes
+	 * dispatch		How to get from one instruction to the next
+	 * Throws std::runtime_error if the image does not fit on the tape or the
+	 * program jumps outside itself, and std::system_error if the tape cannot
+	 * be mapped.
+	 */
+	void run(std::size_t tapeSize, Dispatch dispatch = THREADED);
+
+	/*
+	 * Returns the number of instructions decoded
+	 */
+	std::size_t size() const;
+
+	/*
+	 * Returns the number of loops compiled so far
+	 */
+	std::size_t compiled() const;
+};
+
+#endif  // _INTERPRETER_HPP_
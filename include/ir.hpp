@@ -1,13 +1,14 @@
 #ifndef _IR_HPP_
 #define _IR_HPP_
 
-#include <map>
-#include <optional>
+#include <exception>
 #include <ostream>
 #include <string>
-#include <variant>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <cstddef>
 #include <cstdint>
 
 /*
@@ -30,6 +31,9 @@
  * prog (MOV) (R0)[R1];
  * prog (ADD) (R0)(1);
  * prog (MOV) [R1](R0);
+ *
+ * Register indirects may be displaced by a constant, e.g. [R1+4] is written as
+ * prog (MOV) [R1 + 4](R0);
  */
 
 namespace IR {
@@ -50,7 +54,7 @@ namespace IR {
 		/*
 		 * Returns the message of the exception.
 		 */
-		const char *what();
+		const char *what() const noexcept override;
 	};
 
 	/*
@@ -84,9 +88,30 @@ namespace IR {
 	constexpr Register AR = R6;
 	constexpr Register LR = R7;
 
+	/*
+	 * A register with a constant displacement, used to build displaced
+	 * register indirects such as [AR+4]. Created by adding an integer to a
+	 * register.
+	 */
+	struct DisplacedRegister {
+		Register reg;
+		std::int32_t disp;
+	};
+
+	constexpr DisplacedRegister operator+(Register reg, std::int32_t disp) {
+		return {reg, disp};
+	}
+
+	constexpr DisplacedRegister operator-(Register reg, std::int32_t disp) {
+		return {reg, -disp};
+	}
+
 	/*
 	 * IR conditions. The NV condition is added to represent the never
 	 * condition (referred to as !always in the docs).
+	 *
+	 * Conditions test the flags set by the last CMP or TST. No other
+	 * instruction sets the flags, except CALL, after which they are undefined.
 	 */
 	enum Condition {
 		AL = 0b1000, NV = 0b0000,
@@ -116,6 +141,10 @@ namespace IR {
 
 	/*
 	 * Operand size codes
+	 *
+	 * Writing a register at less than DWORD leaves the rest of it undefined,
+	 * so registers should be read at the size they were written at or less.
+	 * AR holds an address, so what ADD and SUB add to it is sign extended.
 	 */
 	enum OperandSize {
 		BYTE	= 0b00,
@@ -125,49 +154,62 @@ namespace IR {
 	};
 
 	/*
-	 * An instruction operand. This type differs from the actual encoding of
-	 * the instruction operands. This struct can represent registers, register
-	 * indirects, symbols, and literals. It is up to the code generator to
-	 * decide how to actually encode these operand values in IR code.
+	 * The ID of a symbol in a SymbolTable
+	 */
+	enum class Symbol : std::uint32_t {};
+
+	/*
+	 * Interns symbol names, so that symbols can be passed around and compared
+	 * as 32-bit IDs. Symbols can also be anonymous, which is useful for labels
+	 * generated by the compiler; these never have a name string at all.
 	 */
-	struct Operand {
-		enum {
-			REGISTER,
-			INDIRECT,
-			SYMBOL,
-			LITERAL
-		} type;
-		std::variant<Register, std::string, std::uintmax_t> value;
+	class SymbolTable {
+	private:
+		std::unordered_map<std::string, Symbol> ids;
+
+		// The name of each symbol, indexed by ID. Points into the keys of
+		// ids, or is nullptr for anonymous symbols.
+		std::vector<const std::string *> names;
 
+	public:
 		/*
-		 * Construct a new operand. This constructor does nothing; if you use
-		 * it you must initialize the struct values yourself.
+		 * Get the symbol with the given name, creating it if necessary.
 		 */
-		Operand();
+		Symbol intern(const std::string &name);
 
 		/*
-		 * Construct a new register operand. This is not and cannot be a
-		 * register indirect.
-		 *
-		 * reg	The register named in this operand.
+		 * Create a new symbol with no name. Anonymous symbols are distinct from
+		 * all other symbols.
 		 */
-		Operand(Register reg);
+		Symbol anonymous();
 
 		/*
-		 * Construct a new symbol operand. A symbol is a string which can
-		 * either be a label, which is resolved by the compiler backend, or an
-		 * external symbol which is resolved by the linker.
-		 *
-		 * sym	The name of the symbol
+		 * Returns the name of sym, or nullptr if it is anonymous.
 		 */
-		Operand(std::string sym);
+		const std::string *name(Symbol sym) const;
 
 		/*
-		 * A literal integer value.
-		 *
-		 * lit	The value
+		 * Returns the number of symbols in the table. All IDs are less than
+		 * this.
 		 */
-		Operand(std::uintmax_t lit);
+		std::size_t size() const;
+	};
+
+	/*
+	 * Write a symbol's name to os. Anonymous symbols are written as .L<id>
+	 */
+	void printSymbol(std::ostream &os, const SymbolTable &symbols, Symbol sym);
+
+	/*
+	 * Operand types. Op1 can only be a register or a register indirect, while
+	 * op2 can be any of these. The values match the encoding of op2's type in
+	 * the instruction byte.
+	 */
+	enum OperandType {
+		REGISTER	= 0b00,
+		INDIRECT	= 0b01,
+		SYMBOL		= 0b10,
+		LITERAL		= 0b11
 	};
 
 	/*
@@ -175,25 +217,43 @@ namespace IR {
 	 * abstraction of the actual bytecode representation; it is meant to store
 	 * the instructions' data until it is time to assemble the instructions
 	 * into IR code to pass to the next phase in the pipeline.
+	 *
+	 * Instructions are small and trivially copyable so that programs can store
+	 * them contiguously. Symbols are stored as IDs into the symbol table of
+	 * the Program the instruction belongs to.
 	 */
 	class Instruction {
 		friend class _InstructionPtr;
 		friend class Program;
 
-		friend std::ostream &operator<<(std::ostream &os, Instruction &inst);
-
 	private:
-		Opcode opcode;
+		// The value of a literal op2, or the symbol ID of a symbol op2
+		std::uint64_t value = 0;
+
+		// The displacement shared by all register indirect operands
+		std::int32_t displacement = 0;
 
-		std::optional<OperandSize> size;
-		std::optional<Condition> cc;
-		std::optional<Operand> op1;
-		std::optional<Operand> op2;
+		std::uint8_t opcode : 4;
+		std::uint8_t size : 2;		// OperandSize
+		std::uint8_t hasSize : 1;
+		std::uint8_t hasCC : 1;
 
-		bool useOpSize = false;
-		bool useCC = false;
-		bool useOp1 = false;
-		bool useOp2 = false;
+		std::uint8_t cc : 4;		// Condition
+		std::uint8_t op1Type : 2;	// OperandType
+		std::uint8_t hasOp1 : 1;
+		std::uint8_t hasOp2 : 1;
+
+		std::uint8_t op1 : 3;		// Register
+		std::uint8_t op2 : 3;		// Register
+		std::uint8_t op2Type : 2;	// OperandType
+
+		/*
+		 * Which fields are valid for this instruction's opcode
+		 */
+		bool useOpSize() const;
+		bool useCC() const;
+		bool useOp1() const;
+		bool useOp2() const;
 
 	public:
 		/*
@@ -201,9 +261,69 @@ namespace IR {
 		 */
 		Instruction(Opcode opcode);
 
-		operator std::string&() const;
+		/*
+		 * Read access to the instruction, for passes and backends
+		 */
+		Opcode getOpcode() const;
+
+		/*
+		 * Returns the operand size, which is WORD if none was given
+		 */
+		OperandSize getSize() const;
+
+		/*
+		 * Returns the condition code, which is AL if none was given
+		 */
+		Condition getCondition() const;
+
+		bool hasOperand1() const;
+		OperandType getOp1Type() const;
+		Register getOp1() const;
+
+		bool hasOperand2() const;
+		OperandType getOp2Type() const;
+
+		/*
+		 * Returns the register of a REGISTER or INDIRECT op2
+		 */
+		Register getOp2() const;
+
+		/*
+		 * Returns the value of a LITERAL op2
+		 */
+		std::uint64_t getLiteral() const;
+
+		/*
+		 * Returns the symbol of a SYMBOL op2
+		 */
+		Symbol getSymbol() const;
+
+		/*
+		 * Returns the displacement of the register indirect operands
+		 */
+		std::int32_t getDisplacement() const;
+
+		/*
+		 * Write access, for passes. These do not check that the instruction
+		 * stays valid: the opcode can only be changed to one which takes the
+		 * same operands, and the other setters only apply to instructions
+		 * which already have that kind of operand.
+		 */
+		void setOpcode(Opcode opcode);
+		void setCondition(Condition cc);
+		void setLiteral(std::uint64_t literal);
+		void setSymbol(Symbol sym);
 	};
 
+	/*
+	 * Set in a symbol slot in the bytecode which refers to an external symbol.
+	 * The rest of the slot is the index of the symbol in the object's symbol
+	 * table. Otherwise the slot holds the address of a local label.
+	 */
+	constexpr std::uint32_t EXTERNAL_SYMBOL = 0x80000000;
+
+	class Program;
+
 	/*
 	 * A helper class for Instruction and Program. This class is not meant to
 	 * be instantiated by the programmer. It is returned by members of Program
@@ -215,12 +335,21 @@ namespace IR {
 		friend class Program;
 
 	private:
-		Instruction *ptr;
+		Program *prog;
+		std::size_t index;  // index of the instruction in prog
+
+		/*
+		 * Construct a new _InstructionPtr that points to the instruction at
+		 * index i in prog
+		 */
+		_InstructionPtr(Program *prog, std::size_t i);
+
+		Instruction &instruction();
 
 		/*
-		 * Construct a new _InstructionPtr that points to Instruction i
+		 * Add a register or register indirect argument
 		 */
-		_InstructionPtr(Instruction *i);
+		void addRegister(OperandType type, Register reg, std::int32_t disp, const char *error);
 
 	public:
 		/*
@@ -245,13 +374,32 @@ namespace IR {
 		 */
 		_InstructionPtr &operator[](Register reg);
 
+		/*
+		 * Adds a displaced register indirect argument to the instruction. If
+		 * both arguments are register indirects they must share the same
+		 * displacement.
+		 *
+		 * reg	The displaced register indirect argument to add
+		 * Returns a reference to this
+		 */
+		_InstructionPtr &operator[](DisplacedRegister reg);
+
 		/*
 		 * Add a symbol argument
 		 *
 		 * sym	The symbol argument to add
 		 * Returns a reference to this
 		 */
-		_InstructionPtr &operator()(std::string sym);
+		_InstructionPtr &operator()(Symbol sym);
+
+		/*
+		 * Add a symbol argument by name. The name is interned into the
+		 * program's symbol table.
+		 *
+		 * sym	The name of the symbol argument to add
+		 * Returns a reference to this
+		 */
+		_InstructionPtr &operator()(const std::string &sym);
 
 		/*
 		 * Add a integer literal argument
@@ -275,18 +423,157 @@ namespace IR {
 	 * assembly-like interface to create IR bytecode.
 	 */
 	class Program {
+		friend class _InstructionPtr;
 		friend std::ostream &operator<<(std::ostream &os, Program &prog);
 	private:
-		std::vector<Instruction *> instructions;
+		std::vector<Instruction> instructions;
 
 		/* The symbol table */
-		std::map<std::string, std::size_t> symTable;
+		SymbolTable symbolTable;
+
+		/*
+		 * The index of the instruction each label points to, indexed by
+		 * symbol ID. Symbols which are not labels are UNDEFINED, or past the
+		 * end of this vector; these are external symbols.
+		 */
+		std::vector<std::size_t> symbolTargets;
+
+		/*
+		 * Labels with the index of the instruction they point to, in
+		 * ascending order of index so that they can be matched up with
+		 * instructions in one pass. Labels added in the middle of the program
+		 * by passes are appended, and the list is sorted again the next time
+		 * it is used.
+		 */
+		mutable std::vector<std::pair<std::size_t, Symbol>> labels;
+		mutable bool labelsSorted = true;
+
+		/*
+		 * Put the labels back in order, if a pass has added any out of order
+		 */
+		void sortLabels() const;
+
+		/*
+		 * Positions in the source file, with the index of the first
+		 * instruction generated from each. Sorted like labels.
+		 */
+		std::vector<std::pair<std::size_t, std::uint32_t>> sourceLocations;
+
+		/* The initial memory at AR, and output written before main */
+		std::vector<std::uint8_t> initialImage;
+		std::string initialOutput;
+
+		/*
+		 * Returns true if sym is a label in this program
+		 */
+		bool isLocal(Symbol sym) const;
+
+		/*
+		 * Write an instruction in assembly syntax to os
+		 */
+		void print(std::ostream &os, const Instruction &instruction) const;
 
 	public:
+		// Returned by target for symbols which are not labels
+		static constexpr std::size_t UNDEFINED = SIZE_MAX;
+
+		/*
+		 * Returns the symbol table used by this program. Frontends should
+		 * intern their symbols here once, and refer to them by ID afterwards.
+		 */
+		SymbolTable &symbols();
+		const SymbolTable &symbols() const;
+
+		/*
+		 * Returns the number of instructions in the program
+		 */
+		std::size_t size() const;
+
+		/*
+		 * Returns the instruction at index
+		 */
+		const Instruction &operator[](std::size_t index) const;
+		Instruction &operator[](std::size_t index);
+
+		/*
+		 * Returns the labels in the program in order, each with the index of
+		 * the instruction it points to. A label may point one past the last
+		 * instruction.
+		 */
+		const std::vector<std::pair<std::size_t, Symbol>> &getLabels() const;
+
+		/*
+		 * Returns the index of the instruction the label sym points to, or
+		 * UNDEFINED if sym is not a label in this program.
+		 */
+		std::size_t target(Symbol sym) const;
+
+		/*
+		 * Returns the initial contents of the memory AR points to when the
+		 * program starts. Memory past the end of the image is zero.
+		 */
+		std::vector<std::uint8_t> &image();
+		const std::vector<std::uint8_t> &image() const;
+
+		/*
+		 * Returns the output written before main runs
+		 */
+		std::string &output();
+		const std::string &output() const;
+
+		/*
+		 * Add a label pointing at an existing instruction
+		 *
+		 * lbl		The label, which must not already be a label
+		 * index	The index of the instruction, or size() for the end
+		 */
+		void label(Symbol lbl, std::size_t index);
+
+		/*
+		 * Remove instructions from the program. Labels and source positions
+		 * which pointed at a removed instruction move to the next one which
+		 * was not removed.
+		 *
+		 * dead		Which instructions to remove, indexed by instruction
+		 */
+		void erase(const std::vector<bool> &dead);
+
+		/*
+		 * Remove labels from the program. Their symbols stay in the symbol
+		 * table, but no longer refer to any instruction.
+		 *
+		 * dead		Which labels to remove, indexed by symbol ID. Symbols
+		 *			past the end are kept.
+		 */
+		void removeLabels(const std::vector<bool> &dead);
+
+		/*
+		 * Remove anonymous labels which no instruction refers to. Named
+		 * labels are kept, since they may be referred to from outside.
+		 *
+		 * Returns the number of labels removed.
+		 */
+		std::size_t pruneLabels();
+
 		/*
 		 * Add a label to the program
 		 */
-		void label(std::string lbl);
+		void label(Symbol lbl);
+
+		/*
+		 * Add a label to the program by name. The name is interned into the
+		 * program's symbol table.
+		 */
+		void label(const std::string &lbl);
+
+		/*
+		 * Record that the instructions added after this call were generated
+		 * from the given position in the source file. This is used to build
+		 * the source map of the object.
+		 *
+		 * offset	The offset in the source file, in bytes
+		 */
+		void source(std::uint32_t offset);
 
 		/*
 		 * Add an instruction with the given opcode to the program. The return value
@@ -302,17 +589,15 @@ namespace IR {
 		_InstructionPtr operator()(Pseudoinstruction pseudo);
 
 		/*
-		 * Assemble this program into IR bytecode. After calling this function,
-		 * the Program object is invalid and will not assemble properly again
+		 * Assemble this program into an IR object (see object.hpp). Named
+		 * labels are added to the object's symbol table, and a label called
+		 * main becomes the entry point.
 		 *
-		 * Returns the bytecode in a vector.
+		 * Returns the object in a vector.
 		 * Throws InvalidInstructionException if there is an error in the
 		 * Instructions.
 		 */
 		std::vector<std::uint8_t> assemble();
-
-
-		~Program();
 	};
 }
 
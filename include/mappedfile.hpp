@@ -0,0 +1,45 @@
+#ifndef _MAPPEDFILE_HPP_
+#define _MAPPEDFILE_HPP_
+
+#include <string>
+
+#include <cstddef>
+
+/*
+ * A read-only view of a file's contents, mapped into memory. The mapping is
+ * released when the object is destroyed. Files which can't be mapped, such as
+ * pipes, are read into memory instead.
+ */
+class MappedFile {
+private:
+	const char *bytes = nullptr;
+	std::size_t length = 0;
+
+public:
+	/*
+	 * Map the given file into memory, or read it if it is not a regular
+	 * file.
+	 *
+	 * file		The path of the file to map
+	 * Throws std::system_error if the file cannot be opened, mapped or read.
+	 */
+	MappedFile(const std::string &file);
+
+	MappedFile(MappedFile const&) = delete;
+	void operator=(MappedFile const&) = delete;
+
+	/*
+	 * Returns a pointer to the first byte of the file. This is nullptr if the
+	 * file is empty.
+	 */
+	const char *data() const;
+
+	/*
+	 * Returns the size of the file in bytes
+	 */
+	std::size_t size() const;
+
+	~MappedFile();
+};
+
+#endif  // _MAPPEDFILE_HPP_
@@ -0,0 +1,205 @@
+#ifndef _OBJECT_HPP_
+#define _OBJECT_HPP_
+
+#include <exception>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * IR object files
+ *
+ * Program::assemble produces an IR object, which is what flows between the
+ * stages of the compiler and what gets cached or shipped between builds. An
+ * object is laid out so that it can be mapped into memory and used in place,
+ * without any parsing:
+ *
+ * +--------------+
+ * | ObjectHeader |  magic, version, entry point, instruction count, and the
+ * +--------------+  location of each section
+ * | code         |  the IR bytecode
+ * | symbols      |  ObjectSymbol[]
+ * | relocations  |  ObjectRelocation[]
+ * | strings      |  null-terminated symbol names
+ * | source map   |  SourceMapEntry[], optional (may be empty)
+ * | image        |  initial memory at AR, optional
+ * | output       |  output written before main, optional
+ * +--------------+
+ *
+ * All integers are little endian, and every section starts on an 8 byte
+ * boundary. Local symbol slots in the code hold the address of the label in
+ * the code section. External symbol slots hold EXTERNAL_SYMBOL ORed with the
+ * index of the symbol in the symbol table, and have a relocation entry.
+ *
+ * A program starts with AR pointing at zeroed memory, the start of the tape.
+ * If the object has an image, the memory at AR is initialised with it
+ * instead, and if it has an output section, that is written to the output in
+ * one go before main runs. Both are produced by partial evaluation, which
+ * runs the start of a program at compile time.
+ *
+ * Memory below the start of the tape is not part of the machine, and IR must
+ * never access it, even when the access would not change anything. When a
+ * program is run in process, an inaccessible guard page sits there so that
+ * one which does faults straight away; in an executable, what is there is
+ * unspecified.
+ */
+
+namespace IR {
+	/*
+	 * Thrown when an IR object is malformed.
+	 */
+	class InvalidObjectException : public std::exception {
+	private:
+		const char *message;
+	public:
+		/*
+		 * Construct a new InvalidObjectException with a message
+		 *
+		 * msg	A message explaining this exception.
+		 */
+		InvalidObjectException(const char *msg);
+
+		/*
+		 * Returns the message of the exception.
+		 */
+		const char *what() const noexcept override;
+	};
+
+	constexpr std::uint8_t OBJECT_MAGIC[4] = {0x7F, 'A', 'B', 'C'};
+	constexpr std::uint16_t OBJECT_VERSION = 2;
+
+	// The entry point of an object with no main label
+	constexpr std::uint32_t NO_ENTRY = 0xFFFFFFFF;
+
+	/*
+	 * The location of a section, relative to the start of the object
+	 */
+	struct ObjectSection {
+		std::uint32_t offset;
+		std::uint32_t size;		// in bytes
+	};
+
+	struct ObjectHeader {
+		std::uint8_t magic[4];
+		std::uint16_t version;
+		std::uint16_t headerSize;
+		std::uint32_t entry;	// address of main in the code, or NO_ENTRY
+		std::uint32_t instructions;	// number of instructions in the code
+
+		ObjectSection code;
+		ObjectSection symbols;
+		ObjectSection relocations;
+		ObjectSection strings;
+		ObjectSection sourceMap;
+		ObjectSection image;
+		ObjectSection output;
+	};
+
+	struct ObjectSymbol {
+		enum : std::uint32_t {
+			EXTERNAL	= 0,	// resolved by the linker or runtime
+			DEFINED		= 1		// a label in the code section
+		};
+
+		std::uint32_t name;		// offset into the string table
+		std::uint32_t flags;
+		std::uint32_t value;	// address of a DEFINED symbol
+	};
+
+	/*
+	 * A symbol slot in the code which must be filled in with the address of an
+	 * external symbol.
+	 */
+	struct ObjectRelocation {
+		std::uint32_t offset;	// address of the 4 byte slot in the code
+		std::uint32_t symbol;	// index into the symbol table
+	};
+
+	/*
+	 * Maps a position in the code to the position in the source file it was
+	 * generated from. Entries are sorted by code address, and each one covers
+	 * the code up to the next entry.
+	 */
+	struct SourceMapEntry {
+		std::uint32_t address;
+		std::uint32_t source;
+	};
+
+	/*
+	 * A read-only view of an IR object in memory. Constructing a view only
+	 * checks the header, so it takes constant time regardless of the size of
+	 * the object. The object must outlive the view.
+	 */
+	class ObjectView {
+	private:
+		const ObjectHeader *header;
+		const std::uint8_t *base;
+
+	public:
+		/*
+		 * Construct a view of the object in data[0:size].
+		 *
+		 * Throws InvalidObjectException if the data is not a valid IR object
+		 * of this version, or is not suitably aligned.
+		 */
+		ObjectView(const std::uint8_t *data, std::size_t size);
+
+		ObjectView(const std::vector<std::uint8_t> &data);
+
+		/*
+		 * Returns the address of main in the code section, or NO_ENTRY
+		 */
+		std::uint32_t entry() const;
+
+		/*
+		 * Returns the number of instructions in the code section
+		 */
+		std::uint32_t instructions() const;
+
+		std::span<const std::uint8_t> code() const;
+		std::span<const ObjectSymbol> symbols() const;
+		std::span<const ObjectRelocation> relocations() const;
+		std::span<const SourceMapEntry> sourceMap() const;
+		std::span<const std::uint8_t> image() const;
+		std::span<const std::uint8_t> output() const;
+
+		/*
+		 * Returns the name of a symbol
+		 */
+		std::string_view name(const ObjectSymbol &symbol) const;
+	};
+
+	/*
+	 * Collects the sections of an IR object and lays them out.
+	 */
+	struct ObjectBuilder {
+		std::uint32_t entry = NO_ENTRY;
+		std::uint32_t instructions = 0;
+
+		std::vector<std::uint8_t> code;
+		std::vector<ObjectSymbol> symbols;
+		std::vector<ObjectRelocation> relocations;
+		std::string strings;
+		std::vector<SourceMapEntry> sourceMap;
+		std::vector<std::uint8_t> image;
+		std::string output;
+
+		/*
+		 * Add a symbol to the symbol table.
+		 *
+		 * Returns the index of the new symbol.
+		 */
+		std::uint32_t addSymbol(std::string_view name, std::uint32_t flags, std::uint32_t value);
+
+		/*
+		 * Returns the complete object
+		 */
+		std::vector<std::uint8_t> build() const;
+	};
+}
+
+#endif  // _OBJECT_HPP_
@@ -0,0 +1,20 @@
+#ifndef _OUTLETS_HPP_
+#define _OUTLETS_HPP_
+
+#include <string>
+
+#include "pipeline.hpp"
+
+/*
+ * An outlet which writes the IR object flowing out of the pipeline directly
+ * to the destination file.
+ */
+class ObjectOutlet : public IOutlet {
+public:
+	/*
+	 * Throws std::runtime_error if the file cannot be written.
+	 */
+	void deliver(std::string &file, Coupling::Source &source);
+};
+
+#endif  // _OUTLETS_HPP_
@@ -0,0 +1,189 @@
+#ifndef _PASSES_HPP_
+#define _PASSES_HPP_
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include "analysis.hpp"
+#include "ir.hpp"
+#include "pipeline.hpp"
+
+/*
+ * Optimisation passes
+ *
+ * A pass transforms an IR::Program in place. Passes are registered with
+ * PassFactory under a name, and a PassManager runs a list of them in order.
+ * Passes declare the analyses they need up front, and report which analyses
+ * are still valid after they run, so that the AnalysisManager only has to
+ * recompute what a pass actually changed.
+ *
+ * The passes run inside the pipeline as a single pipe (PassPipe), which
+ * disassembles the object flowing into it, runs every pass over the program,
+ * and assembles the result. If no pass changed anything, the object it was
+ * given is passed on instead.
+ */
+
+/*
+ * A set of analyses, as a bitmask
+ */
+typedef std::uint32_t AnalysisSet;
+
+constexpr AnalysisSet NO_ANALYSES			= 0;
+constexpr AnalysisSet CFG_ANALYSIS			= 1 << 0;
+constexpr AnalysisSet CELL_OFFSETS_ANALYSIS	= 1 << 1;
+constexpr AnalysisSet DOMINATORS_ANALYSIS	= 1 << 2;
+constexpr AnalysisSet LOOPS_ANALYSIS		= 1 << 3;
+constexpr AnalysisSet CELL_VALUES_ANALYSIS	= 1 << 4;
+constexpr AnalysisSet ALL_ANALYSES			= ~static_cast<AnalysisSet>(0);
+
+/*
+ * Computes analyses of a program on demand, and keeps them until they are
+ * invalidated.
+ */
+class AnalysisManager {
+private:
+	const IR::Program &program;
+
+	std::unique_ptr<IR::CFG> cfg;
+	std::unique_ptr<IR::CellOffsets> cellOffsets;
+	std::unique_ptr<IR::Dominators> dominators;
+	std::unique_ptr<IR::Loops> loops;
+	std::unique_ptr<IR::CellValues> cellValues;
+
+	// How many times each analysis has been computed
+	std::size_t cfgComputed = 0;
+	std::size_t cellOffsetsComputed = 0;
+	std::size_t dominatorsComputed = 0;
+	std::size_t loopsComputed = 0;
+	std::size_t cellValuesComputed = 0;
+
+public:
+	/*
+	 * Construct a manager for a program. The program must outlive it.
+	 */
+	AnalysisManager(const IR::Program &program);
+
+	/*
+	 * Compute the given analyses if they are not already valid
+	 */
+	void require(AnalysisSet analyses);
+
+	/*
+	 * Throw away every analysis which is not in preserved
+	 */
+	void invalidate(AnalysisSet preserved);
+
+	const IR::CFG &getCFG();
+	const IR::CellOffsets &getCellOffsets();
+	const IR::Dominators &getDominators();
+	const IR::Loops &getLoops();
+	const IR::CellValues &getCellValues();
+
+	/*
+	 * Print how many times each analysis was computed
+	 */
+	void report(std::ostream &os) const;
+};
+
+/*
+ * An optimisation pass
+ */
+class IPass {
+public:
+	/*
+	 * Returns the analyses the pass uses. These are computed before the pass
+	 * runs.
+	 */
+	virtual AnalysisSet required() = 0;
+
+	/*
+	 * Run the pass over a program.
+	 *
+	 * program		The program to transform
+	 * analyses		Analyses of the program as it was before the pass
+	 * Returns the analyses which are still valid for the transformed
+	 * program. A pass which did not change anything should return
+	 * ALL_ANALYSES.
+	 */
+	virtual AnalysisSet run(IR::Program &program, AnalysisManager &analyses) = 0;
+
+	/*
+	 * Print statistics about what the pass did, if it keeps any
+	 */
+	virtual void report(std::ostream &os) {}
+
+	virtual ~IPass() {}
+};
+
+typedef PipelineComponentFactory<IPass> PassFactory;
+
+/*
+ * Runs a list of passes over a program
+ */
+class PassManager {
+private:
+	std::vector<std::pair<std::string, std::unique_ptr<IPass>>> passes;
+
+	bool verbose = false;
+
+public:
+	/*
+	 * Returns the passes run at an optimisation level
+	 *
+	 * level	The level, from 0 to 3. -O3 and above are currently the same as -O2.
+	 */
+	static std::vector<std::string> level(unsigned level);
+
+	/*
+	 * Add a pass to the end of the list
+	 *
+	 * name		The name the pass is registered with in PassFactory
+	 * Throws std::out_of_range if no pass has that name.
+	 */
+	void add(const std::string &name);
+
+	/*
+	 * Returns true if there are no passes to run
+	 */
+	bool empty() const;
+
+	/*
+	 * Enable/disable verbose output. If enabled, run reports what each pass
+	 * did on stdout.
+	 */
+	void setVerbosity(bool verbosity);
+
+	/*
+	 * Run every pass over a program, in order
+	 *
+	 * Returns true if any pass changed the program.
+	 */
+	bool run(IR::Program &program);
+};
+
+/*
+ * A pipe which runs a PassManager over the object flowing through it
+ */
+class PassPipe : public IPipe {
+private:
+	PassManager passes;
+
+public:
+	/*
+	 * Construct a pipe which runs the given passes
+	 *
+	 * names	The names of the passes, in order
+	 * verbose	Whether to report what each pass did
+	 * Throws std::out_of_range if any pass is not registered.
+	 */
+	PassPipe(const std::vector<std::string> &names, bool verbose = false);
+
+	void pump(Coupling::Source &source, Coupling::Drain &drain);
+};
+
+#endif  // _PASSES_HPP_
@@ -1,19 +1,28 @@
 #ifndef _PIPELINE_HPP_
 #define _PIPELINE_HPP_
 
+#include <atomic>
+#include <chrono>
 #include <forward_list>
 #include <functional>
 #include <initializer_list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "stats.hpp"
 
 /*
  * The pipeline is created at the start of compilation, by installing different
  * components together to create a complete pipeline that flows from source
- * code to executable code. The different components comprising the pipeline
- * run synchronous to each other -- that is, they all are executing at the same
- * time. Each component feeds data into the next component as soon as it can.
+ * code to executable code. Each component runs on its own thread, and reads
+ * what the one before it produces through a coupling.
  *
  * At the start of the pipeline is the 'inlet', which takes an input file and
  * outputs IR, which will flow through the rest of the pipeline
@@ -24,6 +33,19 @@
  * At the intermediate phases of the pipeline there can be many different
  * components, or none at all. Since all of these components both take in and
  * yield IR, they can be assembled in any order.
+ *
+ * Components only overlap as far as they can work on part of their input.
+ * None of the current ones can: the frontend only knows what goes in the
+ * object header once it has parsed everything, and the passes and backends
+ * look at the whole program. So each stage waits for the one before it to
+ * finish, and a flow takes about as long as all of its stages put together.
+ * The threads still let a failing stage stop the others straight away, and
+ * separate inputs overlap when several are compiled at once.
+ *
+ * TODO: stream the object between stages, so that a flow takes about as long
+ * as its slowest stage. This needs an object format which can be written
+ * before the whole program is known (e.g. with the header at the end), and
+ * passes and backends which can work a chunk at a time.
  */
 
 template <typename T>
@@ -47,7 +69,7 @@ public:
 	 * registered.
 	 */
 	int registerComponent(std::function<T*()> func, std::initializer_list<std::string> names) {
-		for (std::string &name : names) {
+		for (const std::string &name : names) {
 			if (!registeredComponents.contains(name)) {
 				registeredComponents[name] = func;
 			} else {
@@ -77,17 +99,118 @@ public:
 };
 
 /*
- * Connects two pipes
+ * A chunk of product flowing through the pipeline. Chunks are always moved
+ * from one component to the next, never copied.
+ */
+typedef std::vector<std::uint8_t> Chunk;
+
+/*
+ * A pool of chunk buffers shared by every component of a pipeline. Producers
+ * take buffers from the pool instead of allocating them, and consumers give
+ * them back once they are done with them, so a pipeline only ever holds
+ * about as many buffers as it has chunks in flight.
+ */
+class ChunkPool {
+public:
+	// The capacity of a pooled chunk
+	static constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+
+private:
+	std::mutex mutex;
+	std::vector<Chunk> buffers;
+	std::size_t limit;
+
+public:
+	/*
+	 * Construct a new pool.
+	 *
+	 * limit	The most unused buffers to hold on to. Buffers released
+	 *			beyond this are freed.
+	 */
+	ChunkPool(std::size_t limit = 64);
+
+	ChunkPool(ChunkPool const&) = delete;
+	void operator=(ChunkPool const&) = delete;
+
+	/*
+	 * Take an empty chunk with a capacity of at least CHUNK_SIZE from the
+	 * pool, allocating one if the pool is empty.
+	 */
+	Chunk acquire();
+
+	/*
+	 * Give a chunk back to the pool. Chunks which are too small to be reused,
+	 * or much larger than CHUNK_SIZE (such as whole objects), are freed.
+	 *
+	 * chunk	The chunk to move into the pool
+	 */
+	void release(Chunk &&chunk);
+};
+
+/*
+ * Connects two pipes. A coupling is a bounded single-producer single-consumer
+ * queue of chunks: exactly one thread writes to the drain, and exactly one
+ * thread reads from the source. It does not take any locks; readers and
+ * writers only block (without spinning) when the coupling is empty or full,
+ * so a slow consumer exerts backpressure on its producer.
+ *
+ * A coupling can be cancelled from any thread, which makes any current or
+ * future reads and writes throw Coupling::Cancelled.
+ *
+ * Couplings also count what flows through them and how long each end spent
+ * waiting, for PipelineStats. These counters are only safe to read once both
+ * ends are done with the coupling.
  */
 class Coupling {
 public:
+	/*
+	 * Thrown by reads and writes on a cancelled coupling.
+	 */
+	class Cancelled : public std::exception {
+	public:
+		const char *what() const noexcept;
+	};
+
 	/*
 	 * The source end of the coupling, i.e. where it connects to the next pipe.
 	 * This object is used to read from the previous component in the pipeline.
 	 */
 	class Source {
+		friend class Coupling;
+
 	private:
-		Source();
+		Coupling *coupling;
+
+		Source(Coupling *coupling);
+
+	public:
+		/*
+		 * Take the next chunk out of the coupling, waiting for one to be
+		 * written if necessary.
+		 *
+		 * chunk	Where to move the chunk to
+		 * Returns false if the drain has been closed and every chunk has
+		 * been read.
+		 * Throws Coupling::Cancelled if the coupling is cancelled.
+		 */
+		bool read(Chunk &chunk);
+
+		/*
+		 * Read every chunk up to the end, as one. Stages which need the
+		 * whole object use this; an object written as a single chunk is
+		 * moved rather than copied.
+		 *
+		 * Throws Coupling::Cancelled if the coupling is cancelled.
+		 */
+		Chunk collect();
+
+		/*
+		 * Give a chunk that has been read, and which will not be passed
+		 * on, back to the pool so that a producer can reuse it.
+		 *
+		 * chunk	The chunk to recycle
+		 */
+		void release(Chunk &&chunk);
 	};
 
 	/*
@@ -95,16 +218,115 @@ public:
 	 * pipe. This object is used to write to the next component in the pipeline
 	 */
 	class Drain {
+		friend class Coupling;
+
 	private:
-		Drain();
+		Coupling *coupling;
+
+		Drain(Coupling *coupling);
+
+	public:
+		/*
+		 * Put a chunk into the coupling, waiting for room if it is full.
+		 *
+		 * chunk	The chunk to move into the coupling
+		 * Throws Coupling::Cancelled if the coupling is cancelled.
+		 */
+		void write(Chunk &&chunk);
+
+		/*
+		 * Copy a buffer into the coupling, split into pooled chunks.
+		 *
+		 * data		The bytes to write
+		 * size		The number of bytes to write
+		 * Throws Coupling::Cancelled if the coupling is cancelled.
+		 */
+		void write(const std::uint8_t *data, std::size_t size);
+
+		/*
+		 * Take an empty chunk from the pool to fill and write.
+		 */
+		Chunk acquire();
+
+		/*
+		 * Signal that no more chunks will be written. Must be called by the
+		 * writer when it is done, so that the reader can finish.
+		 */
+		void close();
 	};
 
 	friend class Coupling::Source;
 	friend class Coupling::Drain;
 private:
+	static constexpr std::size_t CACHE_LINE = 64;
+
+	// Set in tail once the drain has been closed
+	static constexpr std::size_t CLOSED = std::size_t(1) << (sizeof(std::size_t) * 8 - 1);
+	// Set in both head and tail once the coupling has been cancelled
+	static constexpr std::size_t CANCELLED = CLOSED >> 1;
+	// The position part of head and tail
+	static constexpr std::size_t POSITION = ~(CLOSED | CANCELLED);
+
+	ChunkPool *pool;
+
+	std::unique_ptr<Chunk[]> ring;
+	std::size_t mask;	// capacity - 1
+
+	// Free-running read and write positions, on separate cache lines so that
+	// the reader and writer do not contend. Each side also keeps a private
+	// copy of the other side's last seen position, so it only has to touch the
+	// shared line when it looks like the ring is empty/full.
+	alignas(CACHE_LINE) std::atomic<std::size_t> head = 0;	// written by the source
+	std::size_t cachedTail = 0;
+	std::chrono::steady_clock::duration sourceWaiting{};
+
+	alignas(CACHE_LINE) std::atomic<std::size_t> tail = 0;	// written by the drain
+	std::size_t cachedHead = 0;
+	std::chrono::steady_clock::duration drainWaiting{};
+	std::uint64_t bytesWritten = 0;
+	std::uint64_t instructionsWritten = 0;
+
+	alignas(CACHE_LINE) Source source;
+	Drain drain;
 
 public:
-	Coupling();
+	/*
+	 * Construct a new coupling.
+	 *
+	 * pool		The pool to recycle chunks through
+	 * capacity	The number of chunks the coupling can hold before the drain
+	 *			blocks. Rounded up to a power of two.
+	 */
+	Coupling(ChunkPool &pool, std::size_t capacity = 16);
+
+	Coupling(Coupling const&) = delete;
+	void operator=(Coupling const&) = delete;
+
+	Source &getSource();
+	Drain &getDrain();
+
+	/*
+	 * Cancel the coupling, waking up the reader and writer. Safe to call from
+	 * any thread, any number of times.
+	 */
+	void cancel();
+
+	/*
+	 * Returns the number of bytes written to the coupling
+	 */
+	std::uint64_t bytes() const;
+
+	/*
+	 * Returns the number of instructions in the IR object written to the
+	 * coupling, taken from its header
+	 */
+	std::uint64_t instructions() const;
+
+	/*
+	 * Returns the time the reader and writer spent waiting, in seconds
+	 */
+	double sourceBlockedTime() const;
+	double drainBlockedTime() const;
 };
 
 /*
@@ -127,7 +349,17 @@ public:
 typedef PipelineComponentFactory<IInlet> InletFactory;
 
 /*
- * A pipe somewhere in the middle of a pipeline
+ * A pipe somewhere in the middle of a pipeline.
+ *
+ * Pipes should pass chunks along by moving them rather than copying their
+ * contents. A pipe which only changes a few bytes can edit a chunk in place
+ * and write that same chunk to its drain, and can splice in extra chunks
+ * taken from Drain::acquire. Chunks which are not passed on should be handed
+ * back with Source::release.
+ *
+ * The frontend writes its object as a single chunk, so a pipe which needs
+ * the whole object can take it with Source::collect without copying it, and
+ * write it on unchanged if it has nothing to do.
  */
 class IPipe {
 public:
@@ -137,7 +369,7 @@ public:
 	 * source	The source to get product from
 	 * drain	The drain to pump product to.
 	 */
-	virtual void pump(Coupling::Source &source, Coupling::Drain &drain);
+	virtual void pump(Coupling::Source &source, Coupling::Drain &drain) = 0;
 
 	virtual ~IPipe() {}
 };
@@ -148,6 +380,7 @@ typedef PipelineComponentFactory<IPipe> PipeFactory;
  * An outlet from a pipeline
  */
 class IOutlet {
+public:
 	/*
 	 * Deliver the final product to the given file
 	 *
@@ -156,7 +389,7 @@ class IOutlet {
 	 * source	The input from the previous pipeline component.
 	 */
 	virtual void deliver(std::string &file, Coupling::Source &source) = 0;
-	
+
 	virtual ~IOutlet() {}
 };
 
@@ -172,6 +405,13 @@ private:
 	std::vector<IPipe *> pipes;
 	IOutlet *outlet;
 
+	// The name of the inlet, each pipe and the outlet, in order
+	std::vector<std::string> names;
+
+	ChunkPool pool;
+
+	PipelineStats statistics;
+
 public:
 	/*
 	 * Construct a new pipeline from inlet to outlet.
@@ -183,6 +423,18 @@ public:
 	 */
 	Pipeline(std::string inlet, std::string outlet);
 
+	/*
+	 * Construct a new pipeline from an already configured inlet and outlet.
+	 * The pipeline takes ownership of both.
+	 *
+	 * inletName	The name to report the inlet's statistics under
+	 * outletName	The name to report the outlet's statistics under
+	 */
+	Pipeline(IInlet *inlet, IOutlet *outlet, std::string inletName = "inlet", std::string outletName = "outlet");
+
+	Pipeline(Pipeline const&) = delete;
+	void operator=(Pipeline const&) = delete;
+
 	/*
 	 * Install a segment of pipe between inlet and outlet. This pipe will be
 	 * installed after the last installed pipe segment, if any.
@@ -193,7 +445,23 @@ public:
 	void addPipe(std::string pipe);
 
 	/*
-	 * Flow code from the source file to the destination file.
+	 * Install an already configured segment of pipe. The pipeline takes
+	 * ownership of it.
+	 *
+	 * pipe		The pipe to install
+	 * name		The name to report the pipe's statistics under
+	 */
+	void addPipe(IPipe *pipe, std::string name);
+
+	/*
+	 * Flow code from the source file to the destination file. The inlet, each
+	 * pipe and the outlet run on their own threads, connected by couplings,
+	 * although each one currently waits for the whole object before it does
+	 * anything. Returns once the outlet has delivered everything.
+	 *
+	 * If any component throws, every coupling is cancelled so that the other
+	 * components stop, and the first exception is rethrown from here once
+	 * all of them have.
 	 *
 	 * srcFile	The source file, passed to the inlet
 	 * dstFile	The destination file, passed to the outlet. This file is
@@ -201,6 +469,13 @@ public:
 	 */
 	void flow(std::string srcFile, std::string dstFile);
 
+	/*
+	 * Returns statistics about each stage of the last flow. If the flow
+	 * failed, these only cover the work done before it did.
+	 */
+	const PipelineStats &stats() const;
+
+	~Pipeline();
 };
 
 #endif  // _PIPELINE_HPP_
@@ -0,0 +1,72 @@
+#ifndef _STATS_HPP_
+#define _STATS_HPP_
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+/*
+ * Statistics collected about each stage of a pipeline while it flows.
+ *
+ * These are always collected, so they have to stay cheap: clocks and the
+ * process's peak RSS are only read when a stage starts and finishes, and
+ * inside a coupling only when it actually has to wait. Allocation is not
+ * instrumented at all.
+ */
+struct StageStats {
+	std::string name;
+
+	double wallTime = 0;		// seconds
+	double cpuTime = 0;			// seconds of CPU time used by the stage's thread
+	double blockedTime = 0;		// seconds spent waiting on its couplings
+
+	std::uint64_t bytesIn = 0;
+	std::uint64_t bytesOut = 0;
+	std::uint64_t instructionsIn = 0;
+	std::uint64_t instructionsOut = 0;
+
+	// How far the peak RSS of the process rose between the stage before
+	// finishing and this one finishing, in bytes. Stages wait for the whole
+	// object before they start, so this is the memory the stage needed
+	// beyond what earlier stages already had. When several inputs are
+	// compiled at once, other jobs contribute too.
+	std::uint64_t peakRSSIncrease = 0;
+};
+
+struct PipelineStats {
+	std::string input;			// the source file that flowed through
+	std::vector<StageStats> stages;
+
+	double wallTime = 0;		// seconds
+	std::uint64_t peakRSS = 0;	// peak resident set size of the process, in bytes
+
+	/*
+	 * Print a human readable table of the statistics.
+	 *
+	 * os		The stream to print to
+	 */
+	void print(std::ostream &os) const;
+
+	/*
+	 * Print the statistics as a JSON object.
+	 *
+	 * os		The stream to print to
+	 */
+	void printJSON(std::ostream &os) const;
+};
+
+namespace Stats {
+	/*
+	 * Returns the CPU time used by this thread so far, in seconds
+	 */
+	double threadCPUTime();
+
+	/*
+	 * Returns the peak resident set size of the process so far, in bytes
+	 */
+	std::uint64_t peakRSS();
+}
+
+#endif  // _STATS_HPP_
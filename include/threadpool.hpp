@@ -0,0 +1,93 @@
+#ifndef _THREADPOOL_HPP_
+#define _THREADPOOL_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+/*
+ * A fixed-size pool of worker threads. Each worker has its own deque of jobs,
+ * which it takes work from the back of. A worker whose deque is empty steals
+ * from the front of the other workers' deques, so one worker drawing a run of
+ * slow jobs does not hold up the rest of the pool.
+ */
+class ThreadPool {
+public:
+	typedef std::function<void()> Job;
+
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+
+	// The worker to give the next submitted job to
+	std::size_t nextWorker = 0;
+
+	// Guards the counts below, and is what idle workers and wait() sleep on
+	std::mutex stateMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable allDone;
+
+	std::size_t queued = 0;		// jobs in a deque
+	std::size_t pending = 0;	// jobs which have not finished
+	bool stopping = false;
+
+	/*
+	 * Take a job for a worker, from its own deque or by stealing one.
+	 *
+	 * index	The index of the worker
+	 * job		Where to move the job to
+	 * Returns false if there was no job to take.
+	 */
+	bool take(std::size_t index, Job &job);
+
+	/*
+	 * The body of each worker thread
+	 */
+	void work(std::size_t index);
+
+public:
+	/*
+	 * Start a new pool.
+	 *
+	 * threads	The number of worker threads. If 0, one per hardware thread.
+	 */
+	ThreadPool(std::size_t threads = 0);
+
+	ThreadPool(ThreadPool const&) = delete;
+	void operator=(ThreadPool const&) = delete;
+
+	/*
+	 * Queue a job to be run by one of the workers. Jobs must not throw.
+	 *
+	 * job		The job to run
+	 */
+	void submit(Job job);
+
+	/*
+	 * Wait until every submitted job has finished.
+	 */
+	void wait();
+
+	/*
+	 * Returns the number of worker threads
+	 */
+	std::size_t size() const;
+
+	/*
+	 * Waits for every submitted job to finish, then stops the workers.
+	 */
+	~ThreadPool();
+};
+
+#endif  // _THREADPOOL_HPP_
@@ -0,0 +1,656 @@
+#ifndef _X86_64_HPP_
+#define _X86_64_HPP_
+
+#include <array>
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "decoder.hpp"
+#include "interpreter.hpp"
+#include "ir.hpp"
+#include "object.hpp"
+
+/*
+ * The x86-64 backend
+ *
+ * The backend is split in two. Lowering walks the bytecode of an IR object
+ * and describes the x86-64 code for it to an IEmitter, one instruction at a
+ * time; the emitter decides what to make of it. AsmEmitter writes GNU
+ * assembly, and Encoder writes machine code directly, for ElfWriter to wrap
+ * in an object or executable without going through as and ld.
+ *
+ * Registers are allocated statically, following asm.S:
+ *
+ *   R0-R5	r8, r9, r10, r11, r13, r14
+ *   AR		rbx, the address of the current cell
+ *   LR		r15
+ *   		r12b caches the byte at [rbx] within a basic block
+ *   		rax, rcx, rdx, rsi and rdi are scratch
+ *
+ * Programs run on a tape in .bss, or one passed in when the program is run
+ * in process by Jit, with the object's image copied to the start of it and
+ * its output written before main. Output is buffered, and flushed before
+ * reading input and when the program ends.
+ *
+ * Lowering can also lower a single loop, for the interpreter to run once it
+ * is hot (see Interpreter). The loop is a function which takes the state of
+ * the machine in rbp, and shares the interpreter's output buffer.
+ */
+
+namespace X86_64 {
+	enum Register : std::uint8_t {
+		RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15
+	};
+
+	/*
+	 * x86 condition codes, numbered as in the encoding of Jcc
+	 */
+	enum Condition : std::uint8_t {
+		O, NO, B, AE, E, NE, BE, A,
+		S, NS, P, NP, L, GE, LE, G,
+		ALWAYS
+	};
+
+	/*
+	 * Instructions an emitter understands. Operand sizes use IR::OperandSize,
+	 * so WORD is 32 bits and DWORD is 64 bits.
+	 *
+	 * Most take a destination and a source. The exceptions are:
+	 *   MOVZX	zero extends a BYTE or HWORD source into a 32-bit register
+	 *   MOVSX	sign extends a source of the given size into a 64-bit register
+	 *   LEA	always 64 bits
+	 *   IMUL	destination must be a register; an immediate source uses the
+	 *			three operand form
+	 *   DIV	divides rdx:rax by its only operand
+	 *   SHL, SHR, SAR	the source is an immediate or rcx
+	 *   NOT, PUSH, POP, JMP, CALL	take one operand; PUSH, POP, JMP and
+	 *			CALL are always 64 bits
+	 *   RET, SYSCALL, STC, PUSHF, POPF, REP_MOVSB	take none
+	 */
+	enum Opcode : std::uint8_t {
+		MOV, MOVZX, MOVSX, LEA,
+		ADD, SUB, AND, OR, XOR, CMP, TEST,
+		IMUL, DIV, NOT,
+		SHL, SHR, SAR,
+		PUSH, POP, JMP, CALL,
+		RET, SYSCALL, STC, PUSHF, POPF, REP_MOVSB
+	};
+
+	/*
+	 * A label in the emitted code or data, from IEmitter::label
+	 */
+	typedef std::uint32_t Label;
+
+	/*
+	 * An instruction operand: a register, memory at a register plus a
+	 * displacement, memory at a label plus a displacement (addressed relative
+	 * to rip), or an immediate.
+	 */
+	struct Operand {
+		enum Kind : std::uint8_t {
+			NONE, REG, MEM, LABEL, IMM
+		};
+
+		Kind kind = NONE;
+		Register reg = RAX;		// REG, or the base of MEM
+		Label label = 0;		// LABEL
+		std::int32_t disp = 0;	// MEM and LABEL
+		std::int64_t imm = 0;	// IMM
+	};
+
+	constexpr Operand reg(Register r) {
+		return {Operand::REG, r, 0, 0, 0};
+	}
+
+	constexpr Operand mem(Register base, std::int32_t disp = 0) {
+		return {Operand::MEM, base, 0, disp, 0};
+	}
+
+	constexpr Operand at(Label label, std::int32_t disp = 0) {
+		return {Operand::LABEL, RAX, label, disp, 0};
+	}
+
+	constexpr Operand imm(std::int64_t value) {
+		return {Operand::IMM, RAX, 0, 0, value};
+	}
+
+	/*
+	 * Receives the code and data produced by lowering.
+	 */
+	class IEmitter {
+	public:
+		enum Section {
+			TEXT, RODATA, BSS
+		};
+
+		/*
+		 * Create a new label. It can be used before it is bound.
+		 *
+		 * name		The name of a global symbol, or empty for a local label
+		 */
+		virtual Label label(const std::string &name = "") = 0;
+
+		/*
+		 * Place a label at the current position of the current section
+		 */
+		virtual void bind(Label label) = 0;
+
+		/*
+		 * Switch to another section. Code and data go at the end of it.
+		 */
+		virtual void section(Section section) = 0;
+
+		/*
+		 * Pad the current section to a multiple of alignment bytes
+		 */
+		virtual void align(std::size_t alignment) = 0;
+
+		/*
+		 * Emit an instruction (see Opcode)
+		 */
+		virtual void emit(Opcode opcode, IR::OperandSize size, Operand dst = {}, Operand src = {}) = 0;
+
+		/*
+		 * Emit a jump to a label, which is conditional unless cc is ALWAYS
+		 */
+		virtual void jump(Condition cc, Label target) = 0;
+
+		/*
+		 * Emit a call to a label
+		 */
+		virtual void call(Label target) = 0;
+
+		/*
+		 * Emit data into the current section, which must not be BSS
+		 */
+		virtual void data(const std::uint8_t *bytes, std::size_t size) = 0;
+
+		/*
+		 * Reserve zeroed space in BSS
+		 */
+		virtual void reserve(std::size_t size) = 0;
+
+		virtual ~IEmitter() {}
+	};
+
+	/*
+	 * An emitter which writes GNU assembly in Intel syntax, to be assembled
+	 * and linked with as and ld.
+	 */
+	class AsmEmitter : public IEmitter {
+	private:
+		std::string text;
+
+		// The names of global labels, by label; empty for local labels
+		std::vector<std::string> names;
+
+		void printOperand(const Operand &operand, IR::OperandSize size);
+		void printLabel(Label label);
+
+	public:
+		AsmEmitter();
+
+		Label label(const std::string &name = "");
+		void bind(Label label);
+		void section(Section section);
+		void align(std::size_t alignment);
+		void emit(Opcode opcode, IR::OperandSize size, Operand dst = {}, Operand src = {});
+		void jump(Condition cc, Label target);
+		void call(Label target);
+		void data(const std::uint8_t *bytes, std::size_t size);
+		void reserve(std::size_t size);
+
+		/*
+		 * Returns the assembly written so far
+		 */
+		const std::string &str() const;
+	};
+
+	/*
+	 * An emitter which encodes machine code. Jumps and references to labels
+	 * are left as fixups until resolve, since they may be to labels which
+	 * have not been bound yet or are in sections which have not been placed.
+	 *
+	 * Only TEXT takes instructions. Backward jumps which reach use the short
+	 * form; forward jumps always take a 32-bit displacement.
+	 */
+	class Encoder : public IEmitter {
+	public:
+		/*
+		 * A 32-bit field in TEXT which must hold the address of a label plus
+		 * disp, relative to the end of the instruction it is in
+		 */
+		struct Fixup {
+			std::uint32_t offset;	// of the field in TEXT
+			std::uint32_t end;		// of the instruction
+			Label label;
+			std::int32_t disp;
+		};
+
+		/*
+		 * A named label
+		 */
+		struct Symbol {
+			std::string name;
+			Section section;
+			std::uint64_t offset;
+		};
+
+	private:
+		struct LabelInfo {
+			std::string name;
+			Section section = TEXT;
+			std::uint64_t offset = 0;
+			bool bound = false;
+		};
+
+		std::vector<std::uint8_t> text;
+		std::vector<std::uint8_t> rodata;
+		std::uint64_t bssSize = 0;
+		Section current = TEXT;
+
+		std::vector<LabelInfo> labels;
+		std::vector<Fixup> fixups;
+
+		/*
+		 * Returns the current size of a section
+		 */
+		std::uint64_t size(Section section) const;
+
+		/*
+		 * Append an immediate of the given number of bytes to TEXT
+		 */
+		void immediate(std::int64_t value, int bytes);
+
+		/*
+		 * Encode an instruction with a ModRM byte.
+		 *
+		 * size		Sets the operand size prefixes: 0x66 for HWORD, REX.W for
+		 *			DWORD
+		 * opcode	The opcode bytes
+		 * reg		The register in the reg field
+		 * rm		The register or memory operand
+		 * immBytes	The size of the immediate which follows, if any
+		 * value	The immediate
+		 */
+		void modrm(IR::OperandSize size, std::initializer_list<std::uint8_t> opcode, Register reg,
+				   const Operand &rm, int immBytes = 0, std::int64_t value = 0);
+
+		/*
+		 * Encode an instruction with a ModRM byte whose reg field holds an
+		 * opcode extension rather than a register. Otherwise as modrm.
+		 */
+		void modrm(IR::OperandSize size, std::initializer_list<std::uint8_t> opcode, int extension,
+				   const Operand &rm, int immBytes = 0, std::int64_t value = 0);
+
+		// Both of the above; byte registers 4-7 in the reg field need a REX
+		// prefix, but opcode extensions don't
+		void modrm(IR::OperandSize size, std::initializer_list<std::uint8_t> opcode, int reg,
+				   bool isRegister, const Operand &rm, int immBytes, std::int64_t value);
+
+		/*
+		 * Emit a jump or call with a 32-bit displacement to a label
+		 */
+		void branch(std::initializer_list<std::uint8_t> opcode, Label target);
+
+	public:
+		Label label(const std::string &name = "");
+		void bind(Label label);
+		void section(Section section);
+		void align(std::size_t alignment);
+		void emit(Opcode opcode, IR::OperandSize size, Operand dst = {}, Operand src = {});
+		void jump(Condition cc, Label target);
+		void call(Label target);
+		void data(const std::uint8_t *bytes, std::size_t size);
+		void reserve(std::size_t size);
+
+		const std::vector<std::uint8_t> &getText() const;
+		const std::vector<std::uint8_t> &getRodata() const;
+		std::uint64_t getBssSize() const;
+
+		/*
+		 * Returns the section and offset of a bound label
+		 */
+		Section labelSection(Label label) const;
+		std::uint64_t labelOffset(Label label) const;
+
+		/*
+		 * Returns every named label
+		 */
+		std::vector<Symbol> symbols() const;
+
+		/*
+		 * Fill in every fixup, given the address of each section.
+		 *
+		 * Throws std::runtime_error if a label is out of reach, or was never
+		 * bound.
+		 */
+		void resolve(const std::array<std::uint64_t, 3> &addresses);
+
+		/*
+		 * Fill in the fixups to labels in TEXT, which don't depend on where
+		 * it is placed, and return the rest.
+		 *
+		 * Throws std::runtime_error if a label was never bound.
+		 */
+		std::vector<Fixup> resolveLocal();
+	};
+
+	/*
+	 * The machine as a compiled loop finds it in rbp, and leaves it
+	 */
+	struct LoopState {
+		std::uint64_t registers[8];
+		std::uint64_t rflags;
+
+		std::uint8_t *buffer;
+		std::uint64_t used;
+	};
+
+	/*
+	 * Lowers the bytecode of an IR object to x86-64.
+	 */
+	class Lowering {
+	private:
+		const IR::ObjectView &object;
+		IEmitter &out;
+
+		std::vector<IR::DecodedInstruction> code;
+
+		// The label of each instruction which is jumped to, and of the end of
+		// the program; NO_LABEL for the rest
+		static constexpr Label NO_LABEL = 0xFFFFFFFF;
+		std::vector<Label> labels;
+
+		// Set for each instruction after which the flags are used before
+		// they are set again
+		std::vector<bool> flagsLive;
+
+		// Set if any condition tests the carry flag, which TST clears
+		bool usesCarry = false;
+
+		// Runtime routines and data
+		Label putcLabel, getcLabel, scanLabel, flushLabel, writeLabel, exitLabel;
+		Label bufferLabel, bufferUsedLabel;
+
+		// Set when the program is a function, which returns to its caller
+		// rather than exiting
+		bool hosted = false;
+
+		// Set when lowering a loop, which is the code from start up to end.
+		// Jumps out of it leave the function through an exit for where they
+		// were going.
+		bool region = false;
+		std::uint32_t start = 0;
+		std::uint32_t end = 0;
+
+		std::vector<std::pair<std::uint32_t, Label>> exits;
+
+		// Set for each instruction which uses the cell when a later one in
+		// the same block does too. Only then is the cell worth loading into
+		// r12b.
+		std::vector<bool> cellReused;
+
+		// Whether r12b holds the byte at [rbx], and whether it has been
+		// changed since it was loaded
+		bool cellCached = false;
+		bool cellDirty = false;
+
+		// The instruction being lowered
+		std::size_t current = 0;
+
+		Lowering(const IR::ObjectView &object, IEmitter &emitter, std::uint32_t start, std::uint32_t end,
+				 bool region, bool carry);
+
+		/*
+		 * Returns the index of the instruction at address in the bytecode
+		 *
+		 * Throws InvalidInstructionException if address is not the start of
+		 * an instruction or the end of the code.
+		 */
+		std::size_t index(std::uint32_t address) const;
+
+		/*
+		 * Returns whether a jump to address leaves the code being lowered
+		 */
+		bool leaves(std::uint32_t address) const;
+
+		/*
+		 * Returns the label to jump to for an address in the bytecode, which
+		 * is the exit for it if it leaves the loop being lowered
+		 */
+		Label target(std::uint32_t address);
+
+		/*
+		 * Find what the program jumps to, where the flags are live and where
+		 * the cell is reused
+		 */
+		void analyse();
+
+		/*
+		 * Returns the label of the runtime routine for an external symbol
+		 *
+		 * Throws std::runtime_error if the runtime has no such routine.
+		 */
+		Label external(const IR::DecodedOperand &symbol);
+
+		/*
+		 * Store r12b back to [rbx] if it has been changed. Does not touch the
+		 * flags.
+		 */
+		void flushCell();
+
+		/*
+		 * Forget the cached cell, storing it first if necessary
+		 */
+		void dropCell();
+
+		/*
+		 * Returns the x86 operand for an IR operand, loading the cell into
+		 * r12b first if the operand is the cell and it is reused. Literals are masked to the
+		 * operand size, and symbols are loaded into rcx.
+		 *
+		 * written	Whether the instruction writes the operand
+		 * readOld	Whether it reads the value before writing it
+		 */
+		Operand operand(const IR::DecodedInstruction &instr, const IR::DecodedOperand &op,
+						bool written, bool readOld = true);
+
+		void lowerInstruction(std::size_t i);
+		void lowerJump(const IR::DecodedInstruction &instr);
+		void lowerCall(const IR::DecodedInstruction &instr);
+
+		/*
+		 * Emit the runtime routines which the program calls
+		 */
+		void runtime();
+
+		/*
+		 * Emit the program from where rbx has been pointed at the tape: the
+		 * setup of the tape and registers, the code, the runtime and the
+		 * data, less the tape
+		 */
+		void program();
+
+	public:
+		/*
+		 * Decode an object for lowering.
+		 *
+		 * Throws InvalidInstructionException if the bytecode is malformed.
+		 */
+		Lowering(const IR::ObjectView &object, IEmitter &emitter);
+
+		/*
+		 * Decode part of an object, to lower it as a loop.
+		 *
+		 * start	The bytecode address of the top of the loop
+		 * end		The bytecode address just past the jump back
+		 * carry	Whether the code the loop leaves to may test the carry
+		 *			flag, as testsCarry tells
+		 * Throws InvalidInstructionException if the bytecode is malformed.
+		 */
+		Lowering(const IR::ObjectView &object, IEmitter &emitter, std::uint32_t start, std::uint32_t end,
+				 bool carry);
+
+		/*
+		 * Returns whether any condition in an object tests the carry flag.
+		 * Only then must TST clear it, which costs an instruction after
+		 * every test.
+		 *
+		 * Throws InvalidInstructionException if the bytecode is malformed.
+		 */
+		static bool testsCarry(const IR::ObjectView &object);
+
+		/*
+		 * Emit a complete program, with a _start which sets up the tape, runs
+		 * main and exits.
+		 *
+		 * tapeSize		The size of the tape in bytes
+		 * Returns the label of _start.
+		 * Throws std::runtime_error if the image does not fit on the tape, or
+		 * the program calls an external the runtime does not provide.
+		 */
+		Label executable(std::size_t tapeSize);
+
+		/*
+		 * Emit a complete program as a function which can be called as
+		 * void (*)(std::uint8_t *tape). It keeps the registers the System V
+		 * ABI requires of it, and returns when the program ends.
+		 *
+		 * Returns the label of the function.
+		 * Throws std::runtime_error if the program calls an external the
+		 * runtime does not provide.
+		 */
+		Label function();
+
+		/*
+		 * Returns whether the code can be lowered as a loop. It must leave
+		 * code addresses alone, since the interpreter has its own: it may
+		 * only call runtime routines and jump to labels.
+		 */
+		bool loopable() const;
+
+		/*
+		 * Emit the code as a function which can be called as
+		 * std::uint32_t (*)(LoopState *). It runs from the top until it jumps
+		 * out, then returns the bytecode address it was jumping to. Only
+		 * code which is loopable can be lowered this way.
+		 *
+		 * Returns the label of the function.
+		 */
+		Label loop();
+
+		/*
+		 * Returns the number of IR instructions lowered
+		 */
+		std::size_t size() const;
+	};
+
+	/*
+	 * An IR object compiled into memory, to be run in this process. The code
+	 * is encoded into a writable mapping which is then made read-only and
+	 * executable, so no page is ever writable and executable at once.
+	 */
+	class Jit {
+	private:
+		// Code and read-only data, followed by the runtime's writable data
+		std::uint8_t *memory = nullptr;
+		std::size_t mapped = 0;
+
+		std::size_t codeSize = 0;
+		std::size_t imageSize = 0;
+
+		void (*entry)(std::uint8_t *tape) = nullptr;
+
+	public:
+		/*
+		 * Compile an object into memory.
+		 *
+		 * Throws InvalidInstructionException if the bytecode is malformed,
+		 * std::runtime_error if the program calls an external the runtime
+		 * does not provide, and std::system_error if memory cannot be
+		 * mapped.
+		 */
+		Jit(const IR::ObjectView &object);
+
+		Jit(Jit const&) = delete;
+		void operator=(Jit const&) = delete;
+
+		/*
+		 * Run the program on a fresh tape. It reads stdin and writes stdout
+		 * directly, and its output is written out by the time this returns.
+		 *
+		 * tapeSize		The size of the tape in bytes
+		 * Throws std::runtime_error if the image does not fit on the tape,
+		 * and std::system_error if the tape cannot be mapped.
+		 */
+		void run(std::size_t tapeSize) const;
+
+		/*
+		 * Returns the number of bytes of machine code
+		 */
+		std::size_t size() const;
+
+		~Jit();
+	};
+
+	/*
+	 * A hot loop compiled into memory, like Jit
+	 */
+	class CompiledLoop : public Interpreter::ICompiledLoop {
+	private:
+		std::uint8_t *memory = nullptr;
+		std::size_t mapped = 0;
+
+		std::uint32_t (*entry)(LoopState *state) = nullptr;
+
+	public:
+		/*
+		 * Load a loop lowered by Lowering::loop.
+		 *
+		 * encoder	The encoder it was lowered into
+		 * function	The label of the function
+		 * Throws std::system_error if memory cannot be mapped.
+		 */
+		CompiledLoop(Encoder &encoder, Label function);
+
+		CompiledLoop(CompiledLoop const&) = delete;
+		void operator=(CompiledLoop const&) = delete;
+
+		std::uint32_t run(Interpreter::State &state);
+
+		~CompiledLoop();
+	};
+
+	/*
+	 * Compiles the loops of an object for the interpreter, for tiered
+	 * execution
+	 */
+	class LoopCompiler : public Interpreter::ILoopCompiler {
+	private:
+		const IR::ObjectView &object;
+
+		// Whether anything in the object tests the carry flag, which is found
+		// out when the first loop is compiled. Most programs never get that
+		// far.
+		bool carry = false;
+		bool scanned = false;
+
+	public:
+		/*
+		 * object	The object the interpreter is running. It must outlive the
+		 *			compiler.
+		 */
+		LoopCompiler(const IR::ObjectView &object);
+
+		Interpreter::ICompiledLoop *compile(std::uint32_t start, std::uint32_t end);
+	};
+}
+
+#endif  // _X86_64_HPP_
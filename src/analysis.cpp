@@ -0,0 +1,939 @@
+#include <algorithm>
+#include <string>
+
+#include <climits>
+
+#include "analysis.hpp"
+#include "decoder.hpp"
+
+namespace IR {
+	/*******
+	 * CFG *
+	 *******/
+	CFG::CFG(const Program &program) {
+		std::size_t n = program.size();
+
+		std::vector<bool> leaders(n + 1, false);
+		for (auto &[index, symbol] : program.getLabels()) {
+			leaders[index] = true;
+		}
+
+		std::vector<std::uint32_t> targets(n, NOT_JUMP);
+		std::vector<bool> conditional(n, false);
+
+		for (std::size_t i=0; i < n; ++i) {
+			const Instruction &instruction = program[i];
+			Condition cc = instruction.getCondition();
+
+			// jmp nv is a nop
+			if (instruction.getOpcode() != JMP || cc == NV) continue;
+
+			targets[i] = UNKNOWN_TARGET;
+			conditional[i] = cc != AL;
+
+			if (instruction.getOp2Type() == SYMBOL) {
+				std::size_t target = program.target(instruction.getSymbol());
+
+				if (target != Program::UNDEFINED) targets[i] = target;
+			}
+		}
+
+		// The entry is main if there is one
+		std::uint32_t entry = NOT_JUMP;
+
+		for (auto &[index, symbol] : program.getLabels()) {
+			const std::string *name = program.symbols().name(symbol);
+
+			if (name && *name == "main" && index < n) {
+				entry = index;
+			}
+		}
+
+		build(leaders, targets, conditional, entry);
+	}
+
+	CFG::CFG(const ObjectView &object) {
+		Decoder decoder(object);
+
+		// The address of each instruction, and where it jumps
+		std::vector<std::uint32_t> addresses;
+		std::vector<std::uint32_t> targets;
+		std::vector<bool> conditional;
+
+		addresses.reserve(object.instructions());
+		targets.reserve(object.instructions());
+		conditional.reserve(object.instructions());
+
+		for (const DecodedInstruction &instr : decoder) {
+			bool jumps = instr.opcode == JMP && instr.cc != NV;
+
+			addresses.push_back(instr.offset);
+			conditional.push_back(jumps && instr.cc != AL);
+
+			if (!jumps) {
+				targets.push_back(NOT_JUMP);
+			} else if (instr.op2.type == SYMBOL && !instr.op2.external) {
+				// resolved to an index once every address is known
+				targets.push_back(instr.op2.address);
+			} else {
+				targets.push_back(UNKNOWN_TARGET);
+			}
+		}
+
+		std::size_t n = addresses.size();
+
+		// The index of the instruction at an address, which may be the end
+		auto index = [&](std::uint32_t address) -> std::uint32_t {
+			if (address == decoder.size()) return n;
+
+			auto it = std::lower_bound(addresses.begin(), addresses.end(), address);
+
+			if (it == addresses.end() || *it != address) {
+				throw InvalidInstructionException("Jump into the middle of an instruction");
+			}
+
+			return it - addresses.begin();
+		};
+
+		std::vector<bool> leaders(n + 1, false);
+
+		for (std::size_t i=0; i < n; ++i) {
+			if (targets[i] != NOT_JUMP && targets[i] != UNKNOWN_TARGET) {
+				targets[i] = index(targets[i]);
+				leaders[targets[i]] = true;
+			}
+		}
+
+		for (const ObjectSymbol &symbol : object.symbols()) {
+			if (symbol.flags & ObjectSymbol::DEFINED) {
+				leaders[index(symbol.value)] = true;
+			}
+		}
+
+		std::uint32_t entry = NOT_JUMP;
+		if (object.entry() != NO_ENTRY && object.entry() < decoder.size()) {
+			entry = index(object.entry());
+		}
+
+		build(leaders, targets, conditional, entry);
+	}
+
+	void CFG::build(std::vector<bool> &leaders, const std::vector<std::uint32_t> &targets,
+					const std::vector<bool> &conditional, std::uint32_t entry) {
+		std::size_t n = targets.size();
+
+		// Find the leaders, i.e. the first instruction of each block
+		leaders[0] = true;
+
+		for (std::size_t i=0; i < n; ++i) {
+			if (targets[i] != NOT_JUMP) {
+				leaders[i + 1] = true;
+			}
+		}
+
+		blocks.resize(n);
+		for (std::size_t i=0; i < n; ++i) {
+			if (leaders[i]) {
+				starts.push_back(i);
+			}
+
+			blocks[i] = starts.size() - 1;
+		}
+		starts.push_back(n);
+
+		// Find the successors of each block
+		std::size_t count = size();
+		fallthroughs.resize(count, EXIT);
+		branches.resize(count, EXIT);
+		unknownBranches.resize(count, false);
+
+		for (BlockID block=0; block < count; ++block) {
+			std::size_t last = end(block) - 1;
+			bool endsProgram = end(block) == n;
+
+			if (targets[last] != NOT_JUMP) {
+				if (conditional[last] && !endsProgram) {
+					fallthroughs[block] = block + 1;
+				}
+
+				if (targets[last] == UNKNOWN_TARGET) {
+					unknownBranches[block] = true;
+				} else if (targets[last] < n) {
+					branches[block] = blocks[targets[last]];
+				}
+			} else if (!endsProgram) {
+				fallthroughs[block] = block + 1;
+			}
+		}
+
+		// Collect predecessors by counting them first, so that they can be
+		// stored in one array
+		predStarts.resize(count + 1, 0);
+		for (BlockID block=0; block < count; ++block) {
+			for (BlockID succ : {fallthroughs[block], branches[block]}) {
+				if (succ != EXIT) ++predStarts[succ + 1];
+			}
+		}
+
+		for (std::size_t i=0; i < count; ++i) {
+			predStarts[i + 1] += predStarts[i];
+		}
+
+		preds.resize(predStarts[count]);
+		std::vector<std::uint32_t> fill(predStarts.begin(), predStarts.end() - 1);
+		for (BlockID block=0; block < count; ++block) {
+			for (BlockID succ : {fallthroughs[block], branches[block]}) {
+				if (succ != EXIT) preds[fill[succ]++] = block;
+			}
+		}
+
+		if (count > 0) {
+			entryBlock = entry == NOT_JUMP ? 0 : blocks[entry];
+		}
+	}
+
+	std::size_t CFG::size() const {
+		return starts.size() - 1;
+	}
+
+	CFG::BlockID CFG::entry() const {
+		return entryBlock;
+	}
+
+	std::size_t CFG::begin(BlockID block) const {
+		return starts[block];
+	}
+
+	std::size_t CFG::end(BlockID block) const {
+		return starts[block + 1];
+	}
+
+	CFG::BlockID CFG::block(std::size_t instruction) const {
+		return blocks[instruction];
+	}
+
+	CFG::BlockID CFG::fallthrough(BlockID block) const {
+		return fallthroughs[block];
+	}
+
+	CFG::BlockID CFG::branch(BlockID block) const {
+		return branches[block];
+	}
+
+	bool CFG::unknownBranch(BlockID block) const {
+		return unknownBranches[block];
+	}
+
+	std::span<const CFG::BlockID> CFG::predecessors(BlockID block) const {
+		return {preds.data() + predStarts[block], preds.data() + predStarts[block + 1]};
+	}
+
+
+	/***************
+	 * CellOffsets *
+	 ***************/
+	CellOffsets::CellOffsets(const Program &program, const CFG &cfg)
+		: offsets(program.size()), deltas(cfg.size()) {
+		// The runtime routines which leave AR where it is
+		auto preservesAR = [&program](Symbol symbol) {
+			const std::string *name = program.symbols().name(symbol);
+
+			return name && (*name == "putc" || *name == "getc");
+		};
+
+		for (CFG::BlockID block=0; block < cfg.size(); ++block) {
+			std::int64_t offset = 0;
+
+			for (std::size_t i=cfg.begin(block); i < cfg.end(block); ++i) {
+				const Instruction &instruction = program[i];
+				offsets[i] = offset;
+
+				if (offset == UNKNOWN) continue;
+
+				Opcode opcode = instruction.getOpcode();
+				bool writesAR = instruction.hasOperand1() && instruction.getOp1Type() == REGISTER
+					&& instruction.getOp1() == AR && opcode != CMP && opcode != TST;
+
+				if (writesAR && (opcode == ADD || opcode == SUB) && instruction.getOp2Type() == LITERAL) {
+					// Sign extend the literal from the operand size
+					int bits = 8 << instruction.getSize();
+					std::int64_t amount = static_cast<std::int64_t>(instruction.getLiteral() << (64 - bits)) >> (64 - bits);
+
+					offset += opcode == ADD ? amount : -amount;
+				} else if (writesAR) {
+					offset = UNKNOWN;
+				} else if (opcode == CALL && !(instruction.getOp2Type() == SYMBOL && preservesAR(instruction.getSymbol()))) {
+					offset = UNKNOWN;
+				}
+			}
+
+			deltas[block] = offset;
+		}
+	}
+
+	std::int64_t CellOffsets::offset(std::size_t instruction) const {
+		return offsets[instruction];
+	}
+
+	std::int64_t CellOffsets::delta(CFG::BlockID block) const {
+		return deltas[block];
+	}
+
+
+	/**************
+	 * Dominators *
+	 **************/
+	Dominators::Dominators(const CFG &cfg)
+		: idoms(cfg.size(), CFG::EXIT), preorder(cfg.size(), 0), postorder(cfg.size(), 0) {
+		CFG::BlockID entry = cfg.entry();
+		if (entry == CFG::EXIT) return;
+
+		// Number the blocks in postorder with an explicit stack, since loops
+		// can nest deeply enough to overflow the call stack. Each entry is a
+		// block and how many of its successors have been visited.
+		constexpr std::uint32_t UNVISITED = 0xFFFFFFFF;
+		std::vector<std::uint32_t> rpoIndex(cfg.size(), UNVISITED);
+		std::vector<std::pair<CFG::BlockID, int>> stack;
+		std::vector<bool> visited(cfg.size(), false);
+
+		stack.emplace_back(entry, 0);
+		visited[entry] = true;
+
+		while (!stack.empty()) {
+			auto &[block, next] = stack.back();
+
+			if (next < 2) {
+				CFG::BlockID succ = next++ == 0 ? cfg.fallthrough(block) : cfg.branch(block);
+
+				if (succ != CFG::EXIT && !visited[succ]) {
+					visited[succ] = true;
+					stack.emplace_back(succ, 0);
+				}
+			} else {
+				order.push_back(block);
+				stack.pop_back();
+			}
+		}
+
+		std::reverse(order.begin(), order.end());
+		for (std::size_t i=0; i < order.size(); ++i) {
+			rpoIndex[order[i]] = i;
+		}
+
+		// Cooper, Harvey and Kennedy's iterative algorithm: walk the blocks in
+		// reverse postorder, intersecting the dominators of each block's
+		// processed predecessors, until nothing changes
+		auto intersect = [&](CFG::BlockID a, CFG::BlockID b) {
+			while (a != b) {
+				while (rpoIndex[a] > rpoIndex[b]) a = idoms[a];
+				while (rpoIndex[b] > rpoIndex[a]) b = idoms[b];
+			}
+
+			return a;
+		};
+
+		idoms[entry] = entry;
+
+		for (bool changed = true; changed; ) {
+			changed = false;
+
+			for (std::size_t i=1; i < order.size(); ++i) {
+				CFG::BlockID block = order[i];
+				CFG::BlockID dom = CFG::EXIT;
+
+				for (CFG::BlockID pred : cfg.predecessors(block)) {
+					if (rpoIndex[pred] == UNVISITED || idoms[pred] == CFG::EXIT) continue;
+
+					dom = dom == CFG::EXIT ? pred : intersect(pred, dom);
+				}
+
+				if (dom != idoms[block]) {
+					idoms[block] = dom;
+					changed = true;
+				}
+			}
+		}
+
+		// Walk the tree to number it. Children are found by counting them
+		// first, like the predecessors in the CFG.
+		std::vector<std::uint32_t> childStarts(cfg.size() + 1, 0);
+		for (CFG::BlockID block : order) {
+			if (block != entry) ++childStarts[idoms[block] + 1];
+		}
+
+		for (std::size_t i=0; i < cfg.size(); ++i) {
+			childStarts[i + 1] += childStarts[i];
+		}
+
+		std::vector<CFG::BlockID> children(childStarts[cfg.size()]);
+		std::vector<std::uint32_t> fill(childStarts.begin(), childStarts.end() - 1);
+		for (CFG::BlockID block : order) {
+			if (block != entry) children[fill[idoms[block]]++] = block;
+		}
+
+		// Numbering starts at 1, so that 0 is left for unreachable blocks
+		std::uint32_t counter = 1;
+		std::vector<std::pair<CFG::BlockID, std::uint32_t>> walk;
+		walk.emplace_back(entry, childStarts[entry]);
+		preorder[entry] = counter++;
+
+		while (!walk.empty()) {
+			auto &[block, next] = walk.back();
+
+			if (next < childStarts[block + 1]) {
+				CFG::BlockID child = children[next++];
+				preorder[child] = counter++;
+				walk.emplace_back(child, childStarts[child]);
+			} else {
+				postorder[block] = counter++;
+				walk.pop_back();
+			}
+		}
+
+		idoms[entry] = CFG::EXIT;
+	}
+
+	bool Dominators::reachable(CFG::BlockID block) const {
+		return preorder[block] != 0;
+	}
+
+	CFG::BlockID Dominators::idom(CFG::BlockID block) const {
+		return idoms[block];
+	}
+
+	bool Dominators::dominates(CFG::BlockID a, CFG::BlockID b) const {
+		return reachable(a) && reachable(b) && preorder[a] <= preorder[b] && postorder[b] <= postorder[a];
+	}
+
+	std::span<const CFG::BlockID> Dominators::reversePostorder() const {
+		return order;
+	}
+
+
+	/*********
+	 * Loops *
+	 *********/
+	Loops::Loops(const CFG &cfg, const Dominators &dominators) : blockLoops(cfg.size(), NO_LOOP) {
+		std::span<const CFG::BlockID> order = dominators.reversePostorder();
+
+		// Headers are visited from last to first in reverse postorder, so
+		// that a loop is found before any loop it is in
+		for (auto it = order.rbegin(); it != order.rend(); ++it) {
+			CFG::BlockID header = *it;
+			std::vector<CFG::BlockID> work;
+
+			for (CFG::BlockID pred : cfg.predecessors(header)) {
+				if (dominators.dominates(header, pred)) work.push_back(pred);
+			}
+
+			if (work.empty()) continue;
+
+			LoopID loop = headers.size();
+			headers.push_back(header);
+			parents.push_back(NO_LOOP);
+			blockLoops[header] = loop;
+
+			// Walk back from the back edges to the header. Blocks already in
+			// an inner loop stand for the whole of their outermost loop so
+			// far, which is now inside this one.
+			while (!work.empty()) {
+				CFG::BlockID block = work.back();
+				work.pop_back();
+
+				if (!dominators.reachable(block)) continue;
+
+				if (blockLoops[block] == NO_LOOP) {
+					blockLoops[block] = loop;
+					work.insert(work.end(), cfg.predecessors(block).begin(), cfg.predecessors(block).end());
+					continue;
+				}
+
+				LoopID outer = blockLoops[block];
+				while (parents[outer] != NO_LOOP) outer = parents[outer];
+
+				if (outer == loop) continue;
+
+				parents[outer] = loop;
+				for (CFG::BlockID pred : cfg.predecessors(headers[outer])) {
+					work.push_back(pred);
+				}
+			}
+		}
+
+		// Parents come after their children, so go backwards
+		depths.resize(headers.size());
+		for (std::size_t loop=headers.size(); loop-- > 0; ) {
+			depths[loop] = parents[loop] == NO_LOOP ? 1 : depths[parents[loop]] + 1;
+		}
+	}
+
+	std::size_t Loops::size() const {
+		return headers.size();
+	}
+
+	CFG::BlockID Loops::header(LoopID loop) const {
+		return headers[loop];
+	}
+
+	Loops::LoopID Loops::parent(LoopID loop) const {
+		return parents[loop];
+	}
+
+	std::uint32_t Loops::depth(LoopID loop) const {
+		return depths[loop];
+	}
+
+	Loops::LoopID Loops::loop(CFG::BlockID block) const {
+		return blockLoops[block];
+	}
+
+	bool Loops::contains(LoopID loop, CFG::BlockID block) const {
+		for (LoopID l = blockLoops[block]; l != NO_LOOP; l = parents[l]) {
+			if (l == loop) return true;
+		}
+
+		return false;
+	}
+
+
+	/**************
+	 * CellValues *
+	 **************/
+	struct CellValues::State {
+		bool reached = false;
+
+		// Where AR points in the image, or NO_IMAGE if cells which aren't
+		// listed are unknown
+		std::int64_t image = NO_IMAGE;
+
+		// Cells with their values, sorted by offset from AR
+		std::vector<std::pair<std::int64_t, int>> cells;
+
+		bool operator==(const State &other) const = default;
+	};
+
+	int CellValues::imageValue(std::int64_t address) const {
+		if (address < 0) return UNKNOWN;
+		if (static_cast<std::size_t>(address) >= image.size()) return 0;
+
+		return image[address];
+	}
+
+	CellValues::CellValues(const Program &program, const CFG &cfg, const CellOffsets &offsets)
+		: reached(cfg.size(), false), fallthroughs(cfg.size(), false), branches(cfg.size(), false),
+		  image(program.image()) {
+		std::size_t count = cfg.size();
+		std::vector<State> states(count);
+
+		const SymbolTable &symbols = program.symbols();
+		auto isRuntime = [&symbols](const Instruction &instr, const char *name) {
+			if (instr.getOp2Type() != SYMBOL) return false;
+
+			const std::string *symbolName = symbols.name(instr.getSymbol());
+			return symbolName && *symbolName == name;
+		};
+
+		auto get = [this](const State &state, std::int64_t cell) -> int {
+			auto it = std::lower_bound(state.cells.begin(), state.cells.end(), std::make_pair(cell, INT_MIN));
+
+			if (it != state.cells.end() && it->first == cell) return it->second;
+
+			return state.image == NO_IMAGE ? UNKNOWN : imageValue(state.image + cell);
+		};
+
+		// Forget about cells until there are few enough, starting with the
+		// image, then the cells furthest from AR
+		auto trim = [](State &state) {
+			if (state.cells.size() <= MAX_CELLS) return;
+
+			state.image = NO_IMAGE;
+			std::erase_if(state.cells, [](const std::pair<std::int64_t, int> &cell) { return cell.second == UNKNOWN; });
+
+			while (state.cells.size() > MAX_CELLS) {
+				if (-state.cells.front().first > state.cells.back().first) {
+					state.cells.erase(state.cells.begin());
+				} else {
+					state.cells.pop_back();
+				}
+			}
+		};
+
+		auto set = [&trim](State &state, std::int64_t cell, int value) {
+			auto it = std::lower_bound(state.cells.begin(), state.cells.end(), std::make_pair(cell, INT_MIN));
+			bool found = it != state.cells.end() && it->first == cell;
+
+			// Without an image, unknown cells don't need to be listed
+			if (value == UNKNOWN && state.image == NO_IMAGE) {
+				if (found) state.cells.erase(it);
+			} else if (found) {
+				it->second = value;
+			} else {
+				state.cells.emplace(it, cell, value);
+				trim(state);
+			}
+		};
+
+		auto clobber = [](State &state) {
+			state.image = NO_IMAGE;
+			state.cells.clear();
+		};
+
+		// Move from one block's frame of reference to the next
+		auto move = [&clobber](State &state, std::int64_t delta) {
+			if (delta == CellOffsets::UNKNOWN) {
+				clobber(state);
+				return;
+			}
+
+			for (auto &cell : state.cells) {
+				cell.first -= delta;
+			}
+
+			if (state.image != NO_IMAGE) state.image += delta;
+		};
+
+		// What is true on both of two paths
+		auto meet = [&](const State &a, const State &b) {
+			if (!a.reached) return b;
+			if (!b.reached) return a;
+
+			State result;
+			result.reached = true;
+			result.image = a.image == b.image ? a.image : NO_IMAGE;
+
+			auto ia = a.cells.begin(), ib = b.cells.begin();
+
+			while (ia != a.cells.end() || ib != b.cells.end()) {
+				std::int64_t cell;
+
+				if (ib == b.cells.end() || (ia != a.cells.end() && ia->first < ib->first)) {
+					cell = (ia++)->first;
+				} else if (ia == a.cells.end() || ib->first < ia->first) {
+					cell = (ib++)->first;
+				} else {
+					cell = ia->first;
+					++ia, ++ib;
+				}
+
+				int va = get(a, cell), vb = get(b, cell);
+				int value = va == vb ? va : UNKNOWN;
+
+				if (result.image != NO_IMAGE ? value != imageValue(result.image + cell) : value != UNKNOWN) {
+					result.cells.emplace_back(cell, value);
+				}
+			}
+
+			trim(result);
+			return result;
+		};
+
+		std::vector<CFG::BlockID> worklist;
+		std::vector<bool> queued(count, false);
+
+		auto reach = [&](CFG::BlockID block, const State &state) {
+			if (block == CFG::EXIT) return;
+
+			State merged = meet(states[block], state);
+
+			if (!(merged == states[block])) {
+				states[block] = std::move(merged);
+
+				if (!queued[block]) {
+					queued[block] = true;
+					worklist.push_back(block);
+				}
+			}
+		};
+
+		// Where code can be entered
+		State unknown;
+		unknown.reached = true;
+
+		Symbol mainSym = Symbol(0);
+		bool hasMain = false;
+
+		for (auto &[index, symbol] : program.getLabels()) {
+			const std::string *name = symbols.name(symbol);
+
+			if (name && *name == "main" && index < program.size()) {
+				State start;
+				start.reached = true;
+				start.image = 0;
+
+				reach(cfg.block(index), start);
+				mainSym = symbol;
+				hasMain = true;
+			}
+		}
+
+		for (auto &[index, symbol] : program.getLabels()) {
+			if (symbols.name(symbol) && !(hasMain && symbol == mainSym) && index < program.size()) {
+				reach(cfg.block(index), unknown);
+			}
+		}
+
+		for (std::size_t i=0; i < program.size(); ++i) {
+			const Instruction &instr = program[i];
+
+			if (instr.getOpcode() != JMP && instr.hasOperand2() && instr.getOp2Type() == SYMBOL) {
+				std::size_t target = program.target(instr.getSymbol());
+
+				if (target != Program::UNDEFINED && target < program.size()) {
+					reach(cfg.block(target), unknown);
+				}
+			}
+		}
+
+		while (!worklist.empty()) {
+			CFG::BlockID block = worklist.back();
+			worklist.pop_back();
+			queued[block] = false;
+
+			State state = states[block];
+			std::size_t begin = cfg.begin(block), end = cfg.end(block);
+
+			// Registers and flags are only followed within a block. Each
+			// register is known up to an operand size, or not at all.
+			std::uint64_t regs[8] = {};
+			int regSizes[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+
+			bool flagsKnown = false;
+			bool zero = false, negative = false, carry = false, overflow = false;
+
+			for (std::size_t i=begin; i < end; ++i) {
+				const Instruction &instr = program[i];
+				Opcode opcode = instr.getOpcode();
+				OperandSize size = instr.getSize();
+				std::int64_t offset = offsets.offset(i);
+
+				int bits = 8 << size;
+				std::uint64_t mask = size == DWORD ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+				std::uint64_t sign = (mask >> 1) + 1;
+
+				auto read = [&](OperandType type, Register reg, std::uint64_t &value) {
+					switch (type) {
+						case REGISTER:
+							value = regs[reg] & mask;
+							return reg != AR && regSizes[reg] >= size;
+						case INDIRECT:
+							if (reg != AR || offset == CellOffsets::UNKNOWN) return false;
+
+							value = 0;
+							for (int byte=(1 << size) - 1; byte >= 0; --byte) {
+								int cell = get(state, offset + instr.getDisplacement() + byte);
+								if (cell == UNKNOWN) return false;
+
+								value = (value << 8) | cell;
+							}
+							return true;
+						case LITERAL:
+							value = instr.getLiteral() & mask;
+							return true;
+						default:
+							return false;
+					}
+				};
+
+				if (opcode == JMP) continue;
+
+				if (opcode == CALL) {
+					if (isRuntime(instr, "getc")) {
+						if (offset == CellOffsets::UNKNOWN) clobber(state);
+						else set(state, offset, UNKNOWN);
+					} else if (!isRuntime(instr, "putc") && !isRuntime(instr, "scan")) {
+						clobber(state);
+					}
+
+					std::fill(std::begin(regSizes), std::end(regSizes), -1);
+					flagsKnown = false;
+					continue;
+				}
+
+				// AR is followed by CellOffsets
+				if (instr.getOp1Type() == REGISTER && instr.getOp1() == AR) continue;
+
+				std::uint64_t a = 0, b = 0;
+				bool known = (opcode == MOV || read(instr.getOp1Type(), instr.getOp1(), a))
+					&& (opcode == CPL || read(instr.getOp2Type(), instr.getOp2(), b));
+				std::uint64_t result = 0;
+
+				if (known) {
+					switch (opcode) {
+						case ADD: result = a + b; break;
+						case SUB: result = a - b; break;
+						case MUL: result = a * b; break;
+						case DIV:
+							known = b != 0;
+							if (known) result = a / b;
+							break;
+						case AND: result = a & b; break;
+						case OR: result = a | b; break;
+						case XOR: result = a ^ b; break;
+						case CPL: result = ~a; break;
+						case LSL:
+						case LSR:
+						case ASR:
+							known = b < static_cast<std::uint64_t>(bits);
+
+							if (known && opcode == LSL) result = a << b;
+							else if (known && opcode == LSR) result = a >> b;
+							else if (known) result = static_cast<std::uint64_t>(
+								(static_cast<std::int64_t>(a << (64 - bits)) >> (64 - bits)) >> b);
+							break;
+						case MOV: result = b; break;
+						default: break;
+					}
+				}
+
+				result &= mask;
+
+				if (opcode == CMP || opcode == TST) {
+					flagsKnown = known;
+
+					if (opcode == CMP) {
+						result = (a - b) & mask;
+						carry = a >= b;
+						overflow = (a ^ b) & (a ^ result) & sign;
+					} else {
+						result = a & b;
+						carry = overflow = false;
+					}
+
+					zero = result == 0;
+					negative = result & sign;
+				} else if (instr.getOp1Type() == REGISTER) {
+					Register reg = instr.getOp1();
+
+					if (known) {
+						regs[reg] = (regs[reg] & ~mask) | result;
+						regSizes[reg] = std::max<int>(regSizes[reg], size);
+					} else {
+						regSizes[reg] = -1;
+					}
+				} else if (instr.getOp1() != AR || offset == CellOffsets::UNKNOWN) {
+					clobber(state);
+				} else {
+					for (int byte=0; byte < (1 << size); ++byte) {
+						set(state, offset + instr.getDisplacement() + byte, known ? (result >> (8 * byte)) & 0xFF : UNKNOWN);
+					}
+				}
+			}
+
+			// Work out which ways out of the block can be taken
+			const Instruction &last = program[end - 1];
+			Condition cc = last.getCondition();
+			bool jumps = last.getOpcode() == JMP && cc != NV;
+
+			bool fallthroughTaken = !jumps || cc != AL;
+			bool branchTaken = jumps;
+
+			if (jumps && cc != AL && flagsKnown) {
+				bool taken;
+
+				switch (cc) {
+					case EQ: taken = zero; break;
+					case NE: taken = !zero; break;
+					case CS: taken = carry; break;
+					case CC: taken = !carry; break;
+					case MI: taken = negative; break;
+					case PL: taken = !negative; break;
+					case VS: taken = overflow; break;
+					case VC: taken = !overflow; break;
+					case HI: taken = carry && !zero; break;
+					case LS: taken = !carry || zero; break;
+					case GE: taken = negative == overflow; break;
+					case LT: taken = negative != overflow; break;
+					case GT: taken = !zero && negative == overflow; break;
+					default: taken = zero || negative != overflow; break;
+				}
+
+				(taken ? fallthroughTaken : branchTaken) = false;
+			}
+
+			fallthroughs[block] = fallthroughTaken;
+			branches[block] = branchTaken;
+
+			State fallthroughState = state, branchState = state;
+
+			// On the way out of a loop test, the cell is known, e.g. after
+			//   tst byte [ar],[ar]
+			//   jmp nz,_start
+			// [ar] is zero if the jump is not taken
+			if (jumps && (cc == EQ || cc == NE) && end - begin >= 2) {
+				const Instruction &test = program[end - 2];
+				std::int64_t offset = offsets.offset(end - 2);
+				bool byteCell = test.getSize() == BYTE && test.getOp1Type() == INDIRECT && test.getOp1() == AR
+					&& offset != CellOffsets::UNKNOWN;
+
+				State &equal = cc == EQ ? branchState : fallthroughState;
+				std::int64_t cell = offset + test.getDisplacement();
+
+				if (byteCell && test.getOpcode() == TST && test.getOp2Type() == INDIRECT && test.getOp2() == AR) {
+					set(equal, cell, 0);
+				} else if (byteCell && test.getOpcode() == CMP && test.getOp2Type() == LITERAL) {
+					set(equal, cell, test.getLiteral() & 0xFF);
+				}
+			}
+
+			std::int64_t delta = offsets.delta(block);
+			move(fallthroughState, delta);
+			move(branchState, delta);
+
+			if (fallthroughTaken) reach(cfg.fallthrough(block), fallthroughState);
+			if (branchTaken) reach(cfg.branch(block), branchState);
+
+			// A jump through a register could go to any label
+			if (branchTaken && cfg.unknownBranch(block)) {
+				for (auto &[index, symbol] : program.getLabels()) {
+					if (index < program.size()) reach(cfg.block(index), unknown);
+				}
+			}
+		}
+
+		// Flatten the results
+		starts.reserve(count + 1);
+		images.reserve(count);
+
+		for (CFG::BlockID block=0; block < count; ++block) {
+			const State &state = states[block];
+
+			reached[block] = state.reached;
+			starts.push_back(cells.size());
+			images.push_back(state.image);
+
+			for (auto &[cell, value] : state.cells) {
+				cells.push_back(cell);
+				values.push_back(value);
+			}
+		}
+
+		starts.push_back(cells.size());
+	}
+
+	bool CellValues::reachable(CFG::BlockID block) const {
+		return reached[block];
+	}
+
+	bool CellValues::fallthroughTaken(CFG::BlockID block) const {
+		return reached[block] && fallthroughs[block];
+	}
+
+	bool CellValues::branchTaken(CFG::BlockID block) const {
+		return reached[block] && branches[block];
+	}
+
+	int CellValues::value(CFG::BlockID block, std::int64_t cell) const {
+		if (!reached[block]) return UNKNOWN;
+
+		auto first = cells.begin() + starts[block], last = cells.begin() + starts[block + 1];
+		auto it = std::lower_bound(first, last, cell);
+
+		if (it != last && *it == cell) return values[it - cells.begin()];
+
+		return images[block] == NO_IMAGE ? UNKNOWN : imageValue(images[block] + cell);
+	}
+
+	bool CellValues::isZero(CFG::BlockID block, std::int64_t cell) const {
+		return value(block, cell) == 0;
+	}
+}
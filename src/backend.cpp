@@ -0,0 +1,67 @@
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "backend.hpp"
+
+/*****************
+ * BackendOutlet *
+ *****************/
+static int registered = OutletFactory::getInstance().registerComponent(
+	[]() { return new BackendOutlet(new X86_64Backend()); }, {"x86_64"});
+static int registeredInterpreter = OutletFactory::getInstance().registerComponent(
+	[]() { return new BackendOutlet(new InterpreterBackend()); }, {"interp"});
+
+BackendOutlet::BackendOutlet(IBackend *backend) : backend(backend) {}
+
+void BackendOutlet::deliver(std::string &file, Coupling::Source &source) {
+	std::vector<std::uint8_t> object = source.collect();
+
+	// Compile before creating the file, so that nothing is left behind if
+	// compilation fails
+	std::vector<std::uint8_t> output = backend->compile(object);
+
+	std::ofstream out(file, std::ios::out | std::ios::trunc | std::ios::binary);
+	out.write(reinterpret_cast<const char *>(output.data()), output.size());
+
+	out.close();
+
+	if (!out) {
+		throw std::runtime_error("Could not write " + file);
+	}
+
+	if (backend->executable()) {
+		namespace fs = std::filesystem;
+
+		// Whoever can read the program can run it, as the umask allowed
+		fs::perms perms = fs::status(file).permissions();
+		fs::perms exec = fs::perms::none;
+
+		if ((perms & fs::perms::owner_read) != fs::perms::none) exec |= fs::perms::owner_exec;
+		if ((perms & fs::perms::group_read) != fs::perms::none) exec |= fs::perms::group_exec;
+		if ((perms & fs::perms::others_read) != fs::perms::none) exec |= fs::perms::others_exec;
+
+		fs::permissions(file, exec, fs::perm_options::add);
+	}
+}
+
+BackendOutlet::~BackendOutlet() {
+	delete backend;
+}
+
+
+/*************
+ * RunOutlet *
+ *************/
+RunOutlet::RunOutlet(IBackend *backend) : backend(backend) {}
+
+void RunOutlet::deliver(std::string &file, Coupling::Source &source) {
+	backend->run(source.collect());
+}
+
+RunOutlet::~RunOutlet() {
+	delete backend;
+}
@@ -2,101 +2,531 @@
  * Brainfuck frontend implementation
  */
 
-#include <fstream>
+#include <chrono>
+#include <map>
 #include <stack>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
 
 #include <iostream>
 
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+#endif
+
 #include "frontend.hpp"
 #include "ir.hpp"
+#include "mappedfile.hpp"
+
+namespace {
+	/*
+	 * Returns true if c is a Brainfuck command
+	 */
+	inline bool isCommand(char c) {
+		switch (c) {
+			case '+': case '-': case '>': case '<':
+			case '[': case ']': case '.': case ',':
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	/*
+	 * Copy the commands in in[0:n] to out, skipping comments. out must have
+	 * room for n bytes.
+	 *
+	 * Returns the number of bytes written to out.
+	 */
+	std::size_t stripCommentsScalar(const char *in, std::size_t n, char *out) {
+		char *start = out;
+
+		for (std::size_t i=0; i < n; ++i) {
+			*out = in[i];
+			out += isCommand(in[i]);  // branchless; comments get overwritten
+		}
+
+		return out - start;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	/*
+	 * Vectorised versions of stripCommentsScalar. Each block of input is
+	 * classified at once, and blocks with no commands in them (which is most
+	 * of them in heavily commented sources) are skipped entirely.
+	 */
+	__attribute__((target("sse2")))
+	std::size_t stripCommentsSSE2(const char *in, std::size_t n, char *out) {
+		char *start = out;
+		std::size_t i = 0;
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+
+			// +,-. are contiguous so they can be matched with one range check
+			__m128i rel = _mm_sub_epi8(block, _mm_set1_epi8('+'));
+			__m128i cmds = _mm_cmpeq_epi8(_mm_min_epu8(rel, _mm_set1_epi8(3)), rel);
+			cmds = _mm_or_si128(cmds, _mm_cmpeq_epi8(block, _mm_set1_epi8('<')));
+			cmds = _mm_or_si128(cmds, _mm_cmpeq_epi8(block, _mm_set1_epi8('>')));
+			cmds = _mm_or_si128(cmds, _mm_cmpeq_epi8(block, _mm_set1_epi8('[')));
+			cmds = _mm_or_si128(cmds, _mm_cmpeq_epi8(block, _mm_set1_epi8(']')));
+
+			for (unsigned mask = _mm_movemask_epi8(cmds); mask; mask &= mask - 1) {
+				*out++ = in[i + __builtin_ctz(mask)];
+			}
+		}
+
+		return (out - start) + stripCommentsScalar(in + i, n - i, out);
+	}
+
+	__attribute__((target("avx2")))
+	std::size_t stripCommentsAVX2(const char *in, std::size_t n, char *out) {
+		char *start = out;
+		std::size_t i = 0;
+
+		for (; i + 32 <= n; i += 32) {
+			__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+
+			__m256i rel = _mm256_sub_epi8(block, _mm256_set1_epi8('+'));
+			__m256i cmds = _mm256_cmpeq_epi8(_mm256_min_epu8(rel, _mm256_set1_epi8(3)), rel);
+			cmds = _mm256_or_si256(cmds, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('<')));
+			cmds = _mm256_or_si256(cmds, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('>')));
+			cmds = _mm256_or_si256(cmds, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('[')));
+			cmds = _mm256_or_si256(cmds, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(']')));
+
+			for (unsigned mask = _mm256_movemask_epi8(cmds); mask; mask &= mask - 1) {
+				*out++ = in[i + __builtin_ctz(mask)];
+			}
+		}
+
+		return (out - start) + stripCommentsSSE2(in + i, n - i, out);
+	}
+#endif
+
+	/*
+	 * Copy the commands in in[0:n] to out using the fastest implementation
+	 * supported by this CPU.
+	 */
+	std::size_t stripComments(const char *in, std::size_t n, char *out) {
+#if defined(__x86_64__) || defined(__i386__)
+		if (__builtin_cpu_supports("avx2")) {
+			return stripCommentsAVX2(in, n, out);
+		} else if (__builtin_cpu_supports("sse2")) {
+			return stripCommentsSSE2(in, n, out);
+		}
+#endif
+		return stripCommentsScalar(in, n, out);
+	}
+
+	/*
+	 * Describe where a command is in the source file, for error messages.
+	 * Only used when something has gone wrong, so the file is just read
+	 * again rather than keeping track of lines while parsing.
+	 *
+	 * file		The source file
+	 * command	The index of the command, not counting comments
+	 */
+	std::string describePosition(const std::string &file, std::size_t command) {
+		try {
+			MappedFile in(file);
+			std::size_t line = 1, column = 1, seen = 0;
+
+			for (std::size_t i=0; i < in.size(); ++i) {
+				char c = in.data()[i];
+
+				if (isCommand(c) && seen++ == command) {
+					return "line " + std::to_string(line) + ", column " + std::to_string(column);
+				}
+
+				if (c == '\n') {
+					++line;
+					column = 1;
+				} else {
+					++column;
+				}
+			}
+		} catch (std::system_error &ex) {}
+
+		return "command " + std::to_string(command + 1);
+	}
+
+	/*
+	 * A loop which can be lowered to straight-line code instead of a TST/JMP
+	 * pair per iteration.
+	 */
+	struct LoopIdiom {
+		enum {
+			NONE,		// not a recognised idiom
+			CLEAR,		// [-] or [+]
+			MULTIPLY,	// [->+++>+<<] and friends
+			SCAN		// [>] or [<<] and friends
+		} kind = NONE;
+
+		// For MULTIPLY, the amount added to each cell per unit of the current
+		// cell, keyed by offset from the current cell.
+		std::map<std::intmax_t, std::uint8_t> factors;
+
+		// For SCAN, how far the pointer moves each iteration
+		std::intmax_t stride = 0;
+
+		// Index of the closing bracket of the loop
+		std::size_t end = 0;
+	};
+
+	/*
+	 * Check if the loop opened at src[start] is a recognised idiom. Only loops
+	 * whose bodies consist entirely of +-<> are considered.
+	 *
+	 * src		The program source, stripped of comments
+	 * start	The index of the opening bracket of the loop
+	 */
+	LoopIdiom matchLoopIdiom(const std::string &src, std::size_t start) {
+		LoopIdiom idiom;
+		std::map<std::intmax_t, std::intmax_t> deltas;  // net change per cell
+		std::intmax_t ptr = 0;
+
+		std::size_t i = start + 1;
+		for (; i < src.size() && src[i] != ']'; ++i) {
+			switch (src[i]) {
+				case '+':
+					++deltas[ptr];
+					break;
+				case '-':
+					--deltas[ptr];
+					break;
+				case '>':
+					++ptr;
+					break;
+				case '<':
+					--ptr;
+					break;
+				default:
+					// nested loop or IO
+					return idiom;
+			}
+		}
+
+		if (i >= src.size()) {
+			// unterminated loop
+			return idiom;
+		}
+
+		idiom.end = i;
+
+		// drop cells which end up unchanged
+		std::erase_if(deltas, [](const auto &delta) {
+			return (delta.second & 0xFF) == 0;
+		});
+
+		if (ptr != 0) {
+			// Scans cannot change any cells
+			if (deltas.empty()) {
+				idiom.kind = LoopIdiom::SCAN;
+				idiom.stride = ptr;
+			}
+
+			return idiom;
+		}
+
+		// The loop counter must step by exactly one so that the number of
+		// iterations is known
+		if (!deltas.contains(0)) return idiom;
+
+		std::uint8_t step = deltas[0] & 0xFF;
+		if (step != 0x01 && step != 0xFF) return idiom;
+
+		deltas.erase(0);
+
+		if (deltas.empty()) {
+			idiom.kind = LoopIdiom::CLEAR;
+			return idiom;
+		}
+
+		// Counting down from n runs n iterations, counting up from n runs -n
+		// iterations, so the factors must be negated in the latter case.
+		idiom.kind = LoopIdiom::MULTIPLY;
+		for (auto &[offset, delta] : deltas) {
+			idiom.factors[offset] = (step == 0xFF ? delta : -delta) & 0xFF;
+		}
+
+		return idiom;
+	}
+}
 
+/*********************
+ * BrainfuckFrontend *
+ *********************/
 void BrainfuckFrontend::applyOptions(char option, std::vector<std::string> &values) {
+	if (option != 'f') return;
 
+	for (const std::string &value : values) {
+		if (value == "source-map") {
+			sourceMap = true;
+		} else if (value == "no-source-map") {
+			sourceMap = false;
+		}
+	}
 }
 
 std::vector<std::uint8_t> BrainfuckFrontend::parse(std::string &file) {
-	std::ifstream in(file);
 	IR::Program program;
 
-	std::stack<std::string> loopStack;  // loop label prefixes
+	IR::SymbolTable &symbols = program.symbols();
+
+	// Runtime routines, interned once so that the IR only has to deal with IDs
+	IR::Symbol putcSym = symbols.intern("putc");
+	IR::Symbol getcSym = symbols.intern("getc");
+	IR::Symbol scanSym = symbols.intern("scan");
+
+	// Open loops, as the labels of their start and end, and the index of the
+	// command that opened each one
+	std::stack<std::pair<IR::Symbol, IR::Symbol>> loopStack;
+	std::stack<std::size_t> loopOpenings;
 
-	// Create a unique label for loops
-	// basically just returns a string with any ASCII character between
-	// '!' (0x21) and '~' (0x7E)
-	auto getUniqueLoopLabel = [](){
-		static std::string prevLbl = " ";
+	// Strip comments so that loop bodies can be inspected ahead of time
+	std::string src;
+	std::vector<std::uint32_t> srcOffsets;  // position of each command, with -fsource-map
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		std::size_t bytes = 0;
 
-		if (prevLbl.back() >= '~') {
-			prevLbl += "!";
-		} else {
-			prevLbl.back()++;
+		try {
+			MappedFile in(file);
+			bytes = in.size();
+
+			src.resize(in.size());
+
+			if (sourceMap) {
+				// Slow path; keep track of where each command came from
+				for (std::size_t i=0; i < in.size(); ++i) {
+					if (isCommand(in.data()[i])) {
+						src[srcOffsets.size()] = in.data()[i];
+						srcOffsets.push_back(i);
+					}
+				}
+
+				src.resize(srcOffsets.size());
+			} else {
+				src.resize(stripComments(in.data(), in.size(), src.data()));
+			}
+		} catch (std::system_error &ex) {
+			throw std::runtime_error("Could not read " + file + ": " + ex.code().message());
 		}
 
-		return prevLbl;
-	};
+		if (verbose) {
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
 
-	if (!in) {
-		// Failed to open file
+			std::cout << "Read " << bytes << " bytes (" << src.size() << " commands) from "
+				<< file << " in " << elapsed.count() * 1e3 << " ms";
+
+			// Small files can be read faster than the clock can tell
+			if (elapsed.count() > 0) {
+				std::cout << " (" << bytes / elapsed.count() / 1e9 << " GB/s)";
+			}
+
+			std::cout << std::endl;
+		}
 	}
 
+	// Runs of +-<> are folded together. Pointer movement is deferred, and
+	// cells are addressed relative to where AR would have been, so that AR
+	// only needs to be updated at loop boundaries and IO. These hold the net
+	// change of the current run, which is emitted once a different command is
+	// encountered.
+	std::map<std::intmax_t, std::intmax_t> cellDeltas;  // keyed by offset from AR
+	std::intmax_t ptrOffset = 0;
+
+	// The cell at the given offset from AR
+	auto cell = [](std::intmax_t offset) {
+		return IR::AR + static_cast<std::int32_t>(offset);
+	};
+
+	// Emit the pending cell deltas, if any
+	auto flushCells = [&program, &cellDeltas, &cell]() {
+		for (auto &[offset, cellDelta] : cellDeltas) {
+			// cells are bytes, so the delta wraps around at 256
+			std::uintmax_t delta = static_cast<std::uintmax_t>(cellDelta) & 0xFF;
+
+			if (delta != 0 && delta <= 0x80) {
+				// add byte [ar+offset],delta
+				program(IR::ADD) (IR::BYTE) [cell(offset)](delta);
+			} else if (delta > 0x80) {
+				// sub byte [ar+offset],-delta
+				program(IR::SUB) (IR::BYTE) [cell(offset)](0x100 - delta);
+			}
+		}
+
+		cellDeltas.clear();
+	};
+
+	// Emit the pending pointer movement, if any
+	auto commitPtr = [&program, &ptrOffset]() {
+		if (ptrOffset > 0) {
+			// add ar,offset
+			program(IR::ADD) (IR::AR)(static_cast<std::uintmax_t>(ptrOffset));
+		} else if (ptrOffset < 0) {
+			// sub ar,-offset
+			program(IR::SUB) (IR::AR)(static_cast<std::uintmax_t>(-ptrOffset));
+		}
+
+		ptrOffset = 0;
+	};
+
 	// Set up program
 	program.label("main");
 
-	char c;
-	while (in.get(c)) {
-		std::string label;
+	// The first command of the current run of +-<>, for the source map
+	constexpr std::size_t NO_RUN = SIZE_MAX;
+	std::size_t runStart = NO_RUN;
+
+	for (std::size_t i=0; i < src.size(); ++i) {
+		char c = src[i];
+		std::pair<IR::Symbol, IR::Symbol> loop;
+		LoopIdiom idiom;
+
+		if (c == '+' || c == '-' || c == '<' || c == '>') {
+			if (runStart == NO_RUN) runStart = i;
+		} else if (sourceMap && runStart != NO_RUN) {
+			program.source(srcOffsets[runStart]);
+		}
 
 		switch (c) {
 			case '+':
-				// add byte [ar],1
-				program(IR::ADD) (IR::BYTE) [IR::AR](1);
-				break;
 			case '-':
-				// sub byte [ar],1
-				program(IR::SUB) (IR::BYTE) [IR::AR](1);
-				break;
+				cellDeltas[ptrOffset] += (c == '+') ? 1 : -1;
+				continue;
 			case '>':
-				// add ar,1
-				program(IR::ADD) (IR::AR)(1);
-				break;
 			case '<':
-				// sub ar,1
-				program(IR::SUB) (IR::AR)(1);
+				ptrOffset += (c == '>') ? 1 : -1;
+				continue;
+			case '[':
+				// idioms can use the pending pointer offset
+				flushCells();
 				break;
+			case ']':
+			case '.':
+			case ',':
+				flushCells();
+				commitPtr();
+				break;
+		}
+
+		runStart = NO_RUN;
+
+		if (sourceMap) {
+			program.source(srcOffsets[i]);
+		}
+
+		switch (c) {
 			case '[':
-				label = getUniqueLoopLabel();
-				loopStack.push(label);
+				idiom = matchLoopIdiom(src, i);
+
+				if (idiom.kind == LoopIdiom::CLEAR) {
+					// mov byte [ar+offset],0
+					program(IR::MOV) (IR::BYTE) [cell(ptrOffset)](0);
+				} else if (idiom.kind == LoopIdiom::MULTIPLY) {
+					//   tst byte [ar+offset],[ar+offset]
+					//   jmp z,_skip
+					//   mov byte r0,[ar+offset]
+					//   mov byte r1,r0
+					//   mul byte r1,factor
+					//   add byte [ar+offset+target],r1
+					//   ...
+					//   mov byte [ar+offset],0
+					// _skip:
+					//
+					// The loop never runs when the counter is zero, and the
+					// target cells may then be off the tape, so they must not
+					// be touched at all.
+					IR::Symbol skip = symbols.anonymous();
+
+					program(IR::TST) (IR::BYTE) [cell(ptrOffset)][cell(ptrOffset)];
+					program(IR::JMP) (IR::Z)(skip);
+					program(IR::MOV) (IR::BYTE) (IR::R0)[cell(ptrOffset)];
+
+					for (auto &[target, factor] : idiom.factors) {
+						if (factor == 0x01) {
+							program(IR::ADD) (IR::BYTE) [cell(ptrOffset + target)](IR::R0);
+						} else if (factor == 0xFF) {
+							program(IR::SUB) (IR::BYTE) [cell(ptrOffset + target)](IR::R0);
+						} else {
+							program(IR::MOV) (IR::BYTE) (IR::R1)(IR::R0);
+							program(IR::MUL) (IR::BYTE) (IR::R1)(static_cast<std::uintmax_t>(factor));
+							program(IR::ADD) (IR::BYTE) [cell(ptrOffset + target)](IR::R1);
+						}
+					}
+
+					program(IR::MOV) (IR::BYTE) [cell(ptrOffset)](0);
+					program.label(skip);
+				} else if (idiom.kind == LoopIdiom::SCAN) {
+					// mov r0,stride
+					// call scan
+					commitPtr();
+					program(IR::MOV) (IR::R0)(static_cast<std::uintmax_t>(idiom.stride));
+					program(IR::CALL) (scanSym);
+				}
+
+				if (idiom.kind != LoopIdiom::NONE) {
+					// skip over the body of the loop
+					i = idiom.end;
+					break;
+				}
+
+				commitPtr();
+
+				loop = {symbols.anonymous(), symbols.anonymous()};
+				loopStack.push(loop);
+				loopOpenings.push(i);
 
 				// _start:
 				//   tst byte [ar],[ar]
 				//   jmp z,_end
-				program.label(label + "_start");
+				program.label(loop.first);
 				program(IR::TST) (IR::BYTE) [IR::AR][IR::AR];
-				program(IR::JMP) (IR::Z)(label + "_end");
+				program(IR::JMP) (IR::Z)(loop.second);
 				break;
 			case ']':
-				label = loopStack.top();
+				if (loopStack.empty()) {
+					throw std::runtime_error("Unmatched ] at " + describePosition(file, i));
+				}
+
+				loop = loopStack.top();
 				loopStack.pop();
+				loopOpenings.pop();
 
 				// _end:
 				//   tst byte [ar],[ar]
 				//   jmp nz,_start
-				program.label(label + "_end");
+				program.label(loop.second);
 				program(IR::TST) (IR::BYTE) [IR::AR][IR::AR];
-				program(IR::JMP) (IR::NZ)(label + "_start");
+				program(IR::JMP) (IR::NZ)(loop.first);
 				break;
 			case '.':
 				// call putc
-				program(IR::CALL) ("putc");
+				program(IR::CALL) (putcSym);
 				break;
 			case ',':
 				// call getc
-				program(IR::CALL) ("getc");
+				program(IR::CALL) (getcSym);
 				break;
 		}
 	}
 
-	std::cout << program;
+	if (!loopStack.empty()) {
+		throw std::runtime_error("Unmatched [ at " + describePosition(file, loopOpenings.top()));
+	}
+
+	if (sourceMap && runStart != NO_RUN) {
+		program.source(srcOffsets[runStart]);
+	}
+
+	flushCells();
+
+	if (verbose) {
+		std::cout << program;
+	}
 
 	return program.assemble();
 }
@@ -106,6 +536,10 @@ std::string BrainfuckFrontend::helpStr() {
 	return "";
 }
 
-void BrainfuckFrontend::setVerbosity(bool verbosity) {
+std::string BrainfuckFrontend::name() {
+	return "brainfuck";
+}
 
+void BrainfuckFrontend::setVerbosity(bool verbosity) {
+	verbose = verbosity;
 }
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "object.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+	/*
+	 * 128 bit FNV-1a. Not cryptographic, but the cache only has to guard
+	 * against accidental collisions, and 128 bits makes those vanishingly
+	 * unlikely.
+	 */
+	class Hash {
+	private:
+		static constexpr unsigned __int128 PRIME =
+			(static_cast<unsigned __int128>(0x0000000001000000) << 64) | 0x000000000000013B;
+
+		unsigned __int128 state =
+			(static_cast<unsigned __int128>(0x6C62272E07BB0142) << 64) | 0x62B821756295C58D;
+
+	public:
+		void update(const char *data, std::size_t size) {
+			for (std::size_t i=0; i < size; ++i) {
+				state ^= static_cast<unsigned char>(data[i]);
+				state *= PRIME;
+			}
+		}
+
+		/*
+		 * Hash a string along with its length, so that the boundaries between
+		 * strings are part of the hash
+		 */
+		void update(const std::string &str) {
+			std::uint64_t size = str.size();
+			update(reinterpret_cast<const char *>(&size), sizeof(size));
+			update(str.data(), str.size());
+		}
+
+		std::string hex() const {
+			static const char digits[] = "0123456789abcdef";
+			std::string out(32, '0');
+
+			for (int i=0; i < 32; ++i) {
+				out[31 - i] = digits[static_cast<unsigned>(state >> (4 * i)) & 0xF];
+			}
+
+			return out;
+		}
+	};
+}
+
+Cache::Cache(fs::path dir, std::uintmax_t maxSize) : dir(dir), maxSize(maxSize) {
+	fs::create_directories(dir);
+}
+
+fs::path Cache::entryPath(const std::string &key) const {
+	// Fan entries out over subdirectories so no one directory gets too big
+	return dir / key.substr(0, 2) / key.substr(2);
+}
+
+bool Cache::copyAtomic(const fs::path &src, const fs::path &dst) {
+	fs::path tmp = dst;
+	tmp += '.';
+	tmp += std::to_string(getpid());
+	tmp += '.';
+	tmp += std::to_string(tmpCounter++);
+	tmp += ".tmp";
+
+	std::error_code ec;
+	fs::copy_file(src, tmp, fs::copy_options::overwrite_existing, ec);
+
+	if (!ec) {
+		fs::rename(tmp, dst, ec);
+	}
+
+	if (ec) {
+		fs::remove(tmp, ec);
+		return false;
+	}
+
+	return true;
+}
+
+std::string Cache::key(const char *source, std::size_t size, const std::vector<std::string> &components) {
+	Hash hash;
+
+	hash.update(VERSION);
+	hash.update(reinterpret_cast<const char *>(&IR::OBJECT_VERSION), sizeof(IR::OBJECT_VERSION));
+
+	std::uint64_t count = components.size();
+	hash.update(reinterpret_cast<const char *>(&count), sizeof(count));
+	for (const std::string &component : components) {
+		hash.update(component);
+	}
+
+	hash.update(source, size);
+
+	return hash.hex();
+}
+
+bool Cache::fetch(const std::string &key, const std::string &dstFile) {
+	fs::path entry = entryPath(key);
+
+	if (copyAtomic(entry, dstFile)) {
+		// Mark the entry as recently used, so trim keeps it
+		std::error_code ec;
+		fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+
+		++hitCount;
+		return true;
+	} else {
+		++missCount;
+		return false;
+	}
+}
+
+void Cache::store(const std::string &key, const std::string &srcFile) {
+	fs::path entry = entryPath(key);
+
+	std::error_code ec;
+	fs::create_directories(entry.parent_path(), ec);
+
+	if (!ec) {
+		copyAtomic(srcFile, entry);
+	}
+}
+
+void Cache::trim() {
+	struct Entry {
+		fs::path path;
+		std::uintmax_t size;
+		fs::file_time_type used;
+	};
+
+	std::vector<Entry> entries;
+	std::uintmax_t total = 0;
+
+	// Other processes may be adding and removing entries, so every error here
+	// is ignored
+	std::error_code ec;
+	for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+		bool regular = it->is_regular_file(ec);
+
+		Entry entry = {it->path(), 0, {}};
+		if (!ec && regular) {
+			entry.size = it->file_size(ec);
+			if (!ec) entry.used = it->last_write_time(ec);
+		}
+
+		if (ec || !regular || entry.path.extension() == ".tmp") {
+			ec.clear();
+			continue;
+		}
+
+		total += entry.size;
+		entries.push_back(std::move(entry));
+	}
+
+	if (total <= maxSize) return;
+
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+		return a.used < b.used;
+	});
+
+	for (const Entry &entry : entries) {
+		if (total <= maxSize) break;
+
+		if (fs::remove(entry.path, ec)) {
+			total -= entry.size;
+		}
+	}
+}
+
+std::uint64_t Cache::hits() const {
+	return hitCount;
+}
+
+std::uint64_t Cache::misses() const {
+	return missCount;
+}
@@ -0,0 +1,93 @@
+/*
+ * Dead code elimination
+ *
+ * Removes the code which can never run. CellValues follows the program from
+ * its entry points, taking only the edges which can be taken given what is
+ * known about the cells, so a loop whose cell is zero when control reaches
+ * it, such as a comment loop at the start of the program or the second loop
+ * of ][, is never entered.
+ *
+ * Blocks that are never reached are removed, jumps which are never taken are
+ * removed, jumps which are always taken become unconditional, and labels
+ * which nothing refers to anymore are pruned.
+ */
+
+#include <iostream>
+#include <vector>
+
+#include "analysis.hpp"
+#include "ir.hpp"
+#include "passes.hpp"
+
+namespace {
+	using namespace IR;
+
+	class DeadCodePass : public IPass {
+	private:
+		// What was done, for the report
+		std::size_t blocksRemoved = 0;
+		std::size_t jumpsRemoved = 0;
+		std::size_t jumpsFolded = 0;
+		std::size_t instructionsRemoved = 0;
+		std::size_t labelsPruned = 0;
+
+	public:
+		AnalysisSet required() {
+			return CFG_ANALYSIS | CELL_VALUES_ANALYSIS;
+		}
+
+		AnalysisSet run(Program &program, AnalysisManager &analyses) {
+			const CFG &cfg = analyses.getCFG();
+			const CellValues &values = analyses.getCellValues();
+
+			std::vector<bool> dead(program.size(), false);
+			bool changed = false;
+
+			for (CFG::BlockID block=0; block < cfg.size(); ++block) {
+				std::size_t begin = cfg.begin(block), end = cfg.end(block);
+
+				if (!values.reachable(block)) {
+					for (std::size_t i=begin; i < end; ++i) {
+						dead[i] = true;
+					}
+
+					++blocksRemoved;
+					instructionsRemoved += end - begin;
+					changed = true;
+					continue;
+				}
+
+				Instruction &jump = program[end - 1];
+				Condition cc = jump.getCondition();
+
+				if (jump.getOpcode() != JMP || cc == AL || cc == NV) continue;
+
+				if (!values.branchTaken(block)) {
+					dead[end - 1] = true;
+					++jumpsRemoved;
+					++instructionsRemoved;
+					changed = true;
+				} else if (!values.fallthroughTaken(block)) {
+					jump.setCondition(AL);
+					++jumpsFolded;
+					changed = true;
+				}
+			}
+
+			if (!changed) return ALL_ANALYSES;
+
+			program.erase(dead);
+			labelsPruned += program.pruneLabels();
+
+			return NO_ANALYSES;
+		}
+
+		void report(std::ostream &os) {
+			os << "  removed " << blocksRemoved << " unreachable blocks, " << jumpsRemoved
+				<< " jumps never taken (" << instructionsRemoved << " instructions); " << jumpsFolded
+				<< " jumps always taken; " << labelsPruned << " unused labels removed" << std::endl;
+		}
+	};
+
+	int registered = PassFactory::getInstance().registerComponent([]() { return new DeadCodePass(); }, {"dce"});
+}
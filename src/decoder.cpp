@@ -0,0 +1,279 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+
+namespace IR {
+	/***********
+	 * Decoder *
+	 ***********/
+	Decoder::Decoder(const ObjectView &object)
+		: code(object.code().data()), codeSize(object.code().size()), object(object) {}
+
+	Decoder::Decoder(const std::uint8_t *code, std::size_t size) : code(code), codeSize(size) {}
+
+	DecodedInstruction Decoder::decode(std::size_t offset) const {
+		DecodedInstruction instr;
+		std::size_t pos = offset;
+
+		/*
+		 * Take the next n bytes of the instruction
+		 */
+		auto take = [this, &pos](std::size_t n) {
+			if (pos + n > codeSize) {
+				throw InvalidInstructionException("Instruction runs past the end of the bytecode");
+			}
+
+			const std::uint8_t *bytes = code + pos;
+			pos += n;
+			return bytes;
+		};
+
+		/*
+		 * Read an n byte little endian integer
+		 */
+		auto readInt = [&take](std::size_t n) {
+			const std::uint8_t *bytes = take(n);
+			std::uintmax_t value = 0;
+
+			for (std::size_t i=0; i < n; ++i) {
+				value |= static_cast<std::uintmax_t>(bytes[i]) << (8 * i);
+			}
+
+			return value;
+		};
+
+		// The instruction byte
+		std::uint8_t instructionByte = *take(1);
+
+		instr.offset = offset;
+		instr.opcode = static_cast<Opcode>(instructionByte >> 4);
+
+		bool displaced = instructionByte & 1;
+		OperandType op2Type = static_cast<OperandType>((instructionByte >> 1) & 0b11);
+
+		instr.hasCC = instr.opcode == JMP;
+		instr.hasSize = instr.opcode != JMP && instr.opcode != CALL;
+		instr.hasOp1 = instr.opcode != JMP && instr.opcode != CALL;
+		instr.hasOp2 = instr.opcode != CPL;
+
+		instr.op1.type = (instructionByte & (1 << 3)) ? INDIRECT : REGISTER;
+		instr.op2.type = op2Type;
+
+		// The packed fields following the instruction byte. These are read
+		// most significant bit first, and a field which does not fit in the
+		// rest of a byte starts at the top of the next one.
+		std::uint8_t scratch = 0;
+		int scratch_pos = 0;
+
+		auto readBits = [&take, &scratch, &scratch_pos](int n) {
+			if (scratch_pos - n < 0) {
+				scratch = *take(1);
+				scratch_pos = 8;
+			}
+
+			scratch_pos -= n;
+			return (scratch >> scratch_pos) & ((1 << n) - 1);
+		};
+
+		if (instr.hasCC) {
+			instr.cc = static_cast<Condition>(readBits(4));
+		}
+
+		if (instr.hasSize) {
+			instr.size = static_cast<OperandSize>(readBits(2));
+		}
+
+		if (instr.hasOp1) {
+			instr.op1.reg = static_cast<Register>(readBits(3));
+		}
+
+		if (instr.hasOp2 && (op2Type == REGISTER || op2Type == INDIRECT)) {
+			instr.op2.reg = static_cast<Register>(readBits(3));
+		}
+
+		if (displaced) {
+			instr.displacement = static_cast<std::int32_t>(readInt(sizeof(std::int32_t)));
+		}
+
+		if (instr.hasOp2) {
+			switch (op2Type) {
+				case REGISTER:
+				case INDIRECT:
+					break;
+				case SYMBOL:
+					instr.op2.address = readInt(sizeof(std::uint32_t));
+
+					if (instr.op2.address & EXTERNAL_SYMBOL) {
+						instr.op2.external = true;
+						instr.op2.symbol = instr.op2.address & ~EXTERNAL_SYMBOL;
+						instr.op2.address = 0;
+
+						if (object) {
+							if (instr.op2.symbol >= object->symbols().size()) {
+								throw InvalidInstructionException("External symbol is not in the symbol table");
+							}
+
+							instr.op2.name = object->name(object->symbols()[instr.op2.symbol]);
+						}
+					}
+					break;
+				case LITERAL:
+					// instructions without a size specifier use word literals
+					instr.op2.literal = readInt(1U << (instr.hasSize ? instr.size : WORD));
+					break;
+			}
+		}
+
+		instr.length = pos - offset;
+
+		return instr;
+	}
+
+	Decoder::iterator Decoder::begin() const {
+		return iterator(this, 0);
+	}
+
+	Decoder::iterator Decoder::end() const {
+		return iterator(this, codeSize);
+	}
+
+	std::size_t Decoder::size() const {
+		return codeSize;
+	}
+
+
+	/*********************
+	 * Decoder::iterator *
+	 *********************/
+	Decoder::iterator::iterator() : decoder(nullptr) {}
+
+	Decoder::iterator::iterator(const Decoder *decoder, std::size_t offset) : decoder(decoder) {
+		if (offset < decoder->codeSize) {
+			current = decoder->decode(offset);
+		} else {
+			current.offset = decoder->codeSize;
+		}
+	}
+
+	Decoder::iterator::reference Decoder::iterator::operator*() const {
+		return current;
+	}
+
+	Decoder::iterator::pointer Decoder::iterator::operator->() const {
+		return &current;
+	}
+
+	Decoder::iterator &Decoder::iterator::operator++() {
+		*this = iterator(decoder, current.offset + current.length);
+		return *this;
+	}
+
+	Decoder::iterator Decoder::iterator::operator++(int) {
+		iterator prev = *this;
+		++*this;
+		return prev;
+	}
+
+	bool Decoder::iterator::operator==(const iterator &other) const {
+		return decoder == other.decoder && current.offset == other.current.offset;
+	}
+
+
+
+	/***************
+	 * disassemble *
+	 ***************/
+	Program disassemble(const ObjectView &object) {
+		Decoder decoder(object);
+		Program program;
+		SymbolTable &symbols = program.symbols();
+
+		// Every address which has a label, with the labels pointing there.
+		// Named labels come from the symbol table, and any other address which
+		// is referred to gets an anonymous label.
+		std::map<std::uint32_t, std::vector<Symbol>> labels;
+
+		for (const ObjectSymbol &symbol : object.symbols()) {
+			if (symbol.flags & ObjectSymbol::DEFINED) {
+				labels[symbol.value].push_back(symbols.intern(std::string(object.name(symbol))));
+			}
+		}
+
+		for (const DecodedInstruction &instr : decoder) {
+			if (instr.hasOp2 && instr.op2.type == SYMBOL && !instr.op2.external) {
+				std::vector<Symbol> &here = labels[instr.op2.address];
+
+				if (here.empty()) {
+					here.push_back(symbols.anonymous());
+				}
+			}
+		}
+
+		auto nextLabel = labels.begin();
+		auto sourceMap = object.sourceMap();
+		auto nextLocation = sourceMap.begin();
+
+		for (const DecodedInstruction &instr : decoder) {
+			for (; nextLabel != labels.end() && nextLabel->first <= instr.offset; ++nextLabel) {
+				if (nextLabel->first != instr.offset) {
+					throw InvalidInstructionException("Symbol points into the middle of an instruction");
+				}
+
+				for (Symbol label : nextLabel->second) {
+					program.label(label);
+				}
+			}
+
+			if (nextLocation != sourceMap.end() && nextLocation->address == instr.offset) {
+				program.source(nextLocation->source);
+				++nextLocation;
+			}
+
+			_InstructionPtr ptr = program(instr.opcode);
+
+			if (instr.hasSize) ptr(instr.size);
+			if (instr.hasCC) ptr(instr.cc);
+
+			for (const DecodedOperand *op : {&instr.op1, &instr.op2}) {
+				if (op == &instr.op1 ? !instr.hasOp1 : !instr.hasOp2) continue;
+
+				switch (op->type) {
+					case REGISTER:
+						ptr(op->reg);
+						break;
+					case INDIRECT:
+						ptr[op->reg + instr.displacement];
+						break;
+					case SYMBOL:
+						if (op->external) {
+							ptr(symbols.intern(std::string(op->name)));
+						} else {
+							ptr(labels[op->address].front());
+						}
+						break;
+					case LITERAL:
+						ptr(op->literal);
+						break;
+				}
+			}
+		}
+
+		program.image().assign(object.image().begin(), object.image().end());
+		program.output().assign(object.output().begin(), object.output().end());
+
+		// labels at the very end of the program
+		for (; nextLabel != labels.end(); ++nextLabel) {
+			if (nextLabel->first != decoder.size()) {
+				throw InvalidInstructionException("Symbol points past the end of the bytecode");
+			}
+
+			for (Symbol label : nextLabel->second) {
+				program.label(label);
+			}
+		}
+
+		return program;
+	}
+}
@@ -0,0 +1,286 @@
+#include <array>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <elf.h>
+
+#include "elfwriter.hpp"
+
+namespace {
+	// Where executables are loaded, and the page size their segments are
+	// aligned to
+	constexpr std::uint64_t BASE_ADDRESS = 0x400000;
+	constexpr std::uint64_t PAGE_SIZE = 0x1000;
+
+	// Executables always have the same program headers: text, rodata, bss
+	// and the stack. The rodata segment is left null when there is no rodata.
+	constexpr std::size_t PROGRAM_HEADERS = 4;
+	constexpr std::uint64_t TEXT_OFFSET = sizeof(Elf64_Ehdr) + PROGRAM_HEADERS * sizeof(Elf64_Phdr);
+
+	std::uint64_t alignUp(std::uint64_t value, std::uint64_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	/*
+	 * Append the bytes of a structure to a file
+	 */
+	template<typename T>
+	void append(std::vector<std::uint8_t> &file, const T &value) {
+		std::size_t end = file.size();
+
+		file.resize(end + sizeof(T));
+		std::memcpy(file.data() + end, &value, sizeof(T));
+	}
+
+	void pad(std::vector<std::uint8_t> &file, std::uint64_t alignment) {
+		file.resize(alignUp(file.size(), alignment), 0);
+	}
+
+	/*
+	 * The contents of a string table section
+	 */
+	class StringTable {
+	private:
+		std::vector<std::uint8_t> strings = {0};
+
+	public:
+		/*
+		 * Add a string, returning its index in the table
+		 */
+		Elf64_Word add(const std::string &string) {
+			Elf64_Word index = strings.size();
+
+			strings.insert(strings.end(), string.begin(), string.end());
+			strings.push_back(0);
+
+			return index;
+		}
+
+		const std::vector<std::uint8_t> &data() const {
+			return strings;
+		}
+	};
+
+	/*
+	 * Sections which follow the loaded ones, and the section headers. Every
+	 * ELF file we write ends this way.
+	 */
+	class SectionTable {
+	private:
+		std::vector<Elf64_Shdr> headers;
+		StringTable names;
+
+	public:
+		SectionTable() {
+			headers.push_back({});
+		}
+
+		/*
+		 * Add a section header, returning its index
+		 */
+		Elf64_Half add(const std::string &name, Elf64_Word type, Elf64_Xword flags, Elf64_Addr address,
+					   Elf64_Off offset, Elf64_Xword size, Elf64_Word link = 0, Elf64_Word info = 0,
+					   Elf64_Xword alignment = 1, Elf64_Xword entrySize = 0) {
+			headers.push_back({names.add(name), type, flags, address, offset, size, link, info, alignment,
+							   entrySize});
+
+			return headers.size() - 1;
+		}
+
+		/*
+		 * Append the contents of a section which isn't loaded to the file,
+		 * and add its header
+		 */
+		Elf64_Half append(std::vector<std::uint8_t> &file, const std::string &name, Elf64_Word type,
+						  const std::vector<std::uint8_t> &contents, Elf64_Word link = 0, Elf64_Word info = 0,
+						  Elf64_Xword alignment = 1, Elf64_Xword entrySize = 0) {
+			pad(file, alignment);
+
+			Elf64_Off offset = file.size();
+			file.insert(file.end(), contents.begin(), contents.end());
+
+			return add(name, type, 0, 0, offset, contents.size(), link, info, alignment, entrySize);
+		}
+
+		/*
+		 * Append .shstrtab and the section headers to the file, and point
+		 * the file header at them
+		 */
+		void finish(std::vector<std::uint8_t> &file) {
+			// The name must be added before the table is written
+			Elf64_Word name = names.add(".shstrtab");
+			headers.push_back({name, SHT_STRTAB, 0, 0, file.size(), names.data().size(), 0, 0, 1, 0});
+			file.insert(file.end(), names.data().begin(), names.data().end());
+
+			pad(file, 8);
+
+			Elf64_Ehdr *header = reinterpret_cast<Elf64_Ehdr *>(file.data());
+			header->e_shoff = file.size();
+			header->e_shnum = headers.size();
+			header->e_shstrndx = headers.size() - 1;
+
+			for (const Elf64_Shdr &section : headers) {
+				::append(file, section);
+			}
+		}
+	};
+
+	Elf64_Ehdr fileHeader(Elf64_Half type, Elf64_Addr entry, Elf64_Half programHeaders) {
+		Elf64_Ehdr header = {};
+
+		std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+		header.e_ident[EI_CLASS] = ELFCLASS64;
+		header.e_ident[EI_DATA] = ELFDATA2LSB;
+		header.e_ident[EI_VERSION] = EV_CURRENT;
+		header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+
+		header.e_type = type;
+		header.e_machine = EM_X86_64;
+		header.e_version = EV_CURRENT;
+		header.e_entry = entry;
+		header.e_phoff = programHeaders ? sizeof(Elf64_Ehdr) : 0;
+		header.e_ehsize = sizeof(Elf64_Ehdr);
+		header.e_phentsize = programHeaders ? sizeof(Elf64_Phdr) : 0;
+		header.e_phnum = programHeaders;
+		header.e_shentsize = sizeof(Elf64_Shdr);
+
+		return header;
+	}
+
+	/*
+	 * Returns the contents of a symbol table holding the given symbols, after
+	 * the null symbol and any local symbols already in table
+	 */
+	std::vector<std::uint8_t> symbolTable(std::vector<Elf64_Sym> table, StringTable &strings,
+										  const std::vector<ElfWriter::Symbol> &symbols,
+										  const std::array<std::uint64_t, 3> &addresses) {
+		for (const ElfWriter::Symbol &symbol : symbols) {
+			table.push_back({strings.add(symbol.name), ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE), STV_DEFAULT,
+							 static_cast<Elf64_Half>(1 + symbol.section), addresses[symbol.section] + symbol.offset,
+							 0});
+		}
+
+		std::vector<std::uint8_t> contents;
+		for (const Elf64_Sym &entry : table) {
+			append(contents, entry);
+		}
+
+		return contents;
+	}
+}
+
+/*************
+ * ElfWriter *
+ *************/
+ElfWriter::ElfWriter(const std::vector<std::uint8_t> &text, const std::vector<std::uint8_t> &rodata,
+					 std::uint64_t bssSize) : text(text), rodata(rodata), bssSize(bssSize) {}
+
+void ElfWriter::addSymbol(const Symbol &symbol) {
+	symbols.push_back(symbol);
+}
+
+void ElfWriter::addRelocation(const Relocation &relocation) {
+	relocations.push_back(relocation);
+}
+
+std::array<std::uint64_t, 3> ElfWriter::addresses(std::uint64_t textSize, std::uint64_t rodataSize) {
+	// Each segment is given its own pages, so that they can be mapped with
+	// different permissions. A segment's address must be congruent to its
+	// offset in the file modulo the page size.
+	std::uint64_t textAddress = BASE_ADDRESS + TEXT_OFFSET;
+	std::uint64_t rodataOffset = alignUp(TEXT_OFFSET + textSize, 16);
+	std::uint64_t rodataAddress = alignUp(textAddress + textSize, PAGE_SIZE) + rodataOffset % PAGE_SIZE;
+	std::uint64_t bssAddress = alignUp(rodataAddress + rodataSize, PAGE_SIZE);
+
+	return {textAddress, rodataAddress, bssAddress};
+}
+
+std::vector<std::uint8_t> ElfWriter::executable(std::uint64_t entry) const {
+	std::array<std::uint64_t, 3> address = addresses(text.size(), rodata.size());
+	std::vector<std::uint8_t> file;
+
+	append(file, fileHeader(ET_EXEC, entry, PROGRAM_HEADERS));
+
+	// The headers are loaded along with the text, which starts right after
+	// them
+	append(file, Elf64_Phdr{PT_LOAD, PF_R | PF_X, 0, BASE_ADDRESS, BASE_ADDRESS, TEXT_OFFSET + text.size(),
+							TEXT_OFFSET + text.size(), PAGE_SIZE});
+
+	std::uint64_t rodataOffset = alignUp(TEXT_OFFSET + text.size(), 16);
+	if (rodata.empty()) {
+		append(file, Elf64_Phdr{PT_NULL, 0, 0, 0, 0, 0, 0, 0});
+	} else {
+		append(file, Elf64_Phdr{PT_LOAD, PF_R, rodataOffset, address[RODATA], address[RODATA], rodata.size(),
+								rodata.size(), PAGE_SIZE});
+	}
+
+	append(file, Elf64_Phdr{PT_LOAD, PF_R | PF_W, 0, address[BSS], address[BSS], 0, bssSize, PAGE_SIZE});
+	append(file, Elf64_Phdr{PT_GNU_STACK, PF_R | PF_W, 0, 0, 0, 0, 0, 16});
+
+	file.insert(file.end(), text.begin(), text.end());
+	pad(file, 16);
+	file.insert(file.end(), rodata.begin(), rodata.end());
+
+	SectionTable sections;
+	sections.add(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, address[TEXT], TEXT_OFFSET, text.size(),
+				 0, 0, 16);
+	sections.add(".rodata", SHT_PROGBITS, SHF_ALLOC, address[RODATA], rodataOffset, rodata.size(), 0, 0, 16);
+	sections.add(".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, address[BSS], rodataOffset + rodata.size(), bssSize,
+				 0, 0, 64);
+
+	// The symbol table is only there for debuggers and disassemblers
+	StringTable strings;
+	std::vector<std::uint8_t> symtab = symbolTable({Elf64_Sym{}}, strings, symbols, address);
+
+	sections.append(file, ".symtab", SHT_SYMTAB, symtab, 5, 1, 8, sizeof(Elf64_Sym));
+	sections.append(file, ".strtab", SHT_STRTAB, strings.data());
+	sections.finish(file);
+
+	return file;
+}
+
+std::vector<std::uint8_t> ElfWriter::object() const {
+	std::vector<std::uint8_t> file;
+
+	append(file, fileHeader(ET_REL, 0, 0));
+
+	pad(file, 16);
+	std::uint64_t textOffset = file.size();
+	file.insert(file.end(), text.begin(), text.end());
+
+	pad(file, 16);
+	std::uint64_t rodataOffset = file.size();
+	file.insert(file.end(), rodata.begin(), rodata.end());
+
+	SectionTable sections;
+	sections.add(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, textOffset, text.size(), 0, 0, 16);
+	sections.add(".rodata", SHT_PROGBITS, SHF_ALLOC, 0, rodataOffset, rodata.size(), 0, 0, 16);
+	sections.add(".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 0, file.size(), bssSize, 0, 0, 64);
+
+	// Relocations refer to the section symbols, which follow the null symbol
+	// in the order of the sections
+	std::vector<std::uint8_t> rela;
+	for (const Relocation &relocation : relocations) {
+		append(rela, Elf64_Rela{relocation.offset, ELF64_R_INFO(1 + relocation.target, R_X86_64_PC32),
+								relocation.addend});
+	}
+
+	std::vector<Elf64_Sym> locals = {Elf64_Sym{}};
+	for (Elf64_Half section=1; section <= 3; ++section) {
+		locals.push_back({0, ELF64_ST_INFO(STB_LOCAL, STT_SECTION), STV_DEFAULT, section, 0, 0});
+	}
+
+	StringTable strings;
+	std::vector<std::uint8_t> symtab = symbolTable(locals, strings, symbols, {0, 0, 0});
+
+	sections.append(file, ".rela.text", SHT_RELA, rela, 5, 1, 8, sizeof(Elf64_Rela));
+	sections.append(file, ".symtab", SHT_SYMTAB, symtab, 6, locals.size(), 8, sizeof(Elf64_Sym));
+	sections.append(file, ".strtab", SHT_STRTAB, strings.data());
+	sections.finish(file);
+
+	return file;
+}
@@ -0,0 +1,51 @@
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "frontend.hpp"
+#include "mappedfile.hpp"
+#include "object.hpp"
+
+/*****************
+ * FrontendInlet *
+ *****************/
+static int registered = InletFactory::getInstance().registerComponent(
+	[]() { return new FrontendInlet(new BrainfuckFrontend()); }, {"bf", "brainfuck"});
+
+FrontendInlet::FrontendInlet(IFrontend *frontend) : frontend(frontend) {}
+
+void FrontendInlet::inject(std::string &file, Coupling::Drain &drain) {
+	// The object is handed on as one chunk, so nothing downstream has to
+	// copy it to see it whole
+	drain.write(frontend->parse(file));
+}
+
+FrontendInlet::~FrontendInlet() {
+	delete frontend;
+}
+
+
+/***************
+ * ObjectInlet *
+ ***************/
+static int registeredObject = InletFactory::getInstance().registerComponent(
+	[]() { return new ObjectInlet(); }, {"ir"});
+
+void ObjectInlet::inject(std::string &file, Coupling::Drain &drain) {
+	try {
+		MappedFile in(file);
+		const std::uint8_t *data = reinterpret_cast<const std::uint8_t *>(in.data());
+
+		// Mappings are page aligned, so the object can be viewed in place
+		IR::ObjectView view(data, in.size());
+
+		// Handed on as one chunk, like the frontend's objects, so that the
+		// stages after this can take it whole without copying it again
+		drain.write(Chunk(data, data + in.size()));
+	} catch (std::system_error &ex) {
+		throw std::runtime_error("Could not read " + file + ": " + ex.code().message());
+	} catch (IR::InvalidObjectException &ex) {
+		throw std::runtime_error(file + ": " + ex.what());
+	}
+}
@@ -0,0 +1,788 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "analysis.hpp"
+#include "backend.hpp"
+#include "decoder.hpp"
+#include "interpreter.hpp"
+
+/*
+ * Every operation, in the order of the handler table. Binary operations come
+ * in each operand size and each combination of operand kinds: R for a
+ * register, M for memory and I for an immediate. CMPJ and TSTJ are a compare
+ * fused with the jump after it.
+ */
+#define INTERPRETER_FORMS(X, NAME, SIZE) \
+	X(NAME##_##SIZE##_RR) X(NAME##_##SIZE##_RM) X(NAME##_##SIZE##_RI) \
+	X(NAME##_##SIZE##_MR) X(NAME##_##SIZE##_MM) X(NAME##_##SIZE##_MI)
+#define INTERPRETER_SIZES(X, NAME) \
+	INTERPRETER_FORMS(X, NAME, B) INTERPRETER_FORMS(X, NAME, H) \
+	INTERPRETER_FORMS(X, NAME, W) INTERPRETER_FORMS(X, NAME, D)
+#define INTERPRETER_OPERATIONS(X) \
+	INTERPRETER_SIZES(X, ADD) INTERPRETER_SIZES(X, SUB) INTERPRETER_SIZES(X, MUL) \
+	INTERPRETER_SIZES(X, DIV) INTERPRETER_SIZES(X, AND) INTERPRETER_SIZES(X, OR) \
+	INTERPRETER_SIZES(X, XOR) INTERPRETER_SIZES(X, LSL) INTERPRETER_SIZES(X, LSR) \
+	INTERPRETER_SIZES(X, ASR) INTERPRETER_SIZES(X, MOV) \
+	INTERPRETER_SIZES(X, CMP) INTERPRETER_SIZES(X, TST) \
+	INTERPRETER_SIZES(X, CMPJ) INTERPRETER_SIZES(X, TSTJ) \
+	X(CPL_B_R) X(CPL_B_M) X(CPL_H_R) X(CPL_H_M) \
+	X(CPL_W_R) X(CPL_W_M) X(CPL_D_R) X(CPL_D_M) \
+	X(AR_ADD) X(AR_MOVE_R) X(AR_MOVE_M) \
+	X(NOP) X(JMP) X(JMP_CC) X(JMP_REG) X(JMP_MEM) X(JMP_EXT) \
+	X(CALL) X(CALL_REG) X(CALL_MEM) X(CALL_EXT) \
+	X(LOOP) X(NATIVE) \
+	X(EXIT)
+
+#define INTERPRETER_ENUM(NAME) NAME,
+#define INTERPRETER_ADDRESS(NAME) &&NAME,
+
+namespace {
+	enum Operation : std::uint16_t {
+		INTERPRETER_OPERATIONS(INTERPRETER_ENUM)
+	};
+
+	// The offset of each form from the first form of its size
+	enum Form {
+		RR, RM, RI, MR, MM, MI
+	};
+
+	constexpr int FORMS = 6;
+
+	// Fusing a compare with its jump
+	constexpr int FUSED = CMPJ_B_RR - CMP_B_RR;
+
+	// The runtime routines
+	enum External : std::uint32_t {
+		PUTC, GETC, SCAN
+	};
+
+	// The flags, as bits
+	constexpr std::uint8_t Z_FLAG = 1, N_FLAG = 2, C_FLAG = 4, V_FLAG = 8;
+
+	/*
+	 * Returns the flags under which a condition holds, as a bit for each of
+	 * the 16 combinations of flags
+	 */
+	constexpr std::uint16_t conditionMask(unsigned cc) {
+		std::uint16_t mask = 0;
+
+		for (unsigned flags=0; flags < 16; ++flags) {
+			bool z = flags & Z_FLAG, n = flags & N_FLAG, c = flags & C_FLAG, v = flags & V_FLAG;
+			bool test = true;
+
+			// The low bits pick the test, and the top bit whether it must
+			// hold or fail
+			switch (cc & 7) {
+				case 1: test = z; break;
+				case 2: test = c; break;
+				case 3: test = n; break;
+				case 4: test = v; break;
+				case 5: test = c && !z; break;
+				case 6: test = n == v; break;
+				case 7: test = !z && n == v; break;
+			}
+
+			if (test == static_cast<bool>(cc & 8)) mask |= 1 << flags;
+		}
+
+		return mask;
+	}
+
+	constexpr std::uint16_t CONDITIONS[16] = {
+		conditionMask(0), conditionMask(1), conditionMask(2), conditionMask(3),
+		conditionMask(4), conditionMask(5), conditionMask(6), conditionMask(7),
+		conditionMask(8), conditionMask(9), conditionMask(10), conditionMask(11),
+		conditionMask(12), conditionMask(13), conditionMask(14), conditionMask(15)
+	};
+
+	inline bool taken(std::uint8_t cc, std::uint8_t flags) {
+		return (CONDITIONS[cc] >> flags) & 1;
+	}
+
+	template<typename T>
+	inline T load(std::uint64_t address) {
+		T value;
+		std::memcpy(&value, reinterpret_cast<const void *>(address), sizeof(T));
+		return value;
+	}
+
+	template<typename T>
+	inline void store(std::uint64_t address, T value) {
+		std::memcpy(reinterpret_cast<void *>(address), &value, sizeof(T));
+	}
+
+	/*
+	 * Load a value of any size, zero extended
+	 */
+	std::uint64_t loadSized(std::uint64_t address, std::uint8_t size) {
+		switch (size) {
+			case IR::BYTE: return load<std::uint8_t>(address);
+			case IR::HWORD: return load<std::uint16_t>(address);
+			case IR::WORD: return load<std::uint32_t>(address);
+			default: return load<std::uint64_t>(address);
+		}
+	}
+
+	std::uint64_t sizeMask(IR::OperandSize size) {
+		return size == IR::DWORD ? ~0ULL : (1ULL << (8 << size)) - 1;
+	}
+
+	std::int64_t signExtend(std::uint64_t value, std::uint8_t size) {
+		int shift = 64 - (8 << size);
+
+		return static_cast<std::int64_t>(value << shift) >> shift;
+	}
+
+	template<typename T>
+	inline std::uint8_t compareFlags(T a, T b) {
+		constexpr int top = 8 * sizeof(T) - 1;
+		T r = static_cast<T>(a - b);
+
+		// C means no borrow
+		return (r == 0 ? Z_FLAG : 0) | ((r >> top) & 1 ? N_FLAG : 0) | (a >= b ? C_FLAG : 0)
+			| ((((a ^ b) & (a ^ r)) >> top) & 1 ? V_FLAG : 0);
+	}
+
+	template<typename T>
+	inline std::uint8_t testFlags(T a, T b) {
+		constexpr int top = 8 * sizeof(T) - 1;
+		T r = a & b;
+
+		return (r == 0 ? Z_FLAG : 0) | ((r >> top) & 1 ? N_FLAG : 0);
+	}
+
+	// Shift counts are masked like x86's, so that both agree
+	template<typename T>
+	constexpr unsigned SHIFT_MASK = sizeof(T) == 8 ? 63 : 31;
+
+	/*
+	 * Write all of a buffer to stdout
+	 */
+	void writeOut(const std::uint8_t *bytes, std::size_t size) {
+		while (size > 0) {
+			ssize_t written = write(STDOUT_FILENO, bytes, size);
+
+			if (written < 0 && errno == EINTR) continue;
+			if (written <= 0) return;
+
+			bytes += written;
+			size -= written;
+		}
+	}
+}
+
+/***************
+ * Interpreter *
+ ***************/
+Interpreter::Interpreter(const IR::ObjectView &object, ILoopCompiler *compiler, std::uint32_t threshold)
+	: image(object.image().begin(), object.image().end()), output(object.output().begin(), object.output().end()),
+	  compiler(compiler), threshold(threshold) {
+	// The first operation of each binary IR opcode
+	static constexpr std::uint16_t BINARY[16] = {
+		NOP, ADD_B_RR, SUB_B_RR, MUL_B_RR, DIV_B_RR, CMP_B_RR, TST_B_RR, AND_B_RR,
+		OR_B_RR, XOR_B_RR, NOP, LSL_B_RR, LSR_B_RR, ASR_B_RR, MOV_B_RR, NOP
+	};
+
+	IR::Decoder decoder(object);
+
+	// The instructions whose target or literal is an address still to be
+	// turned into an index
+	std::vector<std::size_t> jumps, values;
+
+	code.reserve(object.code().size() / 2 + 1);
+	offsets.reserve(object.code().size() / 2 + 1);
+
+	auto external = [](const IR::DecodedOperand &symbol) -> std::uint32_t {
+		if (symbol.name == "putc") return PUTC;
+		if (symbol.name == "getc") return GETC;
+		if (symbol.name == "scan") return SCAN;
+
+		throw std::runtime_error("interp: the interpreter does not provide " + std::string(symbol.name));
+	};
+
+	for (const IR::DecodedInstruction &instr : decoder) {
+		Instruction &out = code.emplace_back();
+		const IR::DecodedOperand &op2 = instr.op2;
+
+		offsets.push_back(instr.offset);
+
+		out.handler = nullptr;
+		out.literal = 0;
+		out.displacement = instr.displacement;
+		out.target = 0;
+		out.op1 = instr.op1.reg;
+		out.op2 = op2.reg;
+		out.cc = instr.cc;
+		out.size = instr.size;
+
+		if (instr.opcode == IR::JMP || instr.opcode == IR::CALL) {
+			bool jump = instr.opcode == IR::JMP;
+
+			if (jump && instr.cc == IR::NV) {
+				out.operation = NOP;
+				continue;
+			}
+
+			switch (op2.type) {
+				case IR::REGISTER:
+					out.operation = jump ? JMP_REG : CALL_REG;
+					break;
+				case IR::INDIRECT:
+					out.operation = jump ? JMP_MEM : CALL_MEM;
+					break;
+				default:
+					if (op2.type == IR::SYMBOL && op2.external) {
+						out.operation = jump ? JMP_EXT : CALL_EXT;
+						out.target = external(op2);
+					} else {
+						// A literal is an address in the bytecode, like a label
+						out.operation = !jump ? CALL : instr.cc == IR::AL ? JMP : JMP_CC;
+						out.target = op2.type == IR::SYMBOL ? op2.address : static_cast<std::uint32_t>(op2.literal);
+						jumps.push_back(code.size() - 1);
+					}
+					break;
+			}
+
+			continue;
+		}
+
+		if (op2.type == IR::SYMBOL && op2.external) {
+			throw std::runtime_error("interp: the program takes the address of " + std::string(op2.name));
+		}
+
+		bool literal = op2.type == IR::LITERAL || op2.type == IR::SYMBOL;
+
+		if (literal) {
+			out.literal = op2.type == IR::SYMBOL ? op2.address : op2.literal & sizeMask(instr.size);
+			if (op2.type == IR::SYMBOL) values.push_back(code.size() - 1);
+		}
+
+		if (instr.opcode == IR::CPL) {
+			out.operation = CPL_B_R + instr.size * 2 + (instr.op1.type == IR::INDIRECT);
+		} else if ((instr.opcode == IR::ADD || instr.opcode == IR::SUB)
+				   && instr.op1.type == IR::REGISTER && instr.op1.reg == IR::AR) {
+			// AR is an address, so what is added to it is sign extended
+			bool subtract = instr.opcode == IR::SUB;
+
+			if (op2.type == IR::LITERAL) {
+				std::int64_t delta = signExtend(out.literal, instr.size);
+				out.operation = AR_ADD;
+				out.literal = subtract ? -delta : delta;
+			} else {
+				out.operation = op2.type == IR::REGISTER ? AR_MOVE_R : op2.type == IR::INDIRECT ? AR_MOVE_M : AR_ADD;
+				out.cc = subtract;
+			}
+		} else {
+			int form = (instr.op1.type == IR::INDIRECT ? MR : RR)
+				+ (literal ? RI : op2.type == IR::INDIRECT ? RM : RR);
+
+			out.operation = BINARY[instr.opcode] + instr.size * FORMS + form;
+		}
+	}
+
+	// Running off the end of the program, or jumping to the end of it, exits
+	offsets.push_back(object.code().size());
+	code.push_back({nullptr, 0, 0, 0, EXIT, 0, 0, 0, 0});
+
+	for (std::size_t i : jumps) {
+		code[i].target = index(code[i].target);
+	}
+
+	// Jumps back to the header of a natural loop close it, and are counted
+	// when tiered. Other jumps back don't make a loop the compiler can enter
+	// at the top. The CFG numbers instructions in decoding order, as here.
+	if (compiler) {
+		IR::CFG cfg(object);
+		IR::Dominators dominators(cfg);
+		IR::Loops loops(cfg, dominators);
+
+		for (std::size_t i : jumps) {
+			if (code[i].operation == CALL || code[i].target > i) continue;
+
+			IR::CFG::BlockID from = cfg.block(i), to = cfg.block(code[i].target);
+			IR::Loops::LoopID loop = loops.loop(to);
+
+			if (loop != IR::Loops::NO_LOOP && loops.header(loop) == to && loops.contains(loop, from)
+				&& cfg.branch(from) == to) {
+				code[i].operation = LOOP;
+			}
+		}
+	}
+
+	for (std::size_t i : values) {
+		code[i].literal = index(code[i].literal);
+	}
+
+	if (object.entry() != IR::NO_ENTRY) {
+		entry = index(object.entry());
+	}
+
+	// Fuse compares with the jumps after them. The jump keeps its own
+	// operation, for when it is jumped to directly.
+	for (std::size_t i=0; i + 1 < code.size(); ++i) {
+		std::uint16_t operation = code[i].operation, next = code[i + 1].operation;
+
+		if (operation >= CMP_B_RR && operation < CMPJ_B_RR && (next == JMP || next == JMP_CC)) {
+			code[i].operation += FUSED;
+		}
+	}
+}
+
+std::uint32_t Interpreter::index(std::uint32_t address) const {
+	auto it = std::lower_bound(offsets.begin(), offsets.end(), address);
+
+	if (it == offsets.end() || *it != address) {
+		throw IR::InvalidInstructionException("Jump into the middle of an instruction");
+	}
+
+	return it - offsets.begin();
+}
+
+void Interpreter::thread(const void *const *handlers) {
+	for (Instruction &instr : code) {
+		instr.handler = handlers[instr.operation];
+	}
+
+	threaded = true;
+}
+
+template<bool Switched>
+void Interpreter::execute(std::uint8_t *tape) {
+	static const void *const HANDLERS[] = {
+		INTERPRETER_OPERATIONS(INTERPRETER_ADDRESS)
+	};
+
+	// The handlers filled in belong to one instantiation, so the switch
+	// leaves them alone and has the next threaded run fill them in again
+	if constexpr (Switched) {
+		threaded = false;
+	} else if (!threaded) {
+		thread(HANDLERS);
+	}
+
+	std::uint64_t R[8] = {};
+	std::uint8_t flags = 0;
+
+	std::vector<std::uint8_t> buffer(BUFFER_SIZE);
+	std::size_t used = 0;
+
+	Instruction *const base = code.data();
+	Instruction *pc = base + entry;
+
+	// The last jump into a compiled loop. A loop around it is hot too.
+	const Instruction *inner = nullptr;
+
+	std::copy(image.begin(), image.end(), tape);
+	writeOut(output.data(), output.size());
+	R[IR::AR] = reinterpret_cast<std::uintptr_t>(tape);
+
+	/*
+	 * Returns the instruction at an index held in a register or memory
+	 */
+	auto at = [&](std::uint64_t index) {
+		if (index >= code.size()) {
+			throw std::runtime_error("interp: jump outside the program");
+		}
+
+		return base + index;
+	};
+
+	/*
+	 * Call a runtime routine
+	 */
+	auto external = [&](std::uint32_t routine) {
+		std::uint8_t *cell = reinterpret_cast<std::uint8_t *>(R[IR::AR]);
+
+		switch (routine) {
+			case PUTC:
+				buffer[used++] = *cell;
+
+				if (used == BUFFER_SIZE) {
+					writeOut(buffer.data(), used);
+					used = 0;
+				}
+				break;
+			case GETC:
+				writeOut(buffer.data(), used);
+				used = 0;
+
+				if (read(STDIN_FILENO, cell, 1) <= 0) *cell = 0;
+				break;
+			case SCAN:
+				while (*cell) {
+					R[IR::AR] += static_cast<std::int32_t>(R[IR::R0]);
+					cell = reinterpret_cast<std::uint8_t *>(R[IR::AR]);
+				}
+				break;
+		}
+	};
+
+	#define DISPATCH do { if constexpr (Switched) goto dispatch; else goto *pc->handler; } while (0)
+	#define NEXT do { ++pc; DISPATCH; } while (0)
+
+	#define OPERAND1_R T a = static_cast<T>(R[pc->op1]);
+	#define OPERAND1_M std::uint64_t address = R[pc->op1] + pc->displacement; T a = load<T>(address);
+	#define OPERAND2_R T b = static_cast<T>(R[pc->op2]);
+	#define OPERAND2_M T b = load<T>(R[pc->op2] + pc->displacement);
+	#define OPERAND2_I T b = static_cast<T>(pc->literal);
+	#define RESULT_R(VALUE) R[pc->op1] = static_cast<T>(VALUE);
+	#define RESULT_M(VALUE) store<T>(address, static_cast<T>(VALUE));
+
+	#define BINARY_FORM(NAME, SIZE, TYPE, DST, SRC, EXPR) \
+		NAME##_##SIZE##_##DST##SRC: { \
+			using T = TYPE; \
+			OPERAND1_##DST OPERAND2_##SRC \
+			RESULT_##DST(EXPR) \
+			NEXT; \
+		}
+	#define BINARY_SIZE(NAME, SIZE, TYPE, EXPR) \
+		BINARY_FORM(NAME, SIZE, TYPE, R, R, EXPR) BINARY_FORM(NAME, SIZE, TYPE, R, M, EXPR) \
+		BINARY_FORM(NAME, SIZE, TYPE, R, I, EXPR) BINARY_FORM(NAME, SIZE, TYPE, M, R, EXPR) \
+		BINARY_FORM(NAME, SIZE, TYPE, M, M, EXPR) BINARY_FORM(NAME, SIZE, TYPE, M, I, EXPR)
+	#define BINARY(NAME, EXPR) \
+		BINARY_SIZE(NAME, B, std::uint8_t, EXPR) BINARY_SIZE(NAME, H, std::uint16_t, EXPR) \
+		BINARY_SIZE(NAME, W, std::uint32_t, EXPR) BINARY_SIZE(NAME, D, std::uint64_t, EXPR)
+
+	// A fused compare takes the jump after it, or skips over it
+	#define BRANCH_PLAIN NEXT;
+	#define BRANCH_FUSED \
+		if (taken(pc[1].cc, flags)) { \
+			pc = base + pc[1].target; \
+			DISPATCH; \
+		} \
+		pc += 2; \
+		DISPATCH;
+
+	#define COMPARE_FORM(NAME, SIZE, TYPE, DST, SRC, FLAGS, BRANCH) \
+		NAME##_##SIZE##_##DST##SRC: { \
+			using T = TYPE; \
+			OPERAND1_##DST OPERAND2_##SRC \
+			flags = FLAGS<T>(a, b); \
+			BRANCH_##BRANCH \
+		}
+	#define COMPARE_SIZE(NAME, SIZE, TYPE, FLAGS, BRANCH) \
+		COMPARE_FORM(NAME, SIZE, TYPE, R, R, FLAGS, BRANCH) COMPARE_FORM(NAME, SIZE, TYPE, R, M, FLAGS, BRANCH) \
+		COMPARE_FORM(NAME, SIZE, TYPE, R, I, FLAGS, BRANCH) COMPARE_FORM(NAME, SIZE, TYPE, M, R, FLAGS, BRANCH) \
+		COMPARE_FORM(NAME, SIZE, TYPE, M, M, FLAGS, BRANCH) COMPARE_FORM(NAME, SIZE, TYPE, M, I, FLAGS, BRANCH)
+	#define COMPARE(NAME, FLAGS, BRANCH) \
+		COMPARE_SIZE(NAME, B, std::uint8_t, FLAGS, BRANCH) COMPARE_SIZE(NAME, H, std::uint16_t, FLAGS, BRANCH) \
+		COMPARE_SIZE(NAME, W, std::uint32_t, FLAGS, BRANCH) COMPARE_SIZE(NAME, D, std::uint64_t, FLAGS, BRANCH)
+
+	#define UNARY_FORM(NAME, SIZE, TYPE, DST, EXPR) \
+		NAME##_##SIZE##_##DST: { \
+			using T = TYPE; \
+			OPERAND1_##DST \
+			RESULT_##DST(EXPR) \
+			NEXT; \
+		}
+	#define UNARY(NAME, EXPR) \
+		UNARY_FORM(NAME, B, std::uint8_t, R, EXPR) UNARY_FORM(NAME, B, std::uint8_t, M, EXPR) \
+		UNARY_FORM(NAME, H, std::uint16_t, R, EXPR) UNARY_FORM(NAME, H, std::uint16_t, M, EXPR) \
+		UNARY_FORM(NAME, W, std::uint32_t, R, EXPR) UNARY_FORM(NAME, W, std::uint32_t, M, EXPR) \
+		UNARY_FORM(NAME, D, std::uint64_t, R, EXPR) UNARY_FORM(NAME, D, std::uint64_t, M, EXPR)
+
+	#define SWITCH_CASE(NAME) case NAME: goto NAME;
+
+	// Every instruction comes back here to find the next handler if
+	// Switched. Otherwise only the first one does.
+	[[maybe_unused]] dispatch:
+	if constexpr (Switched) {
+		switch (pc->operation) {
+			INTERPRETER_OPERATIONS(SWITCH_CASE)
+		}
+	}
+
+	goto *pc->handler;
+
+	// Arithmetic is done in 64 bits and truncated, so that nothing is
+	// promoted to a signed int which could overflow
+	BINARY(ADD, std::uint64_t(a) + b)
+	BINARY(SUB, std::uint64_t(a) - b)
+	BINARY(MUL, std::uint64_t(a) * b)
+	BINARY(DIV, b ? a / b : 0)
+	BINARY(AND, a & b)
+	BINARY(OR, a | b)
+	BINARY(XOR, a ^ b)
+	BINARY(LSL, std::uint64_t(a) << (b & SHIFT_MASK<T>))
+	BINARY(LSR, std::uint64_t(a) >> (b & SHIFT_MASK<T>))
+	BINARY(ASR, std::int64_t(std::make_signed_t<T>(a)) >> (b & SHIFT_MASK<T>))
+	BINARY(MOV, ((void)a, b))
+
+	COMPARE(CMP, compareFlags, PLAIN)
+	COMPARE(TST, testFlags, PLAIN)
+	COMPARE(CMPJ, compareFlags, FUSED)
+	COMPARE(TSTJ, testFlags, FUSED)
+
+	UNARY(CPL, ~a)
+
+	AR_ADD:
+		R[IR::AR] += pc->literal;
+		NEXT;
+
+	AR_MOVE_R:
+	AR_MOVE_M:
+		{
+			std::uint64_t value = pc->operation == AR_MOVE_R ? R[pc->op2] : loadSized(R[pc->op2] + pc->displacement, pc->size);
+			std::int64_t delta = signExtend(value, pc->size);
+
+			R[IR::AR] += pc->cc ? -delta : delta;
+			NEXT;
+		}
+
+	NOP:
+		NEXT;
+
+	JMP:
+		pc = base + pc->target;
+		DISPATCH;
+
+	JMP_CC:
+		if (taken(pc->cc, flags)) {
+			pc = base + pc->target;
+			DISPATCH;
+		}
+		NEXT;
+
+	JMP_REG:
+		if (!taken(pc->cc, flags)) NEXT;
+		pc = at(R[pc->op2]);
+		DISPATCH;
+
+	JMP_MEM:
+		if (!taken(pc->cc, flags)) NEXT;
+		pc = at(load<std::uint64_t>(R[pc->op2] + pc->displacement));
+		DISPATCH;
+
+	// Jumping to a runtime routine returns to LR when it's done
+	JMP_EXT:
+		if (!taken(pc->cc, flags)) NEXT;
+		external(pc->target);
+		pc = at(R[IR::LR]);
+		DISPATCH;
+
+	// Local calls put the return address in LR, which may also be where the
+	// call goes
+	CALL:
+		R[IR::LR] = pc - base + 1;
+		pc = base + pc->target;
+		DISPATCH;
+
+	CALL_REG:
+		{
+			std::uint64_t target = R[pc->op2];
+
+			R[IR::LR] = pc - base + 1;
+			pc = at(target);
+			DISPATCH;
+		}
+
+	CALL_MEM:
+		{
+			std::uint64_t target = load<std::uint64_t>(R[pc->op2] + pc->displacement);
+
+			R[IR::LR] = pc - base + 1;
+			pc = at(target);
+			DISPATCH;
+		}
+
+	CALL_EXT:
+		external(pc->target);
+		NEXT;
+
+	// A jump back counts how often its loop has gone round in the literal,
+	// and has the loop compiled once it is hot, or once a loop inside it has
+	// been. Otherwise an outer loop would spend the run going back and forth
+	// between the interpreter and the loops inside it.
+	LOOP:
+		if (!taken(pc->cc, flags)) NEXT;
+
+		if (++pc->literal >= threshold || (inner && inner >= base + pc->target && inner < pc)) {
+			std::uint32_t start = offsets[pc->target], end = offsets[pc - base + 1];
+			ICompiledLoop *loop = nullptr;
+
+			try {
+				if (compiler) loop = compiler->compile(start, end);
+			} catch (std::system_error &) {
+				// Nothing more will be compiled if memory can't be had
+				compiler = nullptr;
+			}
+
+			if (loop) {
+				pc->literal = loops.size();
+				pc->operation = NATIVE;
+				loops.emplace_back(loop);
+			} else {
+				pc->operation = pc->cc == IR::AL ? JMP : JMP_CC;
+			}
+
+			if constexpr (!Switched) pc->handler = HANDLERS[pc->operation];
+		}
+
+		pc = base + pc->target;
+		DISPATCH;
+
+	// A jump back to a compiled loop runs it, from the top
+	NATIVE:
+		if (!taken(pc->cc, flags)) NEXT;
+
+		{
+			State state;
+
+			std::copy(R, R + 8, state.registers);
+			state.flags = flags;
+			state.buffer = buffer.data();
+			state.used = used;
+
+			std::uint32_t address = loops[pc->literal]->run(state);
+
+			std::copy(state.registers, state.registers + 8, R);
+			flags = state.flags;
+			used = state.used;
+
+			inner = pc;
+			pc = base + index(address);
+			DISPATCH;
+		}
+
+	EXIT:
+		writeOut(buffer.data(), used);
+		return;
+
+	#undef DISPATCH
+	#undef NEXT
+	#undef OPERAND1_R
+	#undef OPERAND1_M
+	#undef OPERAND2_R
+	#undef OPERAND2_M
+	#undef OPERAND2_I
+	#undef RESULT_R
+	#undef RESULT_M
+	#undef BINARY_FORM
+	#undef BINARY_SIZE
+	#undef BINARY
+	#undef BRANCH_PLAIN
+	#undef BRANCH_FUSED
+	#undef COMPARE_FORM
+	#undef COMPARE_SIZE
+	#undef COMPARE
+	#undef UNARY_FORM
+	#undef UNARY
+	#undef SWITCH_CASE
+}
+
+void Interpreter::run(std::size_t tapeSize, Dispatch dispatch) {
+	if (image.size() > tapeSize) {
+		throw std::runtime_error("interp: the image is larger than the tape");
+	}
+
+	// Pages of the tape the program never touches cost nothing. The page
+	// below it is left inaccessible, since programs must never go there.
+	std::size_t guard = sysconf(_SC_PAGESIZE);
+	void *mapping = mmap(nullptr, guard + tapeSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (mapping == MAP_FAILED) {
+		throw std::system_error(errno, std::generic_category(), "interp: could not map the tape");
+	}
+
+	std::uint8_t *tape = static_cast<std::uint8_t *>(mapping) + guard;
+
+	if (mprotect(tape, tapeSize, PROT_READ | PROT_WRITE) < 0) {
+		int err = errno;
+		munmap(mapping, guard + tapeSize);
+		throw std::system_error(err, std::generic_category(), "interp: could not map the tape");
+	}
+
+	try {
+		if (dispatch == SWITCH) {
+			execute<true>(tape);
+		} else {
+			execute<false>(tape);
+		}
+	} catch (...) {
+		munmap(mapping, guard + tapeSize);
+		throw;
+	}
+
+	munmap(mapping, guard + tapeSize);
+}
+
+std::size_t Interpreter::size() const {
+	return code.size();
+}
+
+std::size_t Interpreter::compiled() const {
+	return loops.size();
+}
+
+
+/**********************
+ * InterpreterBackend *
+ **********************/
+void InterpreterBackend::applyOptions(char option, std::vector<std::string> &values) {
+	if (option != 'f') return;
+
+	for (const std::string &value : values) {
+		if (value.starts_with("tape-size=")) {
+			try {
+				tapeSize = std::stoull(value.substr(10));
+			} catch (std::exception &e) {
+				throw std::invalid_argument("Invalid tape size " + value.substr(10));
+			}
+		}
+	}
+}
+
+std::string InterpreterBackend::helpStr() {
+	return "Interpreter. Runs programs with --run on any machine, without generating\n"
+		"code; otherwise it writes out the IR object.\n"
+		"Options:\n"
+		"  -ftape-size=<bytes>    The size of the tape. Defaults to 1 MiB";
+}
+
+std::string InterpreterBackend::name() {
+	return "interp";
+}
+
+std::string InterpreterBackend::extension() {
+	return ".ir";
+}
+
+bool InterpreterBackend::executable() {
+	return false;
+}
+
+void InterpreterBackend::setVerbosity(bool verbosity) {
+	verbose = verbosity;
+}
+
+std::vector<std::uint8_t> InterpreterBackend::compile(const std::vector<std::uint8_t> &object) {
+	return object;
+}
+
+void InterpreterBackend::run(const std::vector<std::uint8_t> &object) {
+	IR::ObjectView view(object);
+	Interpreter interpreter(view);
+
+	if (verbose) {
+		std::cout << "interp: decoded " << interpreter.size() << " instructions" << std::endl;
+	}
+
+	// The program writes straight to the file descriptor, so anything still
+	// buffered must go first
+	std::cout.flush();
+
+	interpreter.run(tapeSize);
+}
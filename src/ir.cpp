@@ -1,95 +1,322 @@
-#include <array>
-#include <queue>
+#include <algorithm>
+#include <type_traits>
 #include <utility>
-#include <variant>
 
 #include <cstddef>
 #include <cstdint>
 
 #include "ir.hpp"
+#include "object.hpp"
 
 namespace IR {
+	static_assert(std::is_trivially_copyable_v<Instruction>);
+	static_assert(sizeof(Instruction) <= 16);
+
 	/*******************************
 	 * InvalidInstructionException *
 	 *******************************/
 	InvalidInstructionException::InvalidInstructionException(const char *msg) : message(msg) {}
 
-	const char *InvalidInstructionException::what() {
+	const char *InvalidInstructionException::what() const noexcept {
 		return message;
 	}
 
 
+	/***************
+	 * SymbolTable *
+	 ***************/
+	Symbol SymbolTable::intern(const std::string &name) {
+		auto [it, inserted] = ids.try_emplace(name, static_cast<Symbol>(names.size()));
+
+		if (inserted) {
+			names.push_back(&it->first);
+		}
+
+		return it->second;
+	}
+
+	Symbol SymbolTable::anonymous() {
+		names.push_back(nullptr);
+
+		return static_cast<Symbol>(names.size() - 1);
+	}
+
+	const std::string *SymbolTable::name(Symbol sym) const {
+		return names[static_cast<std::size_t>(sym)];
+	}
+
+	std::size_t SymbolTable::size() const {
+		return names.size();
+	}
+
+	void printSymbol(std::ostream &os, const SymbolTable &symbols, Symbol sym) {
+		if (const std::string *name = symbols.name(sym)) {
+			os << *name;
+		} else {
+			os << ".L" << static_cast<std::uint32_t>(sym);
+		}
+	}
+
+
 	/***********
 	 * Program *
 	 ***********/
-	void Program::label(std::string lbl) {
-		symTable[lbl] = instructions.size();
+	SymbolTable &Program::symbols() {
+		return symbolTable;
 	}
 
-	_InstructionPtr Program::operator()(Opcode opcode) {
-		Instruction *instr = new Instruction(opcode);
+	const SymbolTable &Program::symbols() const {
+		return symbolTable;
+	}
+
+	std::size_t Program::size() const {
+		return instructions.size();
+	}
+
+	const Instruction &Program::operator[](std::size_t index) const {
+		return instructions[index];
+	}
+
+	Instruction &Program::operator[](std::size_t index) {
+		return instructions[index];
+	}
+
+	const std::vector<std::pair<std::size_t, Symbol>> &Program::getLabels() const {
+		sortLabels();
+
+		return labels;
+	}
+
+	void Program::sortLabels() const {
+		if (!labelsSorted) {
+			// stable, so labels at the same instruction keep their order
+			std::stable_sort(labels.begin(), labels.end(), [](const auto &a, const auto &b) {
+				return a.first < b.first;
+			});
+
+			labelsSorted = true;
+		}
+	}
+
+	std::size_t Program::target(Symbol sym) const {
+		std::size_t id = static_cast<std::size_t>(sym);
+
+		return id < symbolTargets.size() ? symbolTargets[id] : UNDEFINED;
+	}
+
+	std::vector<std::uint8_t> &Program::image() {
+		return initialImage;
+	}
+
+	const std::vector<std::uint8_t> &Program::image() const {
+		return initialImage;
+	}
+
+	std::string &Program::output() {
+		return initialOutput;
+	}
+
+	const std::string &Program::output() const {
+		return initialOutput;
+	}
+
+	bool Program::isLocal(Symbol sym) const {
+		std::size_t id = static_cast<std::size_t>(sym);
+
+		return id < symbolTargets.size() && symbolTargets[id] != UNDEFINED;
+	}
+
+	void Program::label(Symbol lbl) {
+		std::size_t id = static_cast<std::size_t>(lbl);
+
+		if (id >= symbolTargets.size()) {
+			symbolTargets.resize(id + 1, UNDEFINED);
+		}
+
+		symbolTargets[id] = instructions.size();
+		labels.emplace_back(instructions.size(), lbl);
+	}
+
+	void Program::label(const std::string &lbl) {
+		label(symbolTable.intern(lbl));
+	}
+
+	void Program::label(Symbol lbl, std::size_t index) {
+		std::size_t id = static_cast<std::size_t>(lbl);
+
+		if (id >= symbolTargets.size()) {
+			symbolTargets.resize(id + 1, UNDEFINED);
+		}
+
+		if (!labels.empty() && index < labels.back().first) {
+			labelsSorted = false;
+		}
+
+		symbolTargets[id] = index;
+		labels.emplace_back(index, lbl);
+	}
+
+	void Program::erase(const std::vector<bool> &dead) {
+		sortLabels();
+
+		// Where each instruction ends up. A removed instruction maps to the
+		// next instruction which survives.
+		std::vector<std::size_t> newIndex(instructions.size() + 1);
+		std::size_t out = 0;
+
+		for (std::size_t i=0; i < instructions.size(); ++i) {
+			newIndex[i] = out;
+
+			if (!dead[i]) {
+				instructions[out++] = instructions[i];
+			}
+		}
+
+		newIndex[instructions.size()] = out;
+		instructions.erase(instructions.begin() + out, instructions.end());
+
+		for (auto &[index, symbol] : labels) {
+			index = newIndex[index];
+			symbolTargets[static_cast<std::size_t>(symbol)] = index;
+		}
+
+		// If several positions now start at the same instruction, the last
+		// one is where that instruction came from
+		std::size_t kept = 0;
+		for (auto &[index, offset] : sourceLocations) {
+			index = newIndex[index];
+
+			if (kept > 0 && sourceLocations[kept - 1].first == index) {
+				sourceLocations[kept - 1].second = offset;
+			} else {
+				sourceLocations[kept++] = {index, offset};
+			}
+		}
+		sourceLocations.resize(kept);
+	}
+
+	void Program::removeLabels(const std::vector<bool> &dead) {
+		std::erase_if(labels, [&](const std::pair<std::size_t, Symbol> &label) {
+			std::size_t id = static_cast<std::size_t>(label.second);
+
+			if (id < dead.size() && dead[id]) {
+				symbolTargets[id] = UNDEFINED;
+				return true;
+			}
+
+			return false;
+		});
+	}
+
+	std::size_t Program::pruneLabels() {
+		std::vector<bool> unused(symbolTable.size(), false);
+
+		for (auto &[index, symbol] : labels) {
+			unused[static_cast<std::size_t>(symbol)] = !symbolTable.name(symbol);
+		}
 
-		instructions.push_back(instr);
+		for (const Instruction &instruction : instructions) {
+			if (instruction.hasOp2 && instruction.op2Type == SYMBOL) {
+				unused[static_cast<std::size_t>(instruction.value)] = false;
+			}
+		}
+
+		std::size_t count = std::count(unused.begin(), unused.end(), true);
+		removeLabels(unused);
 
-		return _InstructionPtr(instr);
+		return count;
+	}
+
+	void Program::source(std::uint32_t offset) {
+		if (!sourceLocations.empty() && sourceLocations.back().first == instructions.size()) {
+			// no instructions came from the previous location
+			sourceLocations.back().second = offset;
+		} else {
+			sourceLocations.emplace_back(instructions.size(), offset);
+		}
+	}
+
+	_InstructionPtr Program::operator()(Opcode opcode) {
+		instructions.emplace_back(opcode);
+
+		return _InstructionPtr(this, instructions.size() - 1);
 	}
 
 	_InstructionPtr Program::operator()(Pseudoinstruction pseudo) {
-		Instruction *instr = nullptr;
+		Instruction &instr = instructions.emplace_back(JMP);
 
 		switch (pseudo) {
 			case NOP:
 				// jump with null address and a 'never' condition
-				instr = new Instruction(JMP);
-				instr->cc = NV;
-				instr->op2 = Operand(0);
-				instr->size = BYTE;
+				instr.hasCC = true;
+				instr.cc = NV;
+				instr.hasOp2 = true;
+				instr.op2Type = LITERAL;
+				instr.value = 0;
 				break;
 			case RET:
 				// jmp lr
-				instr = new Instruction(JMP);
-				instr->op2 = Operand(LR);
+				instr.hasOp2 = true;
+				instr.op2Type = REGISTER;
+				instr.op2 = LR;
 				break;
 		}
 
-		return _InstructionPtr(instr);
+		return _InstructionPtr(this, instructions.size() - 1);
 	}
 
 	std::vector<std::uint8_t> Program::assemble() {
-		std::vector<std::uint8_t> prog;
-
-		// during the first assembly pass, all symbols are skipped over, with
-		// null bytes written in their place. the symbol fixup queue is a queue
-		// of all the locations in prog where this was done, with the name of
-		// the local symbol which should be used
-		std::queue<std::pair<std::size_t, std::string>> symbolFixupQueue;
-		// associates locate symbol names with their positions in prog
-		std::map<std::string, std::uint32_t> localSymbols;
-
-		for (Instruction *instruction : instructions) {
-			// Start by checking if a local label points here
-			for (auto &[key, value] : symTable) {
-				if (instructions[value] == instruction) {  // pointer comparison not object comparison
-					// this symbol points to this instruction; record this in the fixup queue
-					localSymbols[key] = prog.size();
-					symTable.erase(key);  // remove from symtable to make future loops faster
-										  // if we dont do this the object will be reusable...
-					break;
-				}
+		sortLabels();
+
+		ObjectBuilder object;
+		std::vector<std::uint8_t> &prog = object.code;
+
+		object.instructions = instructions.size();
+		object.image = initialImage;
+		object.output = initialOutput;
+
+		// the index of each external symbol in the object's symbol table,
+		// indexed by symbol ID
+		constexpr std::uint32_t NOT_ADDED = 0xFFFFFFFF;
+		std::vector<std::uint32_t> externalSymbols(symbolTable.size(), NOT_ADDED);
+
+		// during the first assembly pass, all local symbols are skipped over,
+		// with null bytes written in their place. the symbol fixups are all
+		// the locations in prog where this was done, with the ID of the local
+		// symbol which should be used
+		std::vector<std::pair<std::size_t, Symbol>> symbolFixups;
+		// the position of each local symbol in prog, indexed by symbol ID
+		std::vector<std::uint32_t> localSymbols(symbolTargets.size());
+
+		// the next label which has not been placed yet
+		auto nextLabel = labels.begin();
+		auto nextLocation = sourceLocations.begin();
+
+		for (std::size_t index=0; index < instructions.size(); ++index) {
+			const Instruction &instruction = instructions[index];
+
+			// Start by checking if any local labels point here
+			for (; nextLabel != labels.end() && nextLabel->first == index; ++nextLabel) {
+				localSymbols[static_cast<std::size_t>(nextLabel->second)] = prog.size();
+			}
+
+			if (nextLocation != sourceLocations.end() && nextLocation->first == index) {
+				object.sourceMap.push_back({static_cast<std::uint32_t>(prog.size()), nextLocation->second});
+				++nextLocation;
 			}
 
 			std::uint8_t instructionByte = 0;
 
 			// Populate instruction byte
-			instructionByte |= static_cast<std::uint8_t>(instruction->opcode) << 4;
+			instructionByte |= instruction.opcode << 4;
 
-			if (instruction->op1) {
+			if (instruction.hasOp1) {
 				// has op1
-				switch (instruction->op1->type) {
-					case Operand::REGISTER:
+				switch (instruction.op1Type) {
+					case REGISTER:
 						// bit 3 is already 0
 						break;
-					case Operand::INDIRECT:
+					case INDIRECT:
 						instructionByte |= (1 << 3);
 						break;
 					default:
@@ -98,22 +325,17 @@ namespace IR {
 				}
 			}
 
-			if (instruction->op2) {
-				// has op2
-				switch (instruction->op2->type) {
-					case Operand::REGISTER:
-						// bit[2:1] are already 0
-						break;
-					case Operand::INDIRECT:
-						instructionByte |= (0b01 << 1);
-						break;
-					case Operand::SYMBOL:
-						instructionByte |= (0b10 << 1);
-						break;
-					case Operand::LITERAL:
-						instructionByte |= (0b11 << 1);
-						break;
-				}
+			if (instruction.hasOp2) {
+				// has op2; the operand type is encoded directly in bits[2:1]
+				instructionByte |= instruction.op2Type << 1;
+			}
+
+			// Register indirects may be displaced. The displacement is shared
+			// by both operands, and its presence is flagged by bit 0.
+			bool displaced = instruction.displacement != 0;
+
+			if (displaced) {
+				instructionByte |= 1;
 			}
 
 			prog.push_back(instructionByte);
@@ -127,12 +349,12 @@ namespace IR {
 			/*
 			 * Makes enough room in scratch to fit n bits
 			 */
-			auto scratch_make_room = [&prog, &scratch, &scratch_pos](std::size_t n) {
+			auto scratch_make_room = [&prog, &scratch, &scratch_pos](int n) {
 				if (scratch_pos - n < 0) {
 					// Not enough room
 					prog.push_back(scratch);
 					scratch = 0;
-					scratch_pos = 8;
+					scratch_pos = 8 - n;
 				} else {
 					scratch_pos -= n;
 				}
@@ -149,34 +371,34 @@ namespace IR {
 				}
 			};
 
-			if (instruction->opcode == JMP) {
+			if (instruction.opcode == JMP) {
 				// Special case; need to encode condition code first
 				// cc always immediately follows JMP so no need to worry about
 				// values in scratch
 				scratch_pos -= 4;
-				if (instruction->cc) {
-					scratch |= static_cast<std::uint8_t>(*instruction->cc) << scratch_pos;
+				if (instruction.hasCC) {
+					scratch |= instruction.cc << scratch_pos;
 				} else {
 					// if no cc was specified then default to AL
 					scratch |= AL << scratch_pos;
 				}
 			}
 
-			if (instruction->useOpSize) {
+			if (instruction.useOpSize()) {
 				// Operand size specifier
 				// operand size is not valid with jump instruction, so no room
 				// checking necessary
 				scratch_pos -= 2;
-				if (instruction->size) {
-					opSize = *instruction->size;
+				if (instruction.hasSize) {
+					opSize = static_cast<OperandSize>(instruction.size);
 				}
 
-				scratch |= static_cast<std::uint8_t>(opSize) << scratch_pos;
+				scratch |= opSize << scratch_pos;
 			}
 
 			// Now we add the rest of the operands
 
-			if (instruction->op1) {
+			if (instruction.hasOp1) {
 				// Op1. This can only be a register/register indirect so it is
 				// always 3 bits.
 				// No type checking needed since that was already done when
@@ -184,92 +406,186 @@ namespace IR {
 				// No need to make room since at this point there always will
 				// be at least 4 bits left
 				scratch_pos -= 3;
-				scratch |= (static_cast<std::uint8_t>(std::get<Register>(instruction->op1->value)) << scratch_pos);
+				scratch |= instruction.op1 << scratch_pos;
+			}
+
+			if (instruction.hasOp2 && (instruction.op2Type == REGISTER || instruction.op2Type == INDIRECT)) {
+				scratch_make_room(3);  // Make room for 3 bits
+				scratch |= instruction.op2 << scratch_pos;
 			}
 
-			if (instruction->op2) {
-				// Op2
+			scratch_flush();
 
-				switch (instruction->op2->type) {
-					case Operand::REGISTER:
-					case Operand::INDIRECT:
-						scratch_make_room(3);  // Make room for 3 bits
-						scratch |= (static_cast<std::uint8_t>(std::get<Register>(instruction->op2->value)) << scratch_pos);
+			if (displaced) {
+				// The displacement follows the registers as a signed 32-bit
+				// little endian integer
+				for (std::size_t i=0; i < sizeof(std::int32_t); ++i) {
+					prog.push_back(static_cast<std::uint32_t>(instruction.displacement) >> (8 * i));
+				}
+			}
+
+			if (instruction.hasOp2) {
+				// Op2 data
+
+				switch (instruction.op2Type) {
+					case REGISTER:
+					case INDIRECT:
+						// already encoded
 						break;
-					case Operand::SYMBOL:
-						// TODO: figure out how to determine which byte in prog a label refers to
+					case SYMBOL:
 						{
-							scratch_flush();
+							Symbol symbol = static_cast<Symbol>(instruction.value);
 
-							std::string symbol = std::get<std::string>(instruction->op2->value);
-							if (symTable.contains(symbol)) {
+							if (isLocal(symbol)) {
 								// Local label; will fixup later
-								symbolFixupQueue.push(std::make_pair(prog.size(), symbol));
+								symbolFixups.emplace_back(prog.size(), symbol);
 								prog.insert(prog.end(), {0, 0, 0, 0});
-							} else {
-								// External symbol; put the name for the linker
-								for (const char &ch : symbol) {
-									prog.push_back(ch);
+							} else if (const std::string *name = symbolTable.name(symbol)) {
+								// External symbol; refer to the symbol table and
+								// leave a relocation for the linker
+								std::uint32_t &external = externalSymbols[static_cast<std::size_t>(symbol)];
+
+								if (external == NOT_ADDED) {
+									external = object.addSymbol(*name, ObjectSymbol::EXTERNAL, 0);
+								}
+
+								object.relocations.push_back({static_cast<std::uint32_t>(prog.size()), external});
+
+								for (std::size_t i=0; i < sizeof(std::uint32_t); ++i) {
+									prog.push_back((EXTERNAL_SYMBOL | external) >> (8 * i));
 								}
+							} else {
+								throw InvalidInstructionException("Anonymous symbol used but never defined");
 							}
 							break;
 						}
-					case Operand::LITERAL:
-						// we can encode the value immediately rather than using a literal pool
-						scratch_flush();
-
-						// treat the address of the literal as the beginning of
-						// an array, so that we can access each byte
-						// individually
-						std::uintmax_t value = std::get<std::uintmax_t>(instruction->op2->value);
-						std::uint8_t *bytes = (uint8_t *)&value;
-
-						for (std::size_t i=0; i < (1U << static_cast<unsigned int>(opSize)); ++i) {
-							prog.push_back(bytes[i]);
+					case LITERAL:
+						// we can encode the value immediately rather than using
+						// a literal pool
+						for (std::size_t i=0; i < (1U << opSize); ++i) {
+							prog.push_back(instruction.value >> (8 * i));
 						}
-
 						break;
 				}
 			}
+		}
 
-
-			if (scratch_pos != 8) {
-				prog.push_back(scratch);
-			}
+		// labels at the very end of the program
+		for (; nextLabel != labels.end(); ++nextLabel) {
+			localSymbols[static_cast<std::size_t>(nextLabel->second)] = prog.size();
 		}
 
 		// fixup local symbols
-		while (!symbolFixupQueue.empty()) {
-			auto fixup = symbolFixupQueue.front();
-			std::uint8_t *bytes = (std::uint8_t *)&localSymbols[fixup.second];
-
+		for (auto &[position, symbol] : symbolFixups) {
 			for (std::size_t i=0; i < sizeof(std::uint32_t); ++i) {
-				prog[fixup.first + i] = bytes[i];
+				prog[position + i] = localSymbols[static_cast<std::size_t>(symbol)] >> (8 * i);
 			}
+		}
+
+		// export named labels
+		for (auto &[index, symbol] : labels) {
+			if (const std::string *name = symbolTable.name(symbol)) {
+				std::uint32_t address = localSymbols[static_cast<std::size_t>(symbol)];
 
-			symbolFixupQueue.pop();
+				object.addSymbol(*name, ObjectSymbol::DEFINED, address);
+
+				if (*name == "main") {
+					object.entry = address;
+				}
+			}
 		}
 
-		return prog;
+		return object.build();
 	}
 
-	Program::~Program() {
-		for (Instruction *instruction : instructions) {
-			delete instruction;
+	void Program::print(std::ostream &os, const Instruction &instruction) const {
+		static const char *const mnemonics[] = {
+			"jmp", "add", "sub", "mul", "div", "cmp", "tst", "and",
+			"or", "xor", "cpl", "lsl", "lsr", "asr", "mov", "call"
+		};
+
+		static const char *const sizes[] = {"byte", "hword", "word", "dword"};
+
+		static const char *const conditions[] = {
+			"nv", "ne", "cc", "pl", "vc", "ls", "lt", "le",  // nv shouldnt be allowed
+			"al", "eq", "cs", "mi", "vs", "hi", "ge", "gt"
+		};
+
+		os << mnemonics[instruction.opcode] << ' ';
+
+		if (instruction.hasSize) {
+			os << sizes[instruction.size] << ' ';
+		}
+
+		if (instruction.hasCC) {
+			os << conditions[instruction.cc] << ',';
+		}
+
+		// op1 is always a register or register indirect
+		if (instruction.hasOp1) {
+			if (instruction.op1Type == INDIRECT) os << '[';
+
+			os << 'r' << static_cast<int>(instruction.op1);
+
+			if (instruction.op1Type == INDIRECT) {
+				if (instruction.displacement > 0) {
+					os << '+' << instruction.displacement;
+				} else if (instruction.displacement < 0) {
+					os << instruction.displacement;
+				}
+
+				os << ']';
+			}
+		}
+
+		if (instruction.hasOp1 && instruction.hasOp2) os << ',';  // add comma between operands
+
+		if (instruction.hasOp2) {
+			switch (instruction.op2Type) {
+				case REGISTER:
+					os << 'r' << static_cast<int>(instruction.op2);
+					break;
+				case INDIRECT:
+					os << "[r" << static_cast<int>(instruction.op2);
+
+					if (instruction.displacement > 0) {
+						os << '+' << instruction.displacement;
+					} else if (instruction.displacement < 0) {
+						os << instruction.displacement;
+					}
+
+					os << ']';
+					break;
+				case SYMBOL:
+					printSymbol(os, symbolTable, static_cast<Symbol>(instruction.value));
+					break;
+				case LITERAL:
+					os << instruction.value;
+					break;
+			}
 		}
 	}
 
 	std::ostream &operator<<(std::ostream &os, Program &prog) {
-		for (IR::Instruction *instruction : prog.instructions) {
-			for (auto &[key, value] : prog.symTable) {
-				if (prog.instructions[value] == instruction) {  // pointer comparison not object comparison
-					// this symbol points to this instruction
-					os << key << ':' << std::endl;
-					break;
-				}
+		prog.sortLabels();
+
+		auto nextLabel = prog.labels.begin();
+
+		for (std::size_t index=0; index < prog.instructions.size(); ++index) {
+			for (; nextLabel != prog.labels.end() && nextLabel->first == index; ++nextLabel) {
+				// this symbol points to this instruction
+				printSymbol(os, prog.symbolTable, nextLabel->second);
+				os << ':' << std::endl;
 			}
 
-			os << '\t' << *instruction << std::endl;
+			os << '\t';
+			prog.print(os, prog.instructions[index]);
+			os << std::endl;
+		}
+
+		for (; nextLabel != prog.labels.end(); ++nextLabel) {
+			printSymbol(os, prog.symbolTable, nextLabel->second);
+			os << ':' << std::endl;
 		}
 
 		return os;
@@ -279,11 +595,45 @@ namespace IR {
 	/*******************
 	 * _InstructionPtr *
 	 *******************/
-	_InstructionPtr::_InstructionPtr(Instruction *i) : ptr(i) {}
+	_InstructionPtr::_InstructionPtr(Program *prog, std::size_t i) : prog(prog), index(i) {}
+
+	Instruction &_InstructionPtr::instruction() {
+		return prog->instructions[index];
+	}
+
+	void _InstructionPtr::addRegister(OperandType type, Register reg, std::int32_t disp, const char *error) {
+		Instruction &instr = instruction();
+
+		if (instr.useOp1() && !instr.hasOp1) {
+			instr.hasOp1 = true;
+			instr.op1Type = type;
+			instr.op1 = reg;
+		} else if (instr.useOp2() && !instr.hasOp2) {
+			instr.hasOp2 = true;
+			instr.op2Type = type;
+			instr.op2 = reg;
+		} else {
+			throw InvalidInstructionException(error);
+		}
+
+		if (type == INDIRECT) {
+			bool otherIndirect = instr.hasOp1 && instr.hasOp2
+				&& instr.op1Type == INDIRECT && instr.op2Type == INDIRECT;
+
+			if (otherIndirect && instr.displacement != disp) {
+				throw InvalidInstructionException("Register indirects must share the same displacement");
+			}
+
+			instr.displacement = disp;
+		}
+	}
 
 	_InstructionPtr &_InstructionPtr::operator()(OperandSize size) {
-		if (ptr->useOpSize && !ptr->size) {
-			ptr->size = size;
+		Instruction &instr = instruction();
+
+		if (instr.useOpSize() && !instr.hasSize) {
+			instr.hasSize = true;
+			instr.size = size;
 		} else {
 			throw InvalidInstructionException("Cannot use operand size specifier here");
 		}
@@ -293,38 +643,33 @@ namespace IR {
 
 	// Add register
 	_InstructionPtr &_InstructionPtr::operator()(Register reg) {
-		if (ptr->useOp1 && !ptr->op1) {
-			ptr->op1 = reg;
-		} else if (ptr->useOp2 && !ptr->op2) {
-			ptr->op2 = reg;
-		} else {
-			throw InvalidInstructionException("Cannot use register parameter here");
-		}
+		addRegister(REGISTER, reg, 0, "Cannot use register parameter here");
 
 		return *this;
 	}
 
 	// Add [register]
 	_InstructionPtr &_InstructionPtr::operator[](Register reg) {
-		Operand operand;
-		operand.type = Operand::INDIRECT;
-		operand.value = reg;
-
-		if (ptr->useOp1 && !ptr->op1) {
-			ptr->op1 = operand;
-		} else if (ptr->useOp2 && !ptr->op2) {
-			ptr->op2 = operand;
-		} else {
-			throw InvalidInstructionException("Cannot use register indirect parameter here");
-		}
+		addRegister(INDIRECT, reg, 0, "Cannot use register indirect parameter here");
+
+		return *this;
+	}
+
+	// Add [register+displacement]
+	_InstructionPtr &_InstructionPtr::operator[](DisplacedRegister reg) {
+		addRegister(INDIRECT, reg.reg, reg.disp, "Cannot use register indirect parameter here");
 
 		return *this;
 	}
 
 	// Add symbol
-	_InstructionPtr &_InstructionPtr::operator()(std::string sym) {
-		if (ptr->useOp2 && !ptr->op2) {
-			ptr->op2 = sym;
+	_InstructionPtr &_InstructionPtr::operator()(Symbol sym) {
+		Instruction &instr = instruction();
+
+		if (instr.useOp2() && !instr.hasOp2) {
+			instr.hasOp2 = true;
+			instr.op2Type = SYMBOL;
+			instr.value = static_cast<std::uint32_t>(sym);
 		} else {
 			throw InvalidInstructionException("Cannot use symbol parameter here");
 		}
@@ -332,10 +677,18 @@ namespace IR {
 		return *this;
 	}
 
+	_InstructionPtr &_InstructionPtr::operator()(const std::string &sym) {
+		return (*this)(prog->symbolTable.intern(sym));
+	}
+
 	// Add literal
 	_InstructionPtr &_InstructionPtr::operator()(std::uintmax_t lit) {
-		if (ptr->useOp2 && !ptr->op2) {
-			ptr->op2 = lit;
+		Instruction &instr = instruction();
+
+		if (instr.useOp2() && !instr.hasOp2) {
+			instr.hasOp2 = true;
+			instr.op2Type = LITERAL;
+			instr.value = lit;
 		} else {
 			throw InvalidInstructionException("Cannot use PC-relative offset parameter here");
 		}
@@ -344,8 +697,11 @@ namespace IR {
 	}
 
 	_InstructionPtr &_InstructionPtr::operator()(Condition cc) {
-		if (ptr->useCC && !ptr->cc) {
-			ptr->cc = cc;
+		Instruction &instr = instruction();
+
+		if (instr.useCC() && !instr.hasCC) {
+			instr.hasCC = true;
+			instr.cc = cc;
 		} else {
 			throw InvalidInstructionException("Cannot use condition code here");
 		}
@@ -357,207 +713,91 @@ namespace IR {
 	/***************
 	 * Instruction *
 	 ***************/
-	Instruction::Instruction(Opcode opcode) : opcode(opcode) {
-		if (opcode == JMP) {
-			useCC = true;
-			useOp2 = true;
-		} else if (opcode == CPL) {
-			useOpSize = true;
-			useOp1 = true;
-		} else if (opcode == CALL) {
-			useOp2 = true;
-		} else {
-			useOpSize = true;
-			useOp1 = true;
-			useOp2 = true;
-		}
+	Instruction::Instruction(Opcode opcode)
+		: opcode(opcode), size(WORD), hasSize(false), hasCC(false),
+		  cc(AL), op1Type(REGISTER), hasOp1(false), hasOp2(false),
+		  op1(R0), op2(R0), op2Type(REGISTER) {}
+
+	bool Instruction::useOpSize() const {
+		return opcode != JMP && opcode != CALL;
 	}
 
-	std::ostream &operator<<(std::ostream &os, Instruction &instruction) {
-		switch (instruction.opcode) {
-			case JMP:
-				os << "jmp ";
-				break;
-			case SUB:
-				os << "sub ";
-				break;
-			case ADD:
-				os << "add ";
-				break;
-			case MUL:
-				os << "mul ";
-				break;
-			case DIV:
-				os << "div ";
-				break;
-			case CMP:
-				os << "cmp ";
-				break;
-			case TST:
-				os << "tst ";
-				break;
-			case AND:
-				os << "and ";
-				break;
-			case OR:
-				os << "or ";
-				break;
-			case XOR:
-				os << "xor ";
-				break;
-			case CPL:
-				os << "cpl ";
-				break;
-			case LSL:
-				os << "lsl ";
-				break;
-			case LSR:
-				os << "lsr ";
-				break;
-			case ASR:
-				os << "asr ";
-				break;
-			case MOV:
-				os << "mov ";
-				break;
-			case CALL:
-				os << "call ";
-				break;
-		}
+	bool Instruction::useCC() const {
+		return opcode == JMP;
+	}
 
-		if (instruction.size) {
-			switch (*instruction.size) {
-				case BYTE:
-					os << "byte ";
-					break;
-				case HWORD:
-					os << "hword ";
-					break;
-				case WORD:
-					os << "word ";
-					break;
-				case DWORD:
-					os << "dword ";
-					break;
-			}
-		}
+	bool Instruction::useOp1() const {
+		return opcode != JMP && opcode != CALL;
+	}
 
-		if (instruction.cc) {
-			switch (*instruction.cc) {
-				case AL:
-					os << "al,";
-					break;
-				case NV:
-					os << "nv,";  // this shouldnt be allowed
-					break;
-				case EQ:
-					os << "eq,";
-					break;
-				case NE:
-					os << "ne,";
-					break;
-				case CS:
-					os << "cs,";
-					break;
-				case CC:
-					os << "cc,";
-					break;
-				case MI:
-					os << "mi,";
-					break;
-				case PL:
-					os << "pl,";
-					break;
-				case VS:
-					os << "vs,";
-					break;
-				case VC:
-					os << "vc,";
-					break;
-				case HI:
-					os << "hi,";
-					break;
-				case LS:
-					os << "ls,";
-					break;
-				case GE:
-					os << "ge,";
-					break;
-				case LT:
-					os << "lt,";
-					break;
-				case GT:
-					os << "gt,";
-					break;
-				case LE:
-					os << "le,";
-					break;
-			}
-		}
+	bool Instruction::useOp2() const {
+		return opcode != CPL;
+	}
 
-		std::optional<Operand> const *operands[2] = {&instruction.op1, &instruction.op2};
+	Opcode Instruction::getOpcode() const {
+		return static_cast<Opcode>(opcode);
+	}
 
-		for (int i=0; i < 2; ++i) {
-			if (i > 0 && *operands[i] && *operands[i-1]) os << ',';  // add comma between operands
+	OperandSize Instruction::getSize() const {
+		// size is initialised to WORD
+		return static_cast<OperandSize>(size);
+	}
 
-			if (*operands[i]) {
-				if ((*operands[i])->type == Operand::REGISTER
-					 || (*operands[i])->type == Operand::INDIRECT) {
+	Condition Instruction::getCondition() const {
+		// cc is initialised to AL
+		return static_cast<Condition>(cc);
+	}
 
-					if ((*operands[i])->type == Operand::INDIRECT) {
-						os << '[';
-					}
+	bool Instruction::hasOperand1() const {
+		return hasOp1;
+	}
 
-					switch (std::get<Register>((*operands[i])->value)) {
-						case R0:
-							os << "r0";
-							break;
-						case R1:
-							os << "r1";
-							break;
-						case R2:
-							os << "r2";
-							break;
-						case R3:
-							os << "r3";
-							break;
-						case R4:
-							os << "r4";
-							break;
-						case R5:
-							os << "r5";
-							break;
-						case R6:
-							os << "r6";
-							break;
-						case R7:
-							os << "r7";
-							break;
-					}
+	OperandType Instruction::getOp1Type() const {
+		return static_cast<OperandType>(op1Type);
+	}
 
-					if ((*operands[i])->type == Operand::INDIRECT) {
-						os << ']';
-					}
-				} else if ((*operands[i])->type == Operand::SYMBOL) {
-					os << std::get<std::string>((*operands[i])->value);
-				} else if ((*operands[i])->type == Operand::LITERAL) {
-					os << std::get<std::uintmax_t>((*operands[i])->value);
-				}
-			}
-		}
+	Register Instruction::getOp1() const {
+		return static_cast<Register>(op1);
+	}
 
-		return os;
+	bool Instruction::hasOperand2() const {
+		return hasOp2;
 	}
 
-	/***********
-	 * Operand *
-	 ***********/
-	Operand::Operand() {}
+	OperandType Instruction::getOp2Type() const {
+		return static_cast<OperandType>(op2Type);
+	}
+
+	Register Instruction::getOp2() const {
+		return static_cast<Register>(op2);
+	}
 
-	Operand::Operand(Register reg) : type(REGISTER), value(reg) {}
+	std::uint64_t Instruction::getLiteral() const {
+		return value;
+	}
 
-	Operand::Operand(std::string sym) : type(SYMBOL), value(sym) {}
+	Symbol Instruction::getSymbol() const {
+		return static_cast<Symbol>(value);
+	}
 
-	Operand::Operand(std::uintmax_t lit) : type(LITERAL), value(lit) {}
-}
+	std::int32_t Instruction::getDisplacement() const {
+		return displacement;
+	}
 
+	void Instruction::setOpcode(Opcode opcode) {
+		this->opcode = opcode;
+	}
+
+	void Instruction::setCondition(Condition cc) {
+		hasCC = true;
+		this->cc = cc;
+	}
+
+	void Instruction::setLiteral(std::uint64_t literal) {
+		value = literal;
+	}
+
+	void Instruction::setSymbol(Symbol sym) {
+		value = static_cast<std::uint32_t>(sym);
+	}
+}
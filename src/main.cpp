@@ -1,17 +1,29 @@
+#include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <boost/program_options.hpp>
 
+#include "common.h"
 #include "ir.hpp"
 #include "pipeline.hpp"
 #include "frontend.hpp"
 #include "backend.hpp"
+#include "cache.hpp"
+#include "mappedfile.hpp"
+#include "outlets.hpp"
+#include "passes.hpp"
+#include "threadpool.hpp"
 
 namespace po = boost::program_options;
 
@@ -48,6 +60,12 @@ IFrontend *selectFrontend(std::string code, bool isExt) {
  * or nullptr if one could not be selected.
  */
 IBackend *selectBackend(std::string arch) {
+	if (arch == "x86_64" || arch == "x86-64" || arch == "amd64") {
+		return new X86_64Backend();
+	} else if (arch == "interp" || arch == "interpreter") {
+		return new InterpreterBackend();
+	}
+
 	return nullptr;
 }
 
@@ -58,22 +76,30 @@ int main(int argc, char **argv) {
 	po::options_description generalOpts("General Options");
 	generalOpts.add_options()
 		("arch", po::value<std::string>(), "The target architecture to generate code for.")
+		("cache-dir", po::value<std::string>(), "Cache compiled output in the specified directory, and reuse it when nothing has changed")
+		("cache-size", po::value<std::uintmax_t>()->default_value(1024), "The size in MiB to shrink the cache to after compiling")
 		(",f", po::value<std::vector<std::string>>(), "Set flags. Prefix a flag with no- to disable it")
 		("help,h", "Show this help message. Combine with -x or --arch to see help for a specific frontend or backend")
-		("output,o", po::value<std::string>(), "Place primary output in the specified file")
+		("jobs,j", po::value<unsigned>(), "Compile up to this many inputs at once. Defaults to the number of hardware threads")
+		("manifest", po::value<std::string>(), "Also compile every input listed in the specified file, one per line")
+		(",O", po::value<std::string>()->implicit_value("1"), "Set the optimisation level, from 0 (the default) to 3 (currently the same as 2)")
+		("output,o", po::value<std::string>(), "Place primary output in the specified file. With several inputs, this is a directory to place every output in")
+		("run", "Run the program in process instead of writing it out. Takes a single input")
 		(",S", "Stop after the first stage of compilation, and output IR")
+		("stats-json", po::value<std::string>(), "Write statistics about each stage of compilation to the specified file as JSON")
+		("time-passes", "Print statistics about each stage of compilation")
 		("verbose,v", "Show verbose output")
 		("version", "Print version string")
 		(",W", po::value<std::vector<std::string>>(), "Enable or disable warnings.")
-		(",x", po::value<std::string>(), "Select the language")
+		(",x", po::value<std::string>(), "Select the language. ir reads an IR object written with -S")
 		;
 
 	po::positional_options_description positional;
-	positional.add("input", 1);
+	positional.add("input", -1);
 
 	po::options_description hidden("Hidden Options");
 	hidden.add_options()
-		("input", po::value<std::string>(), "input file")
+		("input", po::value<std::vector<std::string>>(), "input files")
 		;
 
 	po::options_description options;
@@ -88,8 +114,8 @@ int main(int argc, char **argv) {
 
 	// Check peripheral options (options that do not trigger the main function of the program)
 	if (vm.count("help")) {
-		if (vm.count("x")) {
-			std::string language = vm["x"].as<std::string>();
+		if (vm.count("-x")) {
+			std::string language = vm["-x"].as<std::string>();
 			IFrontend *frontend = selectFrontend(language, false);
 
 			if (frontend) {
@@ -118,93 +144,439 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
+	// Collect inputs from the command line and the manifest
+	std::vector<std::string> inputs;
+	if (vm.count("input")) {
+		inputs = vm["input"].as<std::vector<std::string>>();
+	}
+
+	if (vm.count("manifest")) {
+		std::string manifestFile = vm["manifest"].as<std::string>();
+		std::ifstream manifest(manifestFile);
+
+		if (!manifest) {
+			std::cerr << "Could not read " << manifestFile << std::endl;
+			return 1;
+		}
+
+		// One path per line; blank lines and lines starting with # are skipped
+		std::string line;
+		while (std::getline(manifest, line)) {
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+
+			if (!line.empty() && line.front() != '#') {
+				inputs.push_back(line);
+			}
+		}
+	}
+
 	// Check options are okay
-	if (!vm.count("input")) {
+	if (inputs.empty()) {
 		std::cerr << "An input file must be specified. Run '" << argv[0] << " --help' for usage." << std::endl;
 		return 1;
 	}
 
+	bool run = vm.count("run");
+
+	if (run && inputs.size() > 1) {
+		std::cerr << "--run takes a single input" << std::endl;
+		return 1;
+	} else if (run && vm.count("-S")) {
+		std::cerr << "--run cannot be combined with -S" << std::endl;
+		return 1;
+	}
+
 	// Options are okay
 
-	std::string srcFile = vm["input"].as<std::string>();
-	IFrontend *frontend;
-	IBackend *backend;
+	bool batch = inputs.size() > 1;
 
-	// Select front end
-	if (!vm.count("x")) {
-		// Try to infer language from file extension
-		std::size_t extIndex = srcFile.find_last_of('.');
-		std::string fileExt = srcFile.substr(extIndex+1);
+	std::filesystem::path outputDir;
+	if (batch && vm.count("output")) {
+		outputDir = vm["output"].as<std::string>();
 
-		frontend = selectFrontend(fileExt, true);
+		std::error_code ec;
+		std::filesystem::create_directories(outputDir, ec);
 
-		if (!frontend) {
-			std::cerr << "Could not infer language from file extension ." << fileExt << std::endl;
+		if (ec) {
+			std::cerr << "Could not create " << outputDir.string() << ": " << ec.message() << std::endl;
 			return 1;
 		}
-	} else {
-		// due to limitations of boost::program_options, this does not work
-		std::string language = vm["x"].as<std::string>();
-		frontend = selectFrontend(language, false);
+	}
+
+	std::unique_ptr<Cache> cache;
+	if (vm.count("cache-dir")) {
+		std::string cacheDir = vm["cache-dir"].as<std::string>();
 
-		if (!frontend) {
-			std::cerr << "Unknown language " << language << std::endl;
+		try {
+			cache = std::make_unique<Cache>(cacheDir, vm["cache-size"].as<std::uintmax_t>() * 1024 * 1024);
+		} catch (std::filesystem::filesystem_error &e) {
+			std::cerr << "Could not create cache " << cacheDir << ": " << e.code().message() << std::endl;
 			return 1;
 		}
 	}
 
-	// Select back end
-	if (!vm.count("arch")) {
-		// Target same architecture as this device
-	} else {
+	// The optimisation passes to run, from -O or -fpasses=
+	std::vector<std::string> passes;
+	{
+		unsigned level = 0;
+
+		if (vm.count("-O")) {
+			std::string levelStr = vm["-O"].as<std::string>();
 
+			if (levelStr.size() != 1 || levelStr[0] < '0' || levelStr[0] > '3') {
+				std::cerr << "Unknown optimisation level -O" << levelStr << std::endl;
+				return 1;
+			}
+
+			level = levelStr[0] - '0';
+		}
+
+		passes = PassManager::level(level);
+
+		// An explicit list of passes overrides the level
+		if (vm.count("-f")) {
+			for (const std::string &flag : vm["-f"].as<std::vector<std::string>>()) {
+				if (flag.starts_with("passes=")) {
+					passes.clear();
+
+					std::stringstream list(flag.substr(7));
+					std::string pass;
+					while (std::getline(list, pass, ',')) {
+						if (!pass.empty()) passes.push_back(pass);
+					}
+				}
+			}
+		}
+
+		// Check every pass exists before starting any jobs
+		try {
+			PassPipe check(passes);
+		} catch (std::out_of_range &e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
 	}
 
-	// Apply options to frontend and backend
-	/*{
-		std::vector<std::string> flags = vm["f"].as<std::vector<std::string>>();
-		std::vector<std::string> warnings = vm["W"].as<std::vector<std::string>>();
+	// Select back end. Without -S, code is generated for --arch, or for this
+	// machine if there is a backend for it. Otherwise the output is IR.
+	std::string arch;
+	if (!vm.count("-S")) {
+		if (vm.count("arch")) {
+			arch = vm["arch"].as<std::string>();
+		} else {
+#ifdef ARCHITECTURE
+			arch = ARCHITECTURE;
+#endif
+		}
+
+		IBackend *backend = arch.empty() ? nullptr : selectBackend(arch);
+
+		if (!backend && vm.count("arch")) {
+			std::cerr << "No backend found for architecture " << arch << std::endl;
+			return 1;
+		} else if (!backend && run) {
+			// Anything can be interpreted
+			arch = "interp";
+		} else if (!backend) {
+			arch.clear();
+		}
+
+		delete backend;
+	}
+
+	std::ofstream statsJSON;
+	if (vm.count("stats-json")) {
+		statsJSON.open(vm["stats-json"].as<std::string>(), std::ios::out | std::ios::trunc);
+
+		if (!statsJSON.is_open()) {
+			std::cerr << "Could not write " << vm["stats-json"].as<std::string>() << std::endl;
+			return 1;
+		}
+	}
+
+	/*
+	 * Work out where the output for an input goes when -o doesn't name it
+	 *
+	 * srcFile		The input
+	 * extension	The extension of the output, including the dot
+	 */
+	auto destination = [&](const std::string &srcFile, const std::string &extension) -> std::string {
+		// Replace the extension of the input file
+		std::filesystem::path dst = std::filesystem::path(srcFile).replace_extension(extension);
+
+		if (!outputDir.empty()) {
+			dst = outputDir / dst.filename();
+		}
+
+		// Executables have no extension, so one built from a source
+		// without an extension would overwrite it
+		if (dst == std::filesystem::path(srcFile)) {
+			dst += ".out";
+		}
+
+		return dst.string();
+	};
+
+	// Two inputs with the same destination would race to write it, and one
+	// of the outputs would be lost, so refuse to start
+	if (batch) {
+		std::string extension = ".ir";
+
+		if (!arch.empty()) {
+			IBackend *backend = selectBackend(arch);
+
+			// Options can change what the backend produces. Bad options are
+			// reported by each job.
+			try {
+				if (vm.count("-f")) {
+					std::vector<std::string> flags = vm["-f"].as<std::vector<std::string>>();
+					backend->applyOptions('f', flags);
+				}
+			} catch (std::invalid_argument &e) {}
+
+			extension = backend->extension();
+			delete backend;
+		}
+
+		std::map<std::filesystem::path, std::string> destinations;
 
-		frontend->applyOptions('f', flags);
-		frontend->applyOptions('W', warnings);
+		for (const std::string &input : inputs) {
+			std::filesystem::path dst = std::filesystem::weakly_canonical(destination(input, extension));
+			auto [it, added] = destinations.emplace(dst, input);
 
-		backend->applyOptions('f', flags);
-		backend->applyOptions('W', warnings);
+			if (!added) {
+				std::cerr << it->second << " and " << input << " would both be written to " << dst.string()
+					<< std::endl;
+				return 1;
+			}
+		}
 	}
 
-	if (vm.count("verbose")) {
-		frontend->setVerbosity(true);
-		backend->setVerbosity(true);
-	}*/
+	// Serializes messages and statistics from different jobs
+	std::mutex outputMutex;
 
 	/*
-	 * Now its time to compile
+	 * Compile a single input. Called from the worker threads, so each call
+	 * gets its own frontend and pipeline.
 	 *
-	 * 1. call the parser
-	 * 2. optimize the IR
-	 * 3. call the code generator
+	 * srcFile	The input to compile
+	 * Returns the exit status for this input.
 	 */
+	auto compile = [&](const std::string &srcFile) -> int {
+		// Messages are prefixed with the input they are about when there are
+		// several
+		std::string prefix = batch ? srcFile + ": " : "";
+
+		auto report = [&](const std::string &message) {
+			std::lock_guard<std::mutex> lock(outputMutex);
+			std::cerr << prefix << message << std::endl;
+		};
+
+		// IR objects have already been through a frontend, so they are
+		// injected as they are
+		IFrontend *frontend = nullptr;
+		bool object = false;
+
+		// Select front end
+		if (!vm.count("-x")) {
+			// Try to infer language from file extension
+			std::size_t extIndex = srcFile.find_last_of('.');
+			std::string fileExt = srcFile.substr(extIndex+1);
+
+			object = fileExt == "ir";
+			frontend = object ? nullptr : selectFrontend(fileExt, true);
+
+			if (!object && !frontend) {
+				report("Could not infer language from file extension ." + fileExt);
+				return 1;
+			}
+		} else {
+			std::string language = vm["-x"].as<std::string>();
+
+			object = language == "ir";
+			frontend = object ? nullptr : selectFrontend(language, false);
+
+			if (!object && !frontend) {
+				report("Unknown language " + language);
+				return 1;
+			}
+		}
+
+		// With no backend, the IR object is the output
+		IBackend *backend = arch.empty() ? nullptr : selectBackend(arch);
+
+		// Apply options to frontend and backend
+		// short-only options are stored under their dashed name
+		try {
+			if (vm.count("-f")) {
+				std::vector<std::string> flags = vm["-f"].as<std::vector<std::string>>();
+
+				if (frontend) frontend->applyOptions('f', flags);
+				if (backend) backend->applyOptions('f', flags);
+			}
+
+			if (vm.count("-W")) {
+				std::vector<std::string> warnings = vm["-W"].as<std::vector<std::string>>();
+
+				if (frontend) frontend->applyOptions('W', warnings);
+				if (backend) backend->applyOptions('W', warnings);
+			}
+		} catch (std::invalid_argument &e) {
+			report(e.what());
+			delete frontend;
+			delete backend;
+			return 1;
+		}
+
+		if (vm.count("verbose")) {
+			if (frontend) frontend->setVerbosity(true);
+			if (backend) backend->setVerbosity(true);
+		}
+
+		// Running a program writes nothing out, so it needs no name
+		std::string dstFile;
+		if (!batch && vm.count("output")) {
+			dstFile = vm["output"].as<std::string>();
+		} else if (!run) {
+			dstFile = destination(srcFile, backend ? backend->extension() : ".ir");
+		}
+
+		// Check the cache before doing any work. If the source can't be read,
+		// carry on without the cache and let the frontend report it. Pipes
+		// can only be read once, so they are never cached.
+		std::string cacheKey;
+		if (cache && !run && std::filesystem::is_regular_file(srcFile)) {
+			try {
+				MappedFile source(srcFile);
+
+				// Everything besides the source that affects the output
+				std::vector<std::string> components = {"frontend=" + (frontend ? frontend->name() : "ir"),
+					backend ? "backend=" + backend->name() : "outlet=ir"};
+				if (vm.count("-f")) {
+					for (const std::string &flag : vm["-f"].as<std::vector<std::string>>()) {
+						components.push_back("-f" + flag);
+					}
+				}
+				for (const std::string &pass : passes) {
+					components.push_back("pass=" + pass);
+				}
+
+				cacheKey = Cache::key(source.data(), source.size(), components);
+			} catch (std::system_error &e) {}
+
+			if (!cacheKey.empty() && cache->fetch(cacheKey, dstFile)) {
+				delete frontend;
+				delete backend;
+				return 0;
+			}
+		}
+
+		/*
+		 * Now its time to compile
+		 *
+		 * 1. call the parser
+		 * 2. optimize the IR
+		 * 3. call the code generator
+		 */
+
+		// The pipeline owns the frontend and backend from here on
+		std::string outletName = backend ? backend->name() : "ir";
+		IOutlet *outlet;
+
+		if (run) {
+			outlet = new RunOutlet(backend);
+		} else if (backend) {
+			outlet = new BackendOutlet(backend);
+		} else {
+			outlet = OutletFactory::getInstance().get("ir");
+		}
 
-	std::vector<std::uint8_t> ir;
-	try {
-		ir = frontend->parse(srcFile);
-	} catch (IR::InvalidInstructionException &e) {
-		std::cerr << e.what() << std::endl;
-		return -1;
+		IInlet *inlet = object ? InletFactory::getInstance().get("ir") : new FrontendInlet(frontend);
+
+		Pipeline pipeline(inlet, outlet, object ? "ir" : "frontend", outletName);
+		int status = 0;
+
+		if (!passes.empty()) {
+			pipeline.addPipe(new PassPipe(passes, vm.count("verbose")), "passes");
+		}
+
+		try {
+			pipeline.flow(srcFile, dstFile);
+
+			if (!cacheKey.empty()) {
+				cache->store(cacheKey, dstFile);
+			}
+		} catch (IR::InvalidInstructionException &e) {
+			report(e.what());
+			status = -1;
+		} catch (std::exception &e) {
+			report(e.what());
+			status = 1;
+		}
+
+		std::lock_guard<std::mutex> lock(outputMutex);
+
+		if (vm.count("time-passes")) {
+			pipeline.stats().print(std::cerr);
+		}
+
+		// With several inputs, this writes one JSON object per line
+		if (statsJSON.is_open()) {
+			pipeline.stats().printJSON(statsJSON);
+		}
+
+		return status;
+	};
+
+	auto startTime = std::chrono::steady_clock::now();
+	int status = 0;
+	std::size_t failed = 0;
+
+	if (!batch) {
+		// Not worth starting a pool for
+		status = compile(inputs.front());
+		failed = status != 0;
+	} else {
+		std::vector<int> statuses(inputs.size());
+
+		{
+			ThreadPool pool(vm.count("jobs") ? vm["jobs"].as<unsigned>() : 0);
+
+			for (std::size_t i=0; i < inputs.size(); ++i) {
+				pool.submit([&, i]() {
+					statuses[i] = compile(inputs[i]);
+				});
+			}
+		}
+
+		// Report the first failure, in the order the inputs were given
+		for (int s : statuses) {
+			if (s != 0) {
+				if (status == 0) status = s;
+				++failed;
+			}
+		}
 	}
 
-	std::ofstream file;
-	file.open("bin/out.ir", std::ios::out | std::ios::trunc | std::ios::binary);
+	if (vm.count("verbose") && batch) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
 
-	for (const std::uint8_t &v : ir) {
-		file.put(v);
+		std::cout << "Compiled " << inputs.size() - failed << " of " << inputs.size() << " inputs in "
+			<< elapsed.count() * 1e3 << " ms (" << inputs.size() / elapsed.count() << " inputs/s)" << std::endl;
 	}
 
-	// optimize(&ir);
+	if (cache) {
+		cache->trim();
 
-	//ir = backend->compile(ir);
+		if (vm.count("verbose")) {
+			std::cout << "Cache: " << cache->hits() << " hits, " << cache->misses() << " misses" << std::endl;
+		}
+	}
 
-	delete frontend;
-	delete backend;
-}
+	if (statsJSON.is_open() && !statsJSON) {
+		std::cerr << "Could not write " << vm["stats-json"].as<std::string>() << std::endl;
+		return 1;
+	}
 
+	return status;
+}
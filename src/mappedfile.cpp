@@ -0,0 +1,144 @@
+#include <string>
+#include <system_error>
+
+#include <cerrno>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mappedfile.hpp"
+
+namespace {
+	/*
+	 * Read everything left in fd into anonymous memory, for files which
+	 * can't be mapped, such as pipes. The memory can be unmapped like a
+	 * mapping of the file.
+	 *
+	 * length	Set to the number of bytes read
+	 * Returns the memory, or nullptr if nothing was read. Throws
+	 * std::system_error if reading fails or memory cannot be mapped.
+	 */
+	char *readAll(int fd, const std::string &file, std::size_t &length) {
+		std::size_t capacity = 1 << 20;
+		void *addr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (addr == MAP_FAILED) {
+			throw std::system_error(errno, std::generic_category(), file);
+		}
+
+		char *buffer = static_cast<char *>(addr);
+		length = 0;
+
+		for (;;) {
+			if (length == capacity) {
+				addr = mremap(buffer, capacity, capacity * 2, MREMAP_MAYMOVE);
+
+				if (addr == MAP_FAILED) {
+					int err = errno;
+					munmap(buffer, capacity);
+					throw std::system_error(err, std::generic_category(), file);
+				}
+
+				buffer = static_cast<char *>(addr);
+				capacity *= 2;
+			}
+
+			ssize_t n = read(fd, buffer + length, capacity - length);
+
+			if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n < 0) {
+				int err = errno;
+				munmap(buffer, capacity);
+				throw std::system_error(err, std::generic_category(), file);
+			} else if (n == 0) {
+				break;
+			}
+
+			length += n;
+		}
+
+		if (length == 0) {
+			munmap(buffer, capacity);
+			return nullptr;
+		}
+
+		// Give back the pages past the end, so that unmapping length bytes
+		// frees everything
+		std::size_t pageSize = sysconf(_SC_PAGESIZE);
+		std::size_t used = (length + pageSize - 1) / pageSize * pageSize;
+
+		if (used < capacity) {
+			munmap(buffer + used, capacity - used);
+		}
+
+		mprotect(buffer, used, PROT_READ);
+
+		return buffer;
+	}
+}
+
+MappedFile::MappedFile(const std::string &file) {
+	int fd = open(file.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		throw std::system_error(errno, std::generic_category(), file);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int err = errno;
+		close(fd);
+		throw std::system_error(err, std::generic_category(), file);
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		// Pipes and devices have no size up front, and can't be mapped
+		try {
+			bytes = readAll(fd, file, length);
+		} catch (...) {
+			close(fd);
+			throw;
+		}
+
+		close(fd);
+		return;
+	}
+
+	length = st.st_size;
+
+	if (length > 0) {
+		void *addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (addr == MAP_FAILED) {
+			int err = errno;
+			close(fd);
+			throw std::system_error(err, std::generic_category(), file);
+		}
+
+		// the file is always read front to back
+		madvise(addr, length, MADV_SEQUENTIAL);
+
+		bytes = static_cast<const char *>(addr);
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+}
+
+const char *MappedFile::data() const {
+	return bytes;
+}
+
+std::size_t MappedFile::size() const {
+	return length;
+}
+
+MappedFile::~MappedFile() {
+	if (bytes) {
+		munmap(const_cast<char *>(bytes), length);
+	}
+}
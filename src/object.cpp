@@ -0,0 +1,156 @@
+#include <bit>
+
+#include <cstring>
+
+#include "object.hpp"
+
+namespace IR {
+	static_assert(std::endian::native == std::endian::little, "IR objects are used in place, so the host must be little endian");
+
+	/**************************
+	 * InvalidObjectException *
+	 **************************/
+	InvalidObjectException::InvalidObjectException(const char *msg) : message(msg) {}
+
+	const char *InvalidObjectException::what() const noexcept {
+		return message;
+	}
+
+
+	/**************
+	 * ObjectView *
+	 **************/
+	ObjectView::ObjectView(const std::uint8_t *data, std::size_t size) : base(data) {
+		if (size < sizeof(ObjectHeader)) {
+			throw InvalidObjectException("IR object is truncated");
+		}
+
+		if (reinterpret_cast<std::uintptr_t>(data) % alignof(ObjectHeader) != 0) {
+			throw InvalidObjectException("IR object is not aligned");
+		}
+
+		header = reinterpret_cast<const ObjectHeader *>(data);
+
+		if (std::memcmp(header->magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC)) != 0) {
+			throw InvalidObjectException("Not an IR object");
+		}
+
+		if (header->version != OBJECT_VERSION || header->headerSize != sizeof(ObjectHeader)) {
+			throw InvalidObjectException("Unsupported IR object version");
+		}
+
+		for (const ObjectSection *section : {&header->code, &header->symbols, &header->relocations,
+											 &header->strings, &header->sourceMap, &header->image,
+											 &header->output}) {
+			if (section->offset % 8 != 0 || static_cast<std::size_t>(section->offset) + section->size > size) {
+				throw InvalidObjectException("IR object section is out of bounds");
+			}
+		}
+	}
+
+	ObjectView::ObjectView(const std::vector<std::uint8_t> &data) : ObjectView(data.data(), data.size()) {}
+
+	std::uint32_t ObjectView::entry() const {
+		return header->entry;
+	}
+
+	std::uint32_t ObjectView::instructions() const {
+		return header->instructions;
+	}
+
+	std::span<const std::uint8_t> ObjectView::code() const {
+		return {base + header->code.offset, header->code.size};
+	}
+
+	std::span<const ObjectSymbol> ObjectView::symbols() const {
+		return {reinterpret_cast<const ObjectSymbol *>(base + header->symbols.offset),
+				header->symbols.size / sizeof(ObjectSymbol)};
+	}
+
+	std::span<const ObjectRelocation> ObjectView::relocations() const {
+		return {reinterpret_cast<const ObjectRelocation *>(base + header->relocations.offset),
+				header->relocations.size / sizeof(ObjectRelocation)};
+	}
+
+	std::span<const SourceMapEntry> ObjectView::sourceMap() const {
+		return {reinterpret_cast<const SourceMapEntry *>(base + header->sourceMap.offset),
+				header->sourceMap.size / sizeof(SourceMapEntry)};
+	}
+
+	std::span<const std::uint8_t> ObjectView::image() const {
+		return {base + header->image.offset, header->image.size};
+	}
+
+	std::span<const std::uint8_t> ObjectView::output() const {
+		return {base + header->output.offset, header->output.size};
+	}
+
+	std::string_view ObjectView::name(const ObjectSymbol &symbol) const {
+		if (symbol.name >= header->strings.size) {
+			throw InvalidObjectException("Symbol name is out of bounds");
+		}
+
+		const char *strings = reinterpret_cast<const char *>(base + header->strings.offset);
+
+		// strnlen so that an unterminated string table cannot be overrun
+		return {strings + symbol.name, strnlen(strings + symbol.name, header->strings.size - symbol.name)};
+	}
+
+
+	/*****************
+	 * ObjectBuilder *
+	 *****************/
+	std::uint32_t ObjectBuilder::addSymbol(std::string_view name, std::uint32_t flags, std::uint32_t value) {
+		symbols.push_back({static_cast<std::uint32_t>(strings.size()), flags, value});
+
+		strings.append(name);
+		strings.push_back('\0');
+
+		return symbols.size() - 1;
+	}
+
+	std::vector<std::uint8_t> ObjectBuilder::build() const {
+		ObjectHeader header = {};
+		std::memcpy(header.magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC));
+		header.version = OBJECT_VERSION;
+		header.headerSize = sizeof(ObjectHeader);
+		header.entry = entry;
+		header.instructions = instructions;
+
+		// Lay out the sections one after another, each aligned to 8 bytes
+		std::size_t end = sizeof(ObjectHeader);
+		auto place = [&end](ObjectSection &section, std::size_t size) {
+			end = (end + 7) & ~static_cast<std::size_t>(7);
+			section.offset = end;
+			section.size = size;
+			end += size;
+		};
+
+		place(header.code, code.size());
+		place(header.symbols, symbols.size() * sizeof(ObjectSymbol));
+		place(header.relocations, relocations.size() * sizeof(ObjectRelocation));
+		place(header.strings, strings.size());
+		place(header.sourceMap, sourceMap.size() * sizeof(SourceMapEntry));
+		place(header.image, image.size());
+		place(header.output, output.size());
+
+		std::vector<std::uint8_t> object(end);
+
+		auto copy = [&object](const ObjectSection &section, const void *data) {
+			if (section.size > 0) {
+				std::memcpy(object.data() + section.offset, data, section.size);
+			}
+		};
+
+		std::memcpy(object.data(), &header, sizeof(header));
+		copy(header.code, code.data());
+		copy(header.symbols, symbols.data());
+		copy(header.relocations, relocations.data());
+		copy(header.strings, strings.data());
+		copy(header.sourceMap, sourceMap.data());
+		copy(header.image, image.data());
+		copy(header.output, output.data());
+
+		return object;
+	}
+}
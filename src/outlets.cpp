@@ -0,0 +1,32 @@
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "outlets.hpp"
+
+/****************
+ * ObjectOutlet *
+ ****************/
+static int registered = OutletFactory::getInstance().registerComponent(
+	[]() { return new ObjectOutlet(); }, {"ir"});
+
+void ObjectOutlet::deliver(std::string &file, Coupling::Source &source) {
+	// Wait for the first chunk before creating the file, so that nothing is
+	// left behind if an earlier stage fails
+	Chunk chunk;
+	bool more = source.read(chunk);
+
+	std::ofstream out(file, std::ios::out | std::ios::trunc | std::ios::binary);
+
+	while (out && more) {
+		out.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+		source.release(std::move(chunk));
+
+		more = source.read(chunk);
+	}
+
+	if (!out) {
+		throw std::runtime_error("Could not write " + file);
+	}
+}
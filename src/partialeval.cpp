@@ -0,0 +1,518 @@
+/*
+ * Partial evaluation
+ *
+ * Many programs do a lot of work which does not depend on their input before
+ * they read any, such as building a lookup table or printing a banner. This
+ * pass runs the program from main at compile time, on a concrete copy of the
+ * memory at AR, until it is about to read input or runs out of steps. That
+ * prefix is then replaced by its result: the memory it built becomes the
+ * object's image, what it printed becomes the object's output, and main jumps
+ * straight to where the evaluation stopped, after restoring the registers.
+ *
+ * The evaluator only follows code whose effect it knows exactly. It gives up
+ * at anything else (indirects through other registers, jumps through
+ * registers, unknown externals, division by zero, ...), and then backs up to
+ * the last point at which the flags were not live, so that the prologue does
+ * not have to rebuild them.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <cstring>
+
+#include "ir.hpp"
+#include "passes.hpp"
+
+namespace {
+	using namespace IR;
+
+	// The most instructions evaluated at compile time, which takes around
+	// 100 ms
+	constexpr std::size_t MAX_STEPS = std::size_t(1) << 22;
+
+	// The largest image the evaluator will build, in bytes
+	constexpr std::int64_t MAX_IMAGE = std::int64_t(1) << 20;
+
+	/*
+	 * Returns the value of a literal of the given size, sign extended
+	 */
+	std::int64_t signExtend(std::uint64_t value, OperandSize size) {
+		int shift = 64 - (8 << size);
+
+		return static_cast<std::int64_t>(value << shift) >> shift;
+	}
+
+	std::uint64_t sizeMask(OperandSize size) {
+		return size == DWORD ? ~std::uint64_t(0) : (std::uint64_t(1) << (8 << size)) - 1;
+	}
+
+	/*
+	 * Runs a program on concrete values, keeping enough history to back up
+	 * to the last point at which the flags were dead.
+	 */
+	class Evaluator {
+	public:
+		enum Stop {
+			FINISHED,		// ran off the end of the program
+			INPUT,			// about to read input
+			BUDGET,			// ran out of steps
+			UNKNOWN			// reached code it can't evaluate
+		};
+
+	private:
+		const Program &program;
+
+		// The symbols of the runtime functions the evaluator understands
+		Symbol putcSym, getcSym, scanSym;
+
+		struct State {
+			std::size_t pc = 0;
+			std::int64_t ar = 0;			// offset of AR into the image
+			std::uint64_t regs[8] = {};
+			std::uint8_t written = 0;		// registers which have been set
+			std::size_t outputSize = 0;
+		};
+
+		State state;
+		State safe;		// the state at the last safe point
+
+		bool zero = false, negative = false, carry = false, overflow = false;
+
+		// Writes to memory since the last safe point, with the old bytes
+		struct Undo {
+			std::int64_t address;
+			std::uint64_t old;
+			std::uint8_t bytes;
+		};
+		std::vector<Undo> undo;
+
+		/*
+		 * Returns a pointer to bytes of memory at offset from AR, growing the
+		 * image if needed, or nullptr if that is out of bounds
+		 */
+		std::uint8_t *memory(std::int32_t offset, std::size_t bytes) {
+			std::int64_t address = state.ar + offset;
+
+			if (address < 0 || address + static_cast<std::int64_t>(bytes) > MAX_IMAGE) return nullptr;
+
+			if (static_cast<std::size_t>(address) + bytes > image.size()) {
+				image.resize(address + bytes);
+			}
+
+			return image.data() + address;
+		}
+
+		/*
+		 * Read an operand. Returns false if its value is not known.
+		 */
+		bool read(const Instruction &instr, OperandType type, Register reg, std::uint64_t &value) {
+			OperandSize size = instr.getSize();
+
+			switch (type) {
+				case REGISTER:
+					// AR is an address, whose value is only known relative to
+					// where it started
+					if (reg == AR || !(state.written & (1 << reg))) return false;
+
+					value = state.regs[reg] & sizeMask(size);
+					return true;
+				case INDIRECT:
+					{
+						if (reg != AR) return false;
+
+						std::uint8_t *p = memory(instr.getDisplacement(), 1 << size);
+						if (!p) return false;
+
+						value = 0;
+						std::memcpy(&value, p, 1 << size);
+						return true;
+					}
+				case LITERAL:
+					value = instr.getLiteral() & sizeMask(size);
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		/*
+		 * Write op1. Returns false if it can't be written.
+		 */
+		bool write(const Instruction &instr, std::uint64_t value) {
+			OperandSize size = instr.getSize();
+			Register reg = instr.getOp1();
+
+			if (instr.getOp1Type() == REGISTER) {
+				if (reg == AR) return false;
+
+				std::uint64_t mask = sizeMask(size);
+				state.regs[reg] = (state.regs[reg] & ~mask) | (value & mask);
+				state.written |= 1 << reg;
+				return true;
+			}
+
+			if (reg != AR) return false;
+
+			std::uint8_t *p = memory(instr.getDisplacement(), 1 << size);
+			if (!p) return false;
+
+			Undo &entry = undo.emplace_back(state.ar + instr.getDisplacement(), 0, 1 << size);
+			std::memcpy(&entry.old, p, 1 << size);
+			std::memcpy(p, &value, 1 << size);
+			return true;
+		}
+
+		/*
+		 * Set the flags as CMP would
+		 */
+		void compare(std::uint64_t a, std::uint64_t b, OperandSize size) {
+			std::uint64_t mask = sizeMask(size);
+			std::uint64_t sign = (mask >> 1) + 1;
+			std::uint64_t result = (a - b) & mask;
+
+			zero = result == 0;
+			negative = result & sign;
+			carry = a >= b;		// no borrow
+			overflow = (a ^ b) & (a ^ result) & sign;
+		}
+
+		bool condition(Condition cc) const {
+			switch (cc) {
+				case AL: return true;
+				case NV: return false;
+				case EQ: return zero;
+				case NE: return !zero;
+				case CS: return carry;
+				case CC: return !carry;
+				case MI: return negative;
+				case PL: return !negative;
+				case VS: return overflow;
+				case VC: return !overflow;
+				case HI: return carry && !zero;
+				case LS: return !carry || zero;
+				case GE: return negative == overflow;
+				case LT: return negative != overflow;
+				case GT: return !zero && negative == overflow;
+				case LE: return zero || negative != overflow;
+			}
+
+			return false;
+		}
+
+		/*
+		 * Evaluate one instruction. Returns false, having changed nothing the
+		 * rollback can't undo, if it can't be evaluated.
+		 */
+		bool step(const Instruction &instr) {
+			Opcode opcode = instr.getOpcode();
+			OperandSize size = instr.getSize();
+			std::uint64_t mask = sizeMask(size);
+			std::uint64_t a = 0, b = 0;
+
+			switch (opcode) {
+				case JMP:
+					{
+						Condition cc = instr.getCondition();
+
+						if (!condition(cc)) {
+							++state.pc;
+							return true;
+						}
+
+						std::size_t target = instr.getOp2Type() == SYMBOL
+							? program.target(instr.getSymbol()) : Program::UNDEFINED;
+						if (target == Program::UNDEFINED) return false;
+
+						state.pc = target;
+						return true;
+					}
+				case CALL:
+					{
+						if (instr.getOp2Type() != SYMBOL) return false;
+
+						Symbol sym = instr.getSymbol();
+						std::uint8_t *cell = memory(0, 1);
+						if (!cell) return false;
+
+						if (sym == putcSym) {
+							output.push_back(*cell);
+						} else if (sym == scanSym) {
+							if (!(state.written & (1 << R0))) return false;
+
+							std::int64_t stride = signExtend(state.regs[R0], WORD);
+
+							while (*cell != 0) {
+								state.ar += stride;
+								if (!(cell = memory(0, 1)) || ++steps > MAX_STEPS) return false;
+							}
+						} else {
+							return false;
+						}
+
+						++state.pc;
+						return true;
+					}
+				default:
+					break;
+			}
+
+			// Moving AR by a constant is the only thing it can do
+			if (instr.getOp1Type() == REGISTER && instr.getOp1() == AR) {
+				if ((opcode != ADD && opcode != SUB) || instr.getOp2Type() != LITERAL) return false;
+
+				std::int64_t delta = signExtend(instr.getLiteral() & mask, size);
+				state.ar += opcode == ADD ? delta : -delta;
+
+				++state.pc;
+				return true;
+			}
+
+			// MOV is the only instruction which doesn't use op1's old value
+			if (opcode != MOV && !read(instr, instr.getOp1Type(), instr.getOp1(), a)) return false;
+
+			if (opcode != CPL && !read(instr, instr.getOp2Type(), instr.getOp2(), b)) return false;
+
+			std::uint64_t result;
+			int bits = 8 << size;
+
+			switch (opcode) {
+				case ADD: result = a + b; break;
+				case SUB: result = a - b; break;
+				case MUL: result = a * b; break;
+				case DIV:
+					if (b == 0) return false;
+					result = a / b;
+					break;
+				case AND: result = a & b; break;
+				case OR: result = a | b; break;
+				case XOR: result = a ^ b; break;
+				case CPL: result = ~a; break;
+				case LSL:
+				case LSR:
+				case ASR:
+					if (b >= static_cast<std::uint64_t>(bits)) return false;
+
+					if (opcode == LSL) result = a << b;
+					else if (opcode == LSR) result = a >> b;
+					else result = static_cast<std::uint64_t>(signExtend(a, size) >> b);
+					break;
+				case MOV: result = b; break;
+				case CMP:
+					compare(a, b, size);
+					++state.pc;
+					return true;
+				case TST:
+					result = a & b;
+					zero = result == 0;
+					negative = result & ((mask >> 1) + 1);
+					carry = overflow = false;
+					++state.pc;
+					return true;
+				default:
+					return false;
+			}
+
+			if (!write(instr, result)) return false;
+
+			++state.pc;
+			return true;
+		}
+
+		/*
+		 * Returns true if the flags are dead before an instruction, because it
+		 * sets them or they are undefined after it
+		 */
+		static bool flagsDead(const Instruction &instr) {
+			Opcode opcode = instr.getOpcode();
+
+			return opcode == CMP || opcode == TST || opcode == CALL;
+		}
+
+		/*
+		 * Back up to the last safe point
+		 */
+		void rollback() {
+			for (auto entry = undo.rbegin(); entry != undo.rend(); ++entry) {
+				std::memcpy(image.data() + entry->address, &entry->old, entry->bytes);
+			}
+
+			undo.clear();
+			state = safe;
+			output.resize(state.outputSize);
+		}
+
+	public:
+		std::vector<std::uint8_t> image;
+		std::string output;
+
+		std::size_t steps = 0;
+
+		/*
+		 * Construct an evaluator which starts at entry. The runtime functions
+		 * are given as symbols in the program's symbol table.
+		 */
+		Evaluator(const Program &program, std::size_t entry, Symbol putcSym, Symbol getcSym, Symbol scanSym)
+			: program(program), putcSym(putcSym), getcSym(getcSym), scanSym(scanSym) {
+			image = program.image();
+			state.pc = safe.pc = entry;
+		}
+
+		/*
+		 * Run until the program stops at a safe point
+		 */
+		Stop run() {
+			std::size_t n = program.size();
+
+			while (true) {
+				if (state.pc >= n) return FINISHED;
+
+				const Instruction &instr = program[state.pc];
+
+				if (flagsDead(instr)) {
+					state.outputSize = output.size();
+					safe = state;
+					undo.clear();
+
+					if (instr.getOpcode() == CALL && instr.getOp2Type() == SYMBOL && instr.getSymbol() == getcSym) {
+						return INPUT;
+					}
+
+					if (steps >= MAX_STEPS) return BUDGET;
+				}
+
+				++steps;
+
+				if (!step(instr)) {
+					rollback();
+					return UNKNOWN;
+				}
+			}
+		}
+
+		std::size_t pc() const {
+			return state.pc;
+		}
+
+		std::int64_t ar() const {
+			return state.ar;
+		}
+
+		/*
+		 * Returns the value of a register, if it has been set
+		 */
+		bool reg(Register r, std::uint64_t &value) const {
+			value = state.regs[r];
+			return state.written & (1 << r);
+		}
+	};
+
+	class PartialEvalPass : public IPass {
+	private:
+		Evaluator::Stop stop = Evaluator::FINISHED;
+		std::size_t steps = 0;
+		std::size_t outputBytes = 0;
+		std::size_t imageBytes = 0;
+		bool evaluated = false;
+
+	public:
+		AnalysisSet required() {
+			return NO_ANALYSES;
+		}
+
+		AnalysisSet run(Program &program, AnalysisManager &analyses) {
+			SymbolTable &symbols = program.symbols();
+			Symbol mainSym = symbols.intern("main");
+			std::size_t entry = program.target(mainSym);
+
+			if (entry == Program::UNDEFINED) return ALL_ANALYSES;
+
+			Evaluator evaluator(program, entry, symbols.intern("putc"), symbols.intern("getc"), symbols.intern("scan"));
+			stop = evaluator.run();
+			steps = evaluator.steps;
+
+			// Nothing was evaluated, so there is nothing to replace
+			if (evaluator.pc() == entry) return ALL_ANALYSES;
+
+			evaluated = true;
+			std::size_t resume = evaluator.pc();
+
+			program.output() += evaluator.output;
+			outputBytes = evaluator.output.size();
+
+			// The state only matters if there is code left to run
+			if (stop != Evaluator::FINISHED) {
+				std::vector<std::uint8_t> &image = evaluator.image;
+
+				while (!image.empty() && image.back() == 0) {
+					image.pop_back();
+				}
+
+				program.image() = std::move(image);
+				imageBytes = program.image().size();
+			}
+
+			// The new entry point goes after the end of the program, so the
+			// program has to jump over it when it finishes:
+			//
+			//   jmp _exit
+			// main:
+			//   add ar,offset
+			//   mov dword rN,value
+			//   ...
+			//   jmp resume
+			// _exit:
+			//
+			// Labels which pointed at the end of the program now point at the
+			// jump over the prologue, so they still end it.
+			Symbol exitSym = symbols.anonymous();
+			program(JMP) (exitSym);
+
+			std::size_t prologue = program.size();
+
+			if (stop != Evaluator::FINISHED) {
+				std::int64_t ar = evaluator.ar();
+
+				if (ar > 0) {
+					program(ADD) (AR)(static_cast<std::uintmax_t>(ar));
+				} else if (ar < 0) {
+					program(SUB) (AR)(static_cast<std::uintmax_t>(-ar));
+				}
+
+				for (Register r : {R0, R1, R2, R3, R4, R5, R7}) {
+					std::uint64_t value;
+
+					if (evaluator.reg(r, value)) {
+						program(MOV) (DWORD) (r)(value);
+					}
+				}
+
+				Symbol resumeSym = symbols.anonymous();
+				program.label(resumeSym, resume);
+				program(JMP) (resumeSym);
+			}
+
+			program.label(exitSym, program.size());
+
+			std::vector<bool> oldMain(symbols.size(), false);
+			oldMain[static_cast<std::size_t>(mainSym)] = true;
+			program.removeLabels(oldMain);
+			program.label(mainSym, prologue);
+
+			return NO_ANALYSES;
+		}
+
+		void report(std::ostream &os) {
+			static const char *reasons[] = {"end of program", "input", "step budget", "unknown code"};
+
+			os << "  evaluated " << steps << " steps, stopped at " << reasons[stop] << std::endl;
+
+			if (evaluated) {
+				os << "  " << outputBytes << " bytes of output, " << imageBytes << " byte image" << std::endl;
+			}
+		}
+	};
+
+	int registered = PassFactory::getInstance().registerComponent([]() { return new PartialEvalPass(); }, {"partial-eval"});
+}
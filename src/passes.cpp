@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "decoder.hpp"
+#include "object.hpp"
+#include "passes.hpp"
+
+/*******************
+ * AnalysisManager *
+ *******************/
+AnalysisManager::AnalysisManager(const IR::Program &program) : program(program) {}
+
+void AnalysisManager::require(AnalysisSet analyses) {
+	if (analyses & CFG_ANALYSIS) getCFG();
+	if (analyses & CELL_OFFSETS_ANALYSIS) getCellOffsets();
+	if (analyses & DOMINATORS_ANALYSIS) getDominators();
+	if (analyses & LOOPS_ANALYSIS) getLoops();
+	if (analyses & CELL_VALUES_ANALYSIS) getCellValues();
+}
+
+void AnalysisManager::invalidate(AnalysisSet preserved) {
+	// Everything else is indexed by block, so it goes with the CFG
+	if (!(preserved & CFG_ANALYSIS)) {
+		preserved = NO_ANALYSES;
+	}
+
+	// and cell values are worked out from the cell offsets
+	if (!(preserved & CELL_OFFSETS_ANALYSIS)) {
+		preserved &= ~CELL_VALUES_ANALYSIS;
+	}
+
+	// and loops from the dominators
+	if (!(preserved & DOMINATORS_ANALYSIS)) {
+		preserved &= ~LOOPS_ANALYSIS;
+	}
+
+	if (!(preserved & CFG_ANALYSIS)) cfg.reset();
+	if (!(preserved & CELL_OFFSETS_ANALYSIS)) cellOffsets.reset();
+	if (!(preserved & DOMINATORS_ANALYSIS)) dominators.reset();
+	if (!(preserved & LOOPS_ANALYSIS)) loops.reset();
+	if (!(preserved & CELL_VALUES_ANALYSIS)) cellValues.reset();
+}
+
+const IR::CFG &AnalysisManager::getCFG() {
+	if (!cfg) {
+		cfg = std::make_unique<IR::CFG>(program);
+		++cfgComputed;
+	}
+
+	return *cfg;
+}
+
+const IR::CellOffsets &AnalysisManager::getCellOffsets() {
+	if (!cellOffsets) {
+		cellOffsets = std::make_unique<IR::CellOffsets>(program, getCFG());
+		++cellOffsetsComputed;
+	}
+
+	return *cellOffsets;
+}
+
+const IR::Dominators &AnalysisManager::getDominators() {
+	if (!dominators) {
+		dominators = std::make_unique<IR::Dominators>(getCFG());
+		++dominatorsComputed;
+	}
+
+	return *dominators;
+}
+
+const IR::Loops &AnalysisManager::getLoops() {
+	if (!loops) {
+		loops = std::make_unique<IR::Loops>(getCFG(), getDominators());
+		++loopsComputed;
+	}
+
+	return *loops;
+}
+
+const IR::CellValues &AnalysisManager::getCellValues() {
+	if (!cellValues) {
+		cellValues = std::make_unique<IR::CellValues>(program, getCFG(), getCellOffsets());
+		++cellValuesComputed;
+	}
+
+	return *cellValues;
+}
+
+void AnalysisManager::report(std::ostream &os) const {
+	os << "Analyses computed: cfg " << cfgComputed << ", cell offsets " << cellOffsetsComputed
+		<< ", dominators " << dominatorsComputed << ", loops " << loopsComputed
+		<< ", cell values " << cellValuesComputed << std::endl;
+}
+
+
+/***************
+ * PassManager *
+ ***************/
+std::vector<std::string> PassManager::level(unsigned level) {
+	// The passes run at each level, in order. There are no passes beyond
+	// those of -O2 yet, so -O3 and above are aliases of -O2.
+	static const std::vector<std::string> levels[] = {
+		{},																// -O0
+		{"dce", "peephole"},											// -O1
+		{"dce", "peephole", "partial-eval", "dce", "peephole"}		// -O2
+	};
+
+	return levels[std::min(level, 2u)];
+}
+
+void PassManager::add(const std::string &name) {
+	passes.emplace_back(name, std::unique_ptr<IPass>(PassFactory::getInstance().get(name)));
+}
+
+bool PassManager::empty() const {
+	return passes.empty();
+}
+
+void PassManager::setVerbosity(bool verbosity) {
+	verbose = verbosity;
+}
+
+bool PassManager::run(IR::Program &program) {
+	AnalysisManager analyses(program);
+	bool changed = false;
+
+	for (auto &[name, pass] : passes) {
+		auto startTime = std::chrono::steady_clock::now();
+		std::size_t before = program.size();
+
+		analyses.require(pass->required());
+
+		AnalysisSet preserved = pass->run(program, analyses);
+		analyses.invalidate(preserved);
+		changed |= preserved != ALL_ANALYSES;
+
+		if (verbose) {
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+			std::cout << "Pass " << name << ": " << before << " -> " << program.size()
+				<< " instructions in " << elapsed.count() * 1e3 << " ms" << std::endl;
+			pass->report(std::cout);
+		}
+	}
+
+	if (verbose) {
+		analyses.report(std::cout);
+	}
+
+	return changed;
+}
+
+
+/************
+ * PassPipe *
+ ************/
+PassPipe::PassPipe(const std::vector<std::string> &names, bool verbose) {
+	for (const std::string &name : names) {
+		passes.add(name);
+	}
+
+	passes.setVerbosity(verbose);
+}
+
+void PassPipe::pump(Coupling::Source &source, Coupling::Drain &drain) {
+	// Passes work on the whole program, so collect the object first
+	Chunk object = source.collect();
+
+	IR::Program program = IR::disassemble(IR::ObjectView(object));
+
+	if (passes.run(program)) {
+		drain.write(program.assemble());
+	} else {
+		drain.write(std::move(object));
+	}
+}
@@ -0,0 +1,370 @@
+/*
+ * Peephole optimiser
+ *
+ * Slides a small window over the program and rewrites sequences of
+ * instructions that match one of the rules below. Rules only look at what
+ * is in their window (and, for jumps, at the instructions they jump to), so
+ * each one is cheap to check and new ones are easy to add: write a match and
+ * rewrite function and add a line to the table.
+ */
+
+#include <array>
+#include <iostream>
+#include <vector>
+
+#include "ir.hpp"
+#include "passes.hpp"
+
+namespace {
+	using namespace IR;
+
+	/*
+	 * The view of the program a rule gets. Indices are relative to the start
+	 * of the window.
+	 */
+	class Window {
+	private:
+		Program &program;
+		std::size_t start;
+
+		std::vector<bool> &dead;
+
+		// The first label at each instruction, or NO_LABEL
+		std::vector<std::uint32_t> &labelAt;
+
+	public:
+		static constexpr std::uint32_t NO_LABEL = 0xFFFFFFFF;
+
+		Window(Program &program, std::size_t start, std::vector<bool> &dead, std::vector<std::uint32_t> &labelAt)
+			: program(program), start(start), dead(dead), labelAt(labelAt) {}
+
+		Instruction &operator[](std::size_t i) {
+			return program[start + i];
+		}
+
+		/*
+		 * Returns the index in the program of an instruction in the window
+		 */
+		std::size_t index(std::size_t i) const {
+			return start + i;
+		}
+
+		/*
+		 * Returns the instruction at an index in the program, or nullptr if it
+		 * has been removed or is past the end
+		 */
+		const Instruction *at(std::size_t index) const {
+			if (index >= program.size() || dead[index]) return nullptr;
+
+			return &program[index];
+		}
+
+		/*
+		 * Returns the index of the instruction a jump goes to, or
+		 * Program::UNDEFINED if it doesn't go to a label
+		 */
+		std::size_t target(const Instruction &jump) const {
+			if (jump.getOp2Type() != SYMBOL) return Program::UNDEFINED;
+
+			return program.target(jump.getSymbol());
+		}
+
+		/*
+		 * Make a jump in the window go to the instruction at index, adding a
+		 * label there if there isn't one already
+		 */
+		void retarget(std::size_t i, std::size_t index) {
+			if (labelAt[index] == NO_LABEL) {
+				Symbol label = program.symbols().anonymous();
+
+				program.label(label, index);
+				labelAt[index] = static_cast<std::uint32_t>(label);
+			}
+
+			(*this)[i].setSymbol(static_cast<Symbol>(labelAt[index]));
+		}
+
+		void remove(std::size_t i) {
+			dead[start + i] = true;
+		}
+	};
+
+	/*
+	 * The opcodes a pattern accepts in one position
+	 */
+	typedef std::uint16_t OpcodeSet;
+
+	constexpr OpcodeSet op(Opcode opcode) {
+		return 1 << opcode;
+	}
+
+	constexpr OpcodeSet ARITH = op(ADD) | op(SUB);
+	constexpr OpcodeSet TEST = op(TST) | op(CMP);
+
+	struct Rule {
+		const char *name;
+
+		// The opcodes of the instructions in the window. Only the first of
+		// them may have a label pointing at it.
+		std::vector<OpcodeSet> pattern;
+
+		/*
+		 * Check the rest of the pattern, and rewrite the window if it
+		 * matches. Returns true if it did.
+		 */
+		bool (*rewrite)(Window &w);
+	};
+
+	/*
+	 * Returns true if two instructions do the same thing
+	 */
+	bool same(const Instruction &a, const Instruction &b) {
+		if (a.getOpcode() != b.getOpcode() || a.getSize() != b.getSize()) return false;
+		if (a.hasOperand1() != b.hasOperand1() || a.hasOperand2() != b.hasOperand2()) return false;
+
+		if (a.hasOperand1() && (a.getOp1Type() != b.getOp1Type() || a.getOp1() != b.getOp1())) return false;
+
+		if (a.hasOperand2()) {
+			if (a.getOp2Type() != b.getOp2Type()) return false;
+
+			switch (a.getOp2Type()) {
+				case REGISTER:
+				case INDIRECT:
+					if (a.getOp2() != b.getOp2()) return false;
+					break;
+				case SYMBOL:
+				case LITERAL:
+					if (a.getLiteral() != b.getLiteral()) return false;
+					break;
+			}
+		}
+
+		return a.getDisplacement() == b.getDisplacement();
+	}
+
+	/*
+	 * Returns true if two instructions write to the same place
+	 */
+	bool sameDestination(const Instruction &a, const Instruction &b) {
+		return a.getSize() == b.getSize() && a.getOp1Type() == b.getOp1Type() && a.getOp1() == b.getOp1()
+			&& (a.getOp1Type() != INDIRECT || a.getDisplacement() == b.getDisplacement());
+	}
+
+	/*
+	 * Returns the literal operand of an instruction, truncated to its size
+	 */
+	std::uint64_t literal(const Instruction &instruction) {
+		int bits = 8 << instruction.getSize();
+
+		return bits == 64 ? instruction.getLiteral() : instruction.getLiteral() & ((std::uint64_t(1) << bits) - 1);
+	}
+
+	/*
+	 * Returns the condition which holds exactly when cc does not
+	 */
+	Condition invert(Condition cc) {
+		return static_cast<Condition>(cc ^ 0b1000);
+	}
+
+	const Rule RULES[] = {
+		// add x,0 and sub x,0 do nothing
+		{"add-zero", {ARITH}, [](Window &w) {
+			if (w[0].getOp2Type() != LITERAL || literal(w[0]) != 0) return false;
+
+			w.remove(0);
+			return true;
+		}},
+
+		// add x,a; sub x,b is add x,a-b
+		{"fold-add-sub", {ARITH, ARITH}, [](Window &w) {
+			if (w[0].getOp2Type() != LITERAL || w[1].getOp2Type() != LITERAL) return false;
+			if (!sameDestination(w[0], w[1])) return false;
+
+			int bits = 8 << w[0].getSize();
+			std::uint64_t mask = bits == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+
+			// The net amount added, modulo the size
+			std::uint64_t net = w[0].getOpcode() == ADD ? literal(w[0]) : -literal(w[0]);
+			net += w[1].getOpcode() == ADD ? literal(w[1]) : -literal(w[1]);
+			net &= mask;
+
+			if (net == 0) {
+				w.remove(0);
+			} else if (net <= mask / 2 + 1) {
+				w[0].setOpcode(ADD);
+				w[0].setLiteral(net);
+			} else {
+				w[0].setOpcode(SUB);
+				w[0].setLiteral(-net & mask);
+			}
+
+			w.remove(1);
+			return true;
+		}},
+
+		// A test whose flags are overwritten before any jump can see them
+		{"dead-test", {TEST, TEST}, [](Window &w) {
+			w.remove(0);
+			return true;
+		}},
+
+		// Repeating a test after a jump which didn't change anything
+		{"repeated-test", {TEST, op(JMP), TEST}, [](Window &w) {
+			if (!same(w[0], w[2])) return false;
+
+			w.remove(2);
+			return true;
+		}},
+
+		// A conditional jump to the same test followed by another jump, e.g.
+		// each ] jumping back to its [. The flags are already known where it
+		// lands, so go straight to wherever the second jump would go.
+		{"thread-known-flags", {TEST, op(JMP)}, [](Window &w) {
+			Condition cc = w[1].getCondition();
+			if (cc == AL || cc == NV) return false;
+
+			std::size_t target = w.target(w[1]);
+			if (target == Program::UNDEFINED) return false;
+
+			const Instruction *test = w.at(target);
+			const Instruction *jump = w.at(target + 1);
+			if (!test || !jump || !same(w[0], *test) || jump->getOpcode() != JMP) return false;
+
+			Condition next = jump->getCondition();
+			std::size_t to;
+
+			if (next == cc || next == AL) {
+				to = w.target(*jump);		// always taken
+			} else if (next == invert(cc) || next == NV) {
+				to = target + 2;			// never taken
+			} else {
+				return false;
+			}
+
+			if (to == Program::UNDEFINED || to == target) return false;
+
+			w.retarget(1, to);
+			return true;
+		}},
+
+		// A jump to an unconditional jump can go straight to its target
+		{"jump-to-jump", {op(JMP)}, [](Window &w) {
+			if (w[0].getCondition() == NV) return false;
+
+			std::size_t target = w.target(w[0]);
+			if (target == Program::UNDEFINED) return false;
+
+			const Instruction *jump = w.at(target);
+			if (!jump || jump->getOpcode() != JMP || jump->getCondition() != AL) return false;
+
+			std::size_t to = w.target(*jump);
+			if (to == Program::UNDEFINED || to == target) return false;
+
+			w.retarget(0, to);
+			return true;
+		}},
+
+		// A jump to the next instruction does nothing, whether it's taken or
+		// not
+		{"jump-to-next", {op(JMP)}, [](Window &w) {
+			if (w[0].getCondition() == NV || w.target(w[0]) != w.index(1)) return false;
+
+			w.remove(0);
+			return true;
+		}},
+	};
+
+	constexpr std::size_t RULE_COUNT = sizeof(RULES) / sizeof(RULES[0]);
+
+	// Rewrites can enable other rewrites, so the rules are applied repeatedly
+	// until nothing changes, up to this many times
+	constexpr int MAX_ROUNDS = 16;
+
+	class PeepholePass : public IPass {
+	private:
+		// How many times each rule fired
+		std::array<std::size_t, RULE_COUNT> fired = {};
+
+		std::size_t labelsPruned = 0;
+
+		/*
+		 * Apply every rule once over the whole program.
+		 *
+		 * Returns true if anything changed.
+		 */
+		bool round(Program &program) {
+			std::size_t n = program.size();
+			std::vector<bool> dead(n, false);
+
+			std::vector<std::uint32_t> labelAt(n + 1, Window::NO_LABEL);
+			for (auto &[index, symbol] : program.getLabels()) {
+				if (labelAt[index] == Window::NO_LABEL) {
+					labelAt[index] = static_cast<std::uint32_t>(symbol);
+				}
+			}
+
+			bool changed = false;
+
+			for (std::size_t i=0; i < n; ++i) {
+				for (std::size_t r=0; r < RULE_COUNT && !dead[i]; ++r) {
+					const Rule &rule = RULES[r];
+					std::size_t length = rule.pattern.size();
+
+					if (i + length > n) continue;
+
+					bool matches = true;
+					for (std::size_t j=0; j < length && matches; ++j) {
+						matches = !dead[i + j] && (rule.pattern[j] & op(program[i + j].getOpcode()))
+							&& (j == 0 || labelAt[i + j] == Window::NO_LABEL);
+					}
+
+					Window window(program, i, dead, labelAt);
+
+					if (matches && rule.rewrite(window)) {
+						++fired[r];
+						changed = true;
+					}
+				}
+			}
+
+			if (changed) {
+				program.erase(dead);
+
+				// labels stop windows from matching, so get rid of the ones
+				// which nothing jumps to anymore
+				labelsPruned += program.pruneLabels();
+			}
+
+			return changed;
+		}
+
+	public:
+		AnalysisSet required() {
+			return NO_ANALYSES;
+		}
+
+		AnalysisSet run(Program &program, AnalysisManager &analyses) {
+			bool changed = false;
+
+			for (int i=0; i < MAX_ROUNDS && round(program); ++i) {
+				changed = true;
+			}
+
+			return changed ? NO_ANALYSES : ALL_ANALYSES;
+		}
+
+		void report(std::ostream &os) {
+			for (std::size_t r=0; r < RULE_COUNT; ++r) {
+				if (fired[r] > 0) {
+					os << "  " << RULES[r].name << ": fired " << fired[r] << " times" << std::endl;
+				}
+			}
+
+			if (labelsPruned > 0) {
+				os << "  " << labelsPruned << " unused labels removed" << std::endl;
+			}
+		}
+	};
+
+	int registered = PassFactory::getInstance().registerComponent([]() { return new PeepholePass(); }, {"peephole"});
+}
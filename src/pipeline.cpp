@@ -1,12 +1,385 @@
+#include <algorithm>
+#include <bit>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#include <cstring>
+
+#include "object.hpp"
 #include "pipeline.hpp"
+#include "stats.hpp"
+
+/*************
+ * ChunkPool *
+ *************/
+ChunkPool::ChunkPool(std::size_t limit) : limit(limit) {}
+
+Chunk ChunkPool::acquire() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (!buffers.empty()) {
+			Chunk chunk = std::move(buffers.back());
+			buffers.pop_back();
+			return chunk;
+		}
+	}
+
+	Chunk chunk;
+	chunk.reserve(CHUNK_SIZE);
+	return chunk;
+}
+
+void ChunkPool::release(Chunk &&chunk) {
+	if (chunk.capacity() < CHUNK_SIZE || chunk.capacity() > 2 * CHUNK_SIZE) return;
+
+	chunk.clear();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (buffers.size() < limit) {
+		buffers.push_back(std::move(chunk));
+	}
+}
+
+
+/************
+ * Coupling *
+ ************/
+Coupling::Coupling(ChunkPool &pool, std::size_t capacity)
+	: pool(&pool), ring(new Chunk[std::bit_ceil(capacity)]), mask(std::bit_ceil(capacity) - 1),
+	  source(this), drain(this) {}
+
+Coupling::Source &Coupling::getSource() {
+	return source;
+}
+
+Coupling::Drain &Coupling::getDrain() {
+	return drain;
+}
+
+void Coupling::cancel() {
+	head.fetch_or(CANCELLED, std::memory_order_release);
+	tail.fetch_or(CANCELLED, std::memory_order_release);
+
+	head.notify_all();
+	tail.notify_all();
+}
+
+std::uint64_t Coupling::bytes() const {
+	return bytesWritten;
+}
+
+std::uint64_t Coupling::instructions() const {
+	return instructionsWritten;
+}
+
+double Coupling::sourceBlockedTime() const {
+	return std::chrono::duration<double>(sourceWaiting).count();
+}
+
+double Coupling::drainBlockedTime() const {
+	return std::chrono::duration<double>(drainWaiting).count();
+}
+
+
+/***********************
+ * Coupling::Cancelled *
+ ***********************/
+const char *Coupling::Cancelled::what() const noexcept {
+	return "Pipeline coupling was cancelled";
+}
+
+
+/********************
+ * Coupling::Source *
+ ********************/
+Coupling::Source::Source(Coupling *coupling) : coupling(coupling) {}
+
+bool Coupling::Source::read(Chunk &chunk) {
+	std::size_t head = coupling->head.load(std::memory_order_relaxed);
+
+	if (head & CANCELLED) {
+		throw Cancelled();
+	}
+
+	while ((coupling->cachedTail & POSITION) == head) {
+		// Looks empty; check what the writer has done since we last looked
+		std::size_t tail = coupling->tail.load(std::memory_order_acquire);
+
+		if (tail & CANCELLED) {
+			throw Cancelled();
+		} else if ((tail & POSITION) != head) {
+			coupling->cachedTail = tail;
+		} else if (tail & CLOSED) {
+			return false;
+		} else {
+			// Wait for the writer to change tail
+			auto start = std::chrono::steady_clock::now();
+			coupling->tail.wait(tail, std::memory_order_acquire);
+			coupling->sourceWaiting += std::chrono::steady_clock::now() - start;
+		}
+	}
+
+	chunk = std::move(coupling->ring[head & coupling->mask]);
+
+	// add rather than store, since cancel() may be setting a flag
+	coupling->head.fetch_add(1, std::memory_order_release);
+	coupling->head.notify_one();
+
+	return true;
+}
+
+Chunk Coupling::Source::collect() {
+	Chunk object, chunk;
+
+	if (!read(object)) return object;
+
+	while (read(chunk)) {
+		object.insert(object.end(), chunk.begin(), chunk.end());
+		release(std::move(chunk));
+	}
+
+	return object;
+}
+
+void Coupling::Source::release(Chunk &&chunk) {
+	coupling->pool->release(std::move(chunk));
+}
+
+
+/*******************
+ * Coupling::Drain *
+ *******************/
+Coupling::Drain::Drain(Coupling *coupling) : coupling(coupling) {}
+
+void Coupling::Drain::write(Chunk &&chunk) {
+	std::size_t tail = coupling->tail.load(std::memory_order_relaxed);
+
+	if (tail & CANCELLED) {
+		throw Cancelled();
+	}
+
+	tail &= POSITION;
+
+	while (tail - coupling->cachedHead > coupling->mask) {
+		// Looks full; check what the reader has done since we last looked
+		std::size_t head = coupling->head.load(std::memory_order_acquire);
+
+		if (head & CANCELLED) {
+			throw Cancelled();
+		} else if (tail - head > coupling->mask) {
+			// Wait for the reader to change head
+			auto start = std::chrono::steady_clock::now();
+			coupling->head.wait(head, std::memory_order_acquire);
+			coupling->drainWaiting += std::chrono::steady_clock::now() - start;
+		}
+
+		coupling->cachedHead = coupling->head.load(std::memory_order_acquire) & POSITION;
+	}
+
+	// The object header is at the start of the first chunk
+	if (coupling->bytesWritten == 0 && chunk.size() >= sizeof(IR::ObjectHeader)) {
+		IR::ObjectHeader header;
+		std::memcpy(&header, chunk.data(), sizeof(header));
+
+		if (std::memcmp(header.magic, IR::OBJECT_MAGIC, sizeof(IR::OBJECT_MAGIC)) == 0) {
+			coupling->instructionsWritten = header.instructions;
+		}
+	}
+
+	coupling->bytesWritten += chunk.size();
+	coupling->ring[tail & coupling->mask] = std::move(chunk);
+
+	// add rather than store, since cancel() may be setting a flag
+	coupling->tail.fetch_add(1, std::memory_order_release);
+	coupling->tail.notify_one();
+}
+
+void Coupling::Drain::write(const std::uint8_t *data, std::size_t size) {
+	while (size > 0) {
+		Chunk chunk = acquire();
+		std::size_t n = std::min(size, ChunkPool::CHUNK_SIZE);
+
+		chunk.insert(chunk.end(), data, data + n);
+		write(std::move(chunk));
+
+		data += n;
+		size -= n;
+	}
+}
+
+Chunk Coupling::Drain::acquire() {
+	return coupling->pool->acquire();
+}
+
+void Coupling::Drain::close() {
+	coupling->tail.fetch_or(CLOSED, std::memory_order_release);
+	coupling->tail.notify_one();
+}
+
+
+/************
+ * Pipeline *
+ ************/
 
 Pipeline::Pipeline(std::string inlet, std::string outlet) {
 	this->inlet = InletFactory::getInstance().get(inlet);
 	this->outlet = OutletFactory::getInstance().get(outlet);
+
+	names = {inlet, outlet};
 }
 
+Pipeline::Pipeline(IInlet *inlet, IOutlet *outlet, std::string inletName, std::string outletName)
+	: inlet(inlet), outlet(outlet), names{inletName, outletName} {}
+
 void Pipeline::addPipe(std::string pipe) {
 	IPipe *pipeSegment = PipeFactory::getInstance().get(pipe);
 
 	pipes.push_back(pipeSegment);
+	names.insert(names.end() - 1, pipe);
+}
+
+void Pipeline::addPipe(IPipe *pipe, std::string name) {
+	pipes.push_back(pipe);
+	names.insert(names.end() - 1, name);
+}
+
+void Pipeline::flow(std::string srcFile, std::string dstFile) {
+	// couplings[i] feeds pipes[i], and the last one feeds the outlet
+	std::vector<std::unique_ptr<Coupling>> couplings;
+	for (std::size_t i=0; i <= pipes.size(); ++i) {
+		couplings.push_back(std::make_unique<Coupling>(pool));
+	}
+
+	// stages[0] is the inlet, stages[i+1] is pipes[i], and the last is the
+	// outlet
+	statistics = PipelineStats();
+	statistics.input = srcFile;
+	statistics.stages.resize(pipes.size() + 2);
+	for (std::size_t i=0; i < names.size(); ++i) {
+		statistics.stages[i].name = names[i];
+	}
+
+	auto flowStart = std::chrono::steady_clock::now();
+
+	std::mutex errorMutex;
+	std::exception_ptr error;
+
+	// The peak RSS of the process when each stage finished. Every stage
+	// starts at once and waits for its input, so what a stage added is
+	// measured from when the stage before it finished.
+	std::uint64_t flowRSS = Stats::peakRSS();
+	std::vector<std::uint64_t> finishedRSS(statistics.stages.size());
+
+	/*
+	 * Run a component, making sure that its drain is closed when it
+	 * finishes, and that the rest of the pipeline stops if it throws.
+	 *
+	 * source	The coupling the component reads from, if any
+	 * drain	The coupling the component writes to, if any
+	 * stats	Where to record the component's time and memory use
+	 */
+	auto run = [&](Coupling *source, Coupling *drain, StageStats &stats, std::function<void()> component) {
+		auto wallStart = std::chrono::steady_clock::now();
+		double cpuStart = Stats::threadCPUTime();
+
+		try {
+			component();
+
+			if (drain) drain->getDrain().close();
+
+			// Nothing else will be read, so don't let the previous component
+			// wait on a full coupling forever
+			if (source) source->cancel();
+		} catch (Coupling::Cancelled &ex) {
+			// Another component failed; it has the interesting exception
+		} catch (...) {
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) error = std::current_exception();
+			}
+
+			for (std::unique_ptr<Coupling> &coupling : couplings) {
+				coupling->cancel();
+			}
+		}
+
+		stats.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+		stats.cpuTime = Stats::threadCPUTime() - cpuStart;
+		finishedRSS[&stats - statistics.stages.data()] = Stats::peakRSS();
+	};
+
+	std::vector<std::thread> threads;
+
+	threads.emplace_back(run, nullptr, couplings.front().get(), std::ref(statistics.stages.front()), [&]() {
+		inlet->inject(srcFile, couplings.front()->getDrain());
+	});
+
+	for (std::size_t i=0; i < pipes.size(); ++i) {
+		threads.emplace_back(run, couplings[i].get(), couplings[i+1].get(), std::ref(statistics.stages[i+1]), [&, i]() {
+			pipes[i]->pump(couplings[i]->getSource(), couplings[i+1]->getDrain());
+		});
+	}
+
+	// The outlet runs on this thread
+	run(couplings.back().get(), nullptr, statistics.stages.back(), [&]() {
+		outlet->deliver(dstFile, couplings.back()->getSource());
+	});
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	// Everything else comes from the couplings, which are only safe to read
+	// now that every thread is done
+	for (std::size_t i=0; i < couplings.size(); ++i) {
+		StageStats &writer = statistics.stages[i];
+		StageStats &reader = statistics.stages[i+1];
+
+		writer.bytesOut = couplings[i]->bytes();
+		writer.instructionsOut = couplings[i]->instructions();
+		writer.blockedTime += couplings[i]->drainBlockedTime();
+
+		reader.bytesIn = couplings[i]->bytes();
+		reader.instructionsIn = couplings[i]->instructions();
+		reader.blockedTime += couplings[i]->sourceBlockedTime();
+	}
+
+	for (std::size_t i=0; i < finishedRSS.size(); ++i) {
+		std::uint64_t before = i > 0 ? finishedRSS[i-1] : flowRSS;
+
+		// A cancelled stage may finish before the stage feeding it
+		statistics.stages[i].peakRSSIncrease = finishedRSS[i] > before ? finishedRSS[i] - before : 0;
+	}
+
+	// The inlet reads and the outlet writes files rather than couplings
+	std::error_code ec;
+	std::uintmax_t srcSize = std::filesystem::file_size(srcFile, ec);
+	if (!ec) statistics.stages.front().bytesIn = srcSize;
+
+	std::uintmax_t dstSize = std::filesystem::file_size(dstFile, ec);
+	if (!ec) statistics.stages.back().bytesOut = dstSize;
+
+	statistics.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - flowStart).count();
+	statistics.peakRSS = Stats::peakRSS();
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+const PipelineStats &Pipeline::stats() const {
+	return statistics;
+}
+
+Pipeline::~Pipeline() {
+	delete inlet;
+
+	for (IPipe *pipe : pipes) {
+		delete pipe;
+	}
+
+	delete outlet;
 }
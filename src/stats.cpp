@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include "stats.hpp"
+
+/*********
+ * Stats *
+ *********/
+namespace Stats {
+	double threadCPUTime() {
+		timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	std::uint64_t peakRSS() {
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+
+		// ru_maxrss is in kilobytes on Linux
+		return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+	}
+}
+
+
+/*****************
+ * PipelineStats *
+ *****************/
+void PipelineStats::print(std::ostream &os) const {
+	std::ios_base::fmtflags flags = os.flags();
+
+	os << "===-- Pipeline statistics for " << input << " --===" << std::endl;
+	os << std::left << std::setw(12) << "stage" << std::right
+	   << std::setw(10) << "wall (s)" << std::setw(10) << "cpu (s)" << std::setw(12) << "blocked (s)"
+	   << std::setw(12) << "bytes in" << std::setw(12) << "bytes out"
+	   << std::setw(12) << "instrs in" << std::setw(12) << "instrs out"
+	   << std::setw(14) << "peak RSS +" << std::endl;
+
+	os << std::fixed << std::setprecision(4);
+	for (const StageStats &stage : stages) {
+		os << std::left << std::setw(12) << stage.name << std::right
+		   << std::setw(10) << stage.wallTime << std::setw(10) << stage.cpuTime << std::setw(12) << stage.blockedTime
+		   << std::setw(12) << stage.bytesIn << std::setw(12) << stage.bytesOut
+		   << std::setw(12) << stage.instructionsIn << std::setw(12) << stage.instructionsOut
+		   << std::setw(14) << stage.peakRSSIncrease << std::endl;
+	}
+
+	os << "total wall time " << wallTime << "s, peak RSS " << peakRSS << " bytes" << std::endl;
+
+	os.flags(flags);
+}
+
+void PipelineStats::printJSON(std::ostream &os) const {
+	// Stage names are component names, but escape them anyway
+	auto string = [&os](const std::string &str) {
+		os << '"';
+		for (char c : str) {
+			if (c == '"' || c == '\\') {
+				os << '\\' << c;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c)
+				   << std::dec << std::setfill(' ');
+			} else {
+				os << c;
+			}
+		}
+		os << '"';
+	};
+
+	os << "{\"input\":";
+	string(input);
+	os << ",\"wallTime\":" << wallTime << ",\"peakRSS\":" << peakRSS << ",\"stages\":[";
+
+	for (std::size_t i=0; i < stages.size(); ++i) {
+		const StageStats &stage = stages[i];
+
+		if (i > 0) os << ',';
+
+		os << "{\"name\":";
+		string(stage.name);
+		os << ",\"wallTime\":" << stage.wallTime
+		   << ",\"cpuTime\":" << stage.cpuTime
+		   << ",\"blockedTime\":" << stage.blockedTime
+		   << ",\"bytesIn\":" << stage.bytesIn
+		   << ",\"bytesOut\":" << stage.bytesOut
+		   << ",\"instructionsIn\":" << stage.instructionsIn
+		   << ",\"instructionsOut\":" << stage.instructionsOut
+		   << ",\"peakRSSIncrease\":" << stage.peakRSSIncrease << '}';
+	}
+
+	os << "]}" << std::endl;
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <utility>
+
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(std::size_t threads) {
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (std::size_t i=0; i < threads; ++i) {
+		workers.push_back(std::make_unique<Worker>());
+	}
+
+	// Only start the threads once every deque exists, since they steal
+	for (std::size_t i=0; i < threads; ++i) {
+		this->threads.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+
+bool ThreadPool::take(std::size_t index, Job &job) {
+	// Newest first from our own deque...
+	{
+		Worker &self = *workers[index];
+		std::lock_guard<std::mutex> lock(self.mutex);
+
+		if (!self.jobs.empty()) {
+			job = std::move(self.jobs.back());
+			self.jobs.pop_back();
+			return true;
+		}
+	}
+
+	// ...then oldest first from everyone else's
+	for (std::size_t i=1; i < workers.size(); ++i) {
+		Worker &victim = *workers[(index + i) % workers.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::work(std::size_t index) {
+	Job job;
+
+	while (true) {
+		if (take(index, job)) {
+			{
+				std::lock_guard<std::mutex> lock(stateMutex);
+				--queued;
+			}
+
+			job();
+			job = nullptr;
+
+			std::lock_guard<std::mutex> lock(stateMutex);
+			if (--pending == 0) {
+				allDone.notify_all();
+			}
+		} else {
+			std::unique_lock<std::mutex> lock(stateMutex);
+			workAvailable.wait(lock, [this]() { return stopping || queued > 0; });
+
+			if (stopping && queued == 0) {
+				return;
+			}
+		}
+	}
+}
+
+void ThreadPool::submit(Job job) {
+	// Count the job before it can be taken, so the counts never go negative
+	std::size_t index;
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		index = nextWorker;
+		nextWorker = (nextWorker + 1) % workers.size();
+
+		++queued;
+		++pending;
+	}
+
+	{
+		Worker &worker = *workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.jobs.push_back(std::move(job));
+	}
+
+	workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(stateMutex);
+	allDone.wait(lock, [this]() { return pending == 0; });
+}
+
+std::size_t ThreadPool::size() const {
+	return workers.size();
+}
+
+ThreadPool::~ThreadPool() {
+	wait();
+
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+}
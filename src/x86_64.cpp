@@ -0,0 +1,1069 @@
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "backend.hpp"
+#include "decoder.hpp"
+#include "elfwriter.hpp"
+#include "interpreter.hpp"
+#include "x86_64.hpp"
+
+namespace X86_64 {
+	namespace {
+		// Where each IR register lives
+		constexpr Register REGISTERS[8] = {R8, R9, R10, R11, R13, R14, RBX, R15};
+
+		// Caches the byte at [rbx]
+		constexpr Register CELL = R12;
+
+		// The size of the output buffer, which loops share with the
+		// interpreter
+		constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+		static_assert(BUFFER_SIZE == Interpreter::BUFFER_SIZE);
+
+		// Linux system calls
+		constexpr std::int64_t SYS_READ = 0;
+		constexpr std::int64_t SYS_WRITE = 1;
+		constexpr std::int64_t SYS_EXIT = 60;
+
+		/*
+		 * Returns the x86 condition which tests an IR condition. IR carry
+		 * means no borrow, which is the opposite of x86 carry.
+		 */
+		Condition condition(IR::Condition cc) {
+			switch (cc) {
+				case IR::EQ: return E;
+				case IR::NE: return NE;
+				case IR::CS: return AE;
+				case IR::CC: return B;
+				case IR::MI: return S;
+				case IR::PL: return NS;
+				case IR::VS: return O;
+				case IR::VC: return NO;
+				case IR::HI: return A;
+				case IR::LS: return BE;
+				case IR::GE: return GE;
+				case IR::LT: return L;
+				case IR::GT: return G;
+				case IR::LE: return LE;
+				default: return ALWAYS;
+			}
+		}
+
+		std::uint64_t sizeMask(IR::OperandSize size) {
+			return size == IR::DWORD ? ~std::uint64_t(0) : (std::uint64_t(1) << (8 << size)) - 1;
+		}
+
+		std::int64_t signExtend(std::uint64_t value, IR::OperandSize size) {
+			int shift = 64 - (8 << size);
+
+			return static_cast<std::int64_t>(value << shift) >> shift;
+		}
+
+		bool fitsInt32(std::int64_t value) {
+			return value >= INT32_MIN && value <= INT32_MAX;
+		}
+
+		bool isConditional(const IR::DecodedInstruction &instr) {
+			return instr.opcode == IR::JMP && instr.cc != IR::AL && instr.cc != IR::NV;
+		}
+
+		bool readsCarry(const IR::DecodedInstruction &instr) {
+			return isConditional(instr)
+				&& (instr.cc == IR::CS || instr.cc == IR::CC || instr.cc == IR::HI || instr.cc == IR::LS);
+		}
+
+		/*
+		 * Returns true if a jump goes to an address in the bytecode
+		 */
+		bool isLocalJump(const IR::DecodedInstruction &instr) {
+			if (instr.opcode != IR::JMP && instr.opcode != IR::CALL) return false;
+
+			return (instr.op2.type == IR::SYMBOL && !instr.op2.external)
+				|| (instr.op2.type == IR::LITERAL && instr.cc != IR::NV);
+		}
+
+		/*
+		 * Returns true if an operand is the byte at AR
+		 */
+		bool isCell(const IR::DecodedInstruction &instr, const IR::DecodedOperand &op) {
+			return op.type == IR::INDIRECT && op.reg == IR::AR && instr.displacement == 0 && instr.size == IR::BYTE;
+		}
+
+		/*
+		 * Returns true if an operand is memory which may overlap the cell
+		 * without being it
+		 */
+		bool overlapsCell(const IR::DecodedInstruction &instr, const IR::DecodedOperand &op) {
+			std::int32_t disp = instr.displacement;
+
+			if (op.type != IR::INDIRECT || isCell(instr, op)) return false;
+
+			return op.reg != IR::AR || (disp <= 0 && disp + (1 << instr.size) > 0);
+		}
+
+		std::uint32_t jumpAddress(const IR::DecodedInstruction &instr) {
+			return instr.op2.type == IR::SYMBOL ? instr.op2.address : static_cast<std::uint32_t>(instr.op2.literal);
+		}
+
+		/*
+		 * Zero extend a value of the given size into a scratch register
+		 */
+		void load(IEmitter &out, Register scratch, const Operand &src, IR::OperandSize size) {
+			if (src.kind == Operand::IMM) {
+				out.emit(MOV, size == IR::DWORD ? IR::DWORD : IR::WORD, reg(scratch), src);
+			} else if (size < IR::WORD) {
+				out.emit(MOVZX, size, reg(scratch), src);
+			} else {
+				out.emit(MOV, size, reg(scratch), src);
+			}
+		}
+	}
+
+	/************
+	 * Lowering *
+	 ************/
+	Lowering::Lowering(const IR::ObjectView &object, IEmitter &emitter)
+		: Lowering(object, emitter, 0, object.code().size(), false, false) {}
+
+	Lowering::Lowering(const IR::ObjectView &object, IEmitter &emitter, std::uint32_t start, std::uint32_t end,
+					   bool carry) : Lowering(object, emitter, start, end, true, carry) {}
+
+	Lowering::Lowering(const IR::ObjectView &object, IEmitter &emitter, std::uint32_t start, std::uint32_t end,
+					   bool region, bool carry)
+		: object(object), out(emitter), usesCarry(carry), region(region), start(start), end(end) {
+		IR::Decoder decoder(object);
+
+		// No instruction is shorter than two bytes. Growing the vector one
+		// doubling at a time costs more than decoding.
+		code.reserve((end - start) / 2);
+
+		for (std::size_t offset=start; offset < end; offset += code.back().length) {
+			code.push_back(decoder.decode(offset));
+		}
+
+		putcLabel = out.label();
+		getcLabel = out.label();
+		scanLabel = out.label();
+		flushLabel = out.label();
+		writeLabel = out.label();
+		exitLabel = out.label();
+		bufferLabel = out.label();
+		bufferUsedLabel = out.label();
+
+		analyse();
+	}
+
+	std::size_t Lowering::index(std::uint32_t address) const {
+		auto it = std::lower_bound(code.begin(), code.end(), address,
+			[](const IR::DecodedInstruction &instr, std::uint32_t address) { return instr.offset < address; });
+
+		if (it == code.end() ? address != end : it->offset != address) {
+			throw IR::InvalidInstructionException("Jump into the middle of an instruction");
+		}
+
+		return it - code.begin();
+	}
+
+	bool Lowering::testsCarry(const IR::ObjectView &object) {
+		for (const IR::DecodedInstruction &instr : IR::Decoder(object)) {
+			if (readsCarry(instr)) return true;
+		}
+
+		return false;
+	}
+
+	bool Lowering::leaves(std::uint32_t address) const {
+		return region && (address < start || address >= end);
+	}
+
+	Label Lowering::target(std::uint32_t address) {
+		if (leaves(address)) {
+			for (const auto &[exit, label] : exits) {
+				if (exit == address) return label;
+			}
+
+			exits.push_back({address, out.label()});
+			return exits.back().second;
+		}
+
+		std::size_t i = index(address);
+		if (labels[i] == NO_LABEL) labels[i] = out.label();
+
+		return labels[i];
+	}
+
+	void Lowering::analyse() {
+		std::size_t n = code.size();
+
+		labels.assign(n + 1, NO_LABEL);
+		flagsLive.assign(n, false);
+
+		std::vector<std::size_t> targets(n, IR::Program::UNDEFINED);
+
+		for (std::size_t i=0; i < n; ++i) {
+			const IR::DecodedInstruction &instr = code[i];
+
+			if (isLocalJump(instr)) {
+				std::uint32_t address = jumpAddress(instr);
+
+				target(address);
+				targets[i] = leaves(address) ? n : index(address);
+			} else if (instr.op2.type == IR::SYMBOL && !instr.op2.external) {
+				// The address of a label used as a value
+				target(instr.op2.address);
+			}
+
+			if (readsCarry(instr)) usesCarry = true;
+		}
+
+		if (!region) {
+			std::size_t entry = object.entry() == IR::NO_ENTRY ? 0 : index(object.entry());
+			if (labels[entry] == NO_LABEL) labels[entry] = out.label();
+		}
+
+		// The cell stays cached across conditional jumps, but not past
+		// anything that moves AR, writes memory that might be the cell, or
+		// may be jumped to
+		cellReused.assign(n, false);
+		std::size_t lastUse = IR::Program::UNDEFINED;
+
+		for (std::size_t i=0; i < n; ++i) {
+			const IR::DecodedInstruction &instr = code[i];
+
+			if (labels[i] != NO_LABEL) lastUse = IR::Program::UNDEFINED;
+
+			if ((instr.hasOp1 && isCell(instr, instr.op1)) || (instr.hasOp2 && isCell(instr, instr.op2))) {
+				if (lastUse != IR::Program::UNDEFINED) cellReused[lastUse] = true;
+				lastUse = i;
+			}
+
+			bool barrier = instr.opcode == IR::CALL || (instr.opcode == IR::JMP && instr.cc == IR::AL)
+				|| (instr.hasOp1 && (overlapsCell(instr, instr.op1)
+									 || (instr.op1.type == IR::REGISTER && instr.op1.reg == IR::AR)))
+				|| (instr.hasOp2 && overlapsCell(instr, instr.op2));
+
+			if (barrier) lastUse = IR::Program::UNDEFINED;
+		}
+
+		// The flags are live before an instruction if it tests them, or if it
+		// leaves them alone and they are live afterwards. Back edges need
+		// more than one sweep.
+		std::vector<bool> liveIn(n + 1, false);
+		bool changed = true;
+
+		// The flags go back to the interpreter when a loop leaves
+		liveIn[n] = region;
+
+		while (changed) {
+			changed = false;
+
+			for (std::size_t i=n; i-- > 0;) {
+				const IR::DecodedInstruction &instr = code[i];
+				bool live = false;
+
+				if (instr.opcode == IR::JMP) {
+					if (instr.cc != IR::AL) live = liveIn[i + 1];
+					if (instr.cc != IR::NV && targets[i] != IR::Program::UNDEFINED) live = live || liveIn[targets[i]];
+				} else {
+					live = liveIn[i + 1];
+				}
+
+				flagsLive[i] = live;
+
+				bool sets = instr.opcode == IR::CMP || instr.opcode == IR::TST || instr.opcode == IR::CALL;
+				bool in = isConditional(instr) || (!sets && live);
+
+				if (in != liveIn[i]) {
+					liveIn[i] = in;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	Label Lowering::external(const IR::DecodedOperand &symbol) {
+		if (symbol.name == "putc") return putcLabel;
+		if (symbol.name == "getc") return getcLabel;
+		if (symbol.name == "scan") return scanLabel;
+
+		throw std::runtime_error("x86_64: the runtime does not provide " + std::string(symbol.name));
+	}
+
+	void Lowering::flushCell() {
+		if (cellCached && cellDirty) {
+			out.emit(MOV, IR::BYTE, mem(RBX), reg(CELL));
+			cellDirty = false;
+		}
+	}
+
+	void Lowering::dropCell() {
+		flushCell();
+		cellCached = false;
+	}
+
+	Operand Lowering::operand(const IR::DecodedInstruction &instr, const IR::DecodedOperand &op,
+							  bool written, bool readOld) {
+		IR::OperandSize size = instr.size;
+
+		switch (op.type) {
+			case IR::REGISTER:
+				return reg(REGISTERS[op.reg]);
+			case IR::INDIRECT:
+				{
+					std::int32_t disp = instr.displacement;
+
+					if (isCell(instr, op) && (cellCached || cellReused[current])) {
+						if (!cellCached) {
+							if (!written || readOld) out.emit(MOVZX, IR::BYTE, reg(CELL), mem(RBX));
+
+							cellCached = true;
+							cellDirty = false;
+						}
+
+						if (written) cellDirty = true;
+						return reg(CELL);
+					}
+
+					if (cellCached && overlapsCell(instr, op)) {
+						if (written) dropCell();
+						else flushCell();
+					}
+
+					return mem(REGISTERS[op.reg], disp);
+				}
+			case IR::LITERAL:
+				{
+					std::int64_t value = static_cast<std::int64_t>(op.literal & sizeMask(size));
+
+					if (!fitsInt32(value) && size == IR::DWORD) {
+						out.emit(MOV, IR::DWORD, reg(RCX), imm(value));
+						return reg(RCX);
+					}
+
+					return imm(value);
+				}
+			case IR::SYMBOL:
+				{
+					Label label = op.external ? external(op) : target(op.address);
+
+					out.emit(LEA, IR::DWORD, reg(RCX), at(label));
+					return reg(RCX);
+				}
+		}
+
+		return {};
+	}
+
+	void Lowering::lowerInstruction(std::size_t i) {
+		const IR::DecodedInstruction &instr = code[i];
+		IR::OperandSize size = instr.size;
+		IR::Opcode opcode = instr.opcode;
+
+		current = i;
+
+		if (labels[i] != NO_LABEL) {
+			dropCell();
+			out.bind(labels[i]);
+		}
+
+		if (opcode == IR::JMP) {
+			lowerJump(instr);
+			return;
+		} else if (opcode == IR::CALL) {
+			lowerCall(instr);
+			return;
+		}
+
+		bool movesAR = instr.op1.type == IR::REGISTER && instr.op1.reg == IR::AR && opcode != IR::CMP && opcode != IR::TST;
+
+		if (movesAR) {
+			dropCell();
+
+			// AR is an address, so what is added to it is sign extended. Moves
+			// by a constant don't touch the flags.
+			if ((opcode == IR::ADD || opcode == IR::SUB) && instr.op2.type == IR::LITERAL) {
+				std::int64_t delta = signExtend(instr.op2.literal & sizeMask(size), size);
+				if (opcode == IR::SUB) delta = -delta;
+
+				if (fitsInt32(delta)) {
+					out.emit(LEA, IR::DWORD, reg(RBX), mem(RBX, static_cast<std::int32_t>(delta)));
+					return;
+				}
+			}
+		}
+
+		bool preserveFlags = flagsLive[i] && opcode != IR::MOV && opcode != IR::CPL
+			&& opcode != IR::CMP && opcode != IR::TST;
+
+		if (preserveFlags) out.emit(PUSHF, IR::DWORD);
+
+		Operand dst, src;
+
+		switch (opcode) {
+			case IR::MOV:
+				src = operand(instr, instr.op2, false);
+				dst = operand(instr, instr.op1, true, false);
+
+				if (dst.kind == Operand::MEM && src.kind == Operand::MEM) {
+					out.emit(MOV, size, reg(RAX), src);
+					src = reg(RAX);
+				}
+
+				out.emit(MOV, size, dst, src);
+				break;
+			case IR::ADD:
+			case IR::SUB:
+			case IR::AND:
+			case IR::OR:
+			case IR::XOR:
+				src = operand(instr, instr.op2, false);
+				dst = operand(instr, instr.op1, true);
+
+				if (movesAR && size != IR::DWORD && (opcode == IR::ADD || opcode == IR::SUB)) {
+					out.emit(MOVSX, size, reg(RAX), src);
+					src = reg(RAX);
+					size = IR::DWORD;
+				} else if (dst.kind == Operand::MEM && src.kind == Operand::MEM) {
+					out.emit(MOV, size, reg(RAX), src);
+					src = reg(RAX);
+				}
+
+				{
+					static constexpr Opcode OPCODES[] = {ADD, SUB, AND, OR, XOR};
+					Opcode x86 = OPCODES[opcode == IR::ADD ? 0 : opcode == IR::SUB ? 1
+										 : opcode == IR::AND ? 2 : opcode == IR::OR ? 3 : 4];
+
+					out.emit(x86, size, dst, src);
+				}
+				break;
+			case IR::CMP:
+			case IR::TST:
+				dst = operand(instr, instr.op1, false);
+				src = operand(instr, instr.op2, false);
+
+				// tst x,x sets the same flags as cmp x,0, which can take
+				// memory
+				if (opcode == IR::TST && dst.kind == Operand::MEM && instr.op1.reg == instr.op2.reg
+					&& instr.op2.type == IR::INDIRECT) {
+					out.emit(CMP, size, dst, imm(0));
+					if (usesCarry) out.emit(STC, size);
+					break;
+				}
+
+				if (dst.kind == Operand::MEM && src.kind == Operand::MEM) {
+					out.emit(MOV, size, reg(RAX), src);
+					src = reg(RAX);
+				}
+
+				if (opcode == IR::TST) {
+					// test only takes memory as its first operand
+					if (src.kind == Operand::MEM) std::swap(dst, src);
+
+					out.emit(TEST, size, dst, src);
+
+					// TST clears the carry flag, which means a borrow on x86
+					if (usesCarry) out.emit(STC, size);
+				} else {
+					out.emit(CMP, size, dst, src);
+				}
+				break;
+			case IR::MUL:
+				{
+					// There is no 8-bit imul with two operands, but the low byte
+					// of a 32-bit product is the same
+					IR::OperandSize width = size == IR::BYTE ? IR::WORD : size;
+
+					src = operand(instr, instr.op2, false);
+					dst = operand(instr, instr.op1, true);
+
+					if (src.kind == Operand::MEM && size == IR::BYTE) {
+						out.emit(MOVZX, IR::BYTE, reg(RCX), src);
+						src = reg(RCX);
+					}
+
+					if (dst.kind == Operand::REG) {
+						out.emit(IMUL, width, dst, src);
+					} else {
+						load(out, RAX, dst, size);
+						out.emit(IMUL, width, reg(RAX), src);
+						out.emit(MOV, size, dst, reg(RAX));
+					}
+				}
+				break;
+			case IR::DIV:
+				{
+					// Unsigned, with the operands zero extended to 64 bits.
+					// Dividing by zero gives zero instead of faulting.
+					Label byZero = out.label(), done = out.label();
+
+					src = operand(instr, instr.op2, false);
+					dst = operand(instr, instr.op1, true);
+
+					load(out, RCX, src, size);
+					load(out, RAX, dst, size);
+					out.emit(XOR, IR::WORD, reg(RDX), reg(RDX));
+					out.emit(TEST, IR::DWORD, reg(RCX), reg(RCX));
+					out.jump(E, byZero);
+					out.emit(DIV, IR::DWORD, reg(RCX));
+					out.jump(ALWAYS, done);
+					out.bind(byZero);
+					out.emit(XOR, IR::WORD, reg(RAX), reg(RAX));
+					out.bind(done);
+					out.emit(MOV, size, dst, reg(RAX));
+				}
+				break;
+			case IR::CPL:
+				dst = operand(instr, instr.op1, true);
+				out.emit(NOT, size, dst);
+				break;
+			case IR::LSL:
+			case IR::LSR:
+			case IR::ASR:
+				src = operand(instr, instr.op2, false);
+
+				if (src.kind == Operand::IMM) {
+					src = imm(src.imm & 0x3F);
+				} else {
+					load(out, RCX, src, size);
+					src = reg(RCX);
+				}
+
+				dst = operand(instr, instr.op1, true);
+				out.emit(opcode == IR::LSL ? SHL : opcode == IR::LSR ? SHR : SAR, size, dst, src);
+				break;
+			default:
+				break;
+		}
+
+		if (preserveFlags) out.emit(POPF, IR::DWORD);
+	}
+
+	void Lowering::lowerJump(const IR::DecodedInstruction &instr) {
+		if (instr.cc == IR::NV) return;
+
+		Condition cc = condition(instr.cc);
+
+		// Everything which jumps here has stored the cell
+		flushCell();
+
+		if (isLocalJump(instr)) {
+			out.jump(cc, target(jumpAddress(instr)));
+			return;
+		}
+
+		// Jumps the x86 can't make conditionally skip over an unconditional
+		// one. Conditions are numbered in pairs, so flipping the lowest bit
+		// negates one.
+		Label skip = 0;
+		if (cc != ALWAYS) {
+			skip = out.label();
+			out.jump(static_cast<Condition>(cc ^ 1), skip);
+		}
+
+		switch (instr.op2.type) {
+			case IR::REGISTER:
+				out.emit(JMP, IR::DWORD, reg(REGISTERS[instr.op2.reg]));
+				break;
+			case IR::INDIRECT:
+				out.emit(JMP, IR::DWORD, mem(REGISTERS[instr.op2.reg], instr.displacement));
+				break;
+			default:
+				// Jumping to a runtime routine returns to LR when it's done
+				out.call(external(instr.op2));
+				out.emit(JMP, IR::DWORD, reg(REGISTERS[IR::LR]));
+				break;
+		}
+
+		if (cc != ALWAYS) out.bind(skip);
+	}
+
+	void Lowering::lowerCall(const IR::DecodedInstruction &instr) {
+		dropCell();
+
+		if (instr.op2.type == IR::SYMBOL && instr.op2.external) {
+			out.call(external(instr.op2));
+			return;
+		}
+
+		// Local calls put the return address in LR, which may also be where
+		// the call goes
+		Label ret = out.label();
+
+		switch (instr.op2.type) {
+			case IR::REGISTER:
+				out.emit(MOV, IR::DWORD, reg(RAX), reg(REGISTERS[instr.op2.reg]));
+				break;
+			case IR::INDIRECT:
+				out.emit(MOV, IR::DWORD, reg(RAX), mem(REGISTERS[instr.op2.reg], instr.displacement));
+				break;
+			default:
+				out.emit(LEA, IR::DWORD, reg(REGISTERS[IR::LR]), at(ret));
+				out.jump(ALWAYS, target(jumpAddress(instr)));
+				out.bind(ret);
+				return;
+		}
+
+		out.emit(LEA, IR::DWORD, reg(REGISTERS[IR::LR]), at(ret));
+		out.emit(JMP, IR::DWORD, reg(RAX));
+		out.bind(ret);
+	}
+
+	void Lowering::runtime() {
+		// Loops write to the interpreter's output buffer, which they find in
+		// the state
+		Operand used = region ? mem(RBP, offsetof(LoopState, used)) : at(bufferUsedLabel);
+		Operand buffer = region ? mem(RBP, offsetof(LoopState, buffer)) : at(bufferLabel);
+		Opcode loadBuffer = region ? MOV : LEA;
+
+		// exit: flush the output and exit with status 0, or return to whoever
+		// called the function. Loops never end the program.
+		if (!region) {
+			out.bind(exitLabel);
+			out.call(flushLabel);
+
+			if (hosted) {
+				for (Register r : {R15, R14, R13, R12, RBX}) {
+					out.emit(POP, IR::DWORD, reg(r));
+				}
+
+				out.emit(RET, IR::DWORD);
+			} else {
+				out.emit(MOV, IR::WORD, reg(RAX), imm(SYS_EXIT));
+				out.emit(XOR, IR::WORD, reg(RDI), reg(RDI));
+				out.emit(SYSCALL, IR::DWORD);
+			}
+		}
+
+		// putc: append the cell to the output buffer, flushing it when full
+		out.bind(putcLabel);
+		out.emit(MOV, IR::WORD, reg(RAX), used);
+		out.emit(MOVZX, IR::BYTE, reg(RCX), mem(RBX));
+		out.emit(loadBuffer, IR::DWORD, reg(RDX), buffer);
+		out.emit(ADD, IR::DWORD, reg(RDX), reg(RAX));
+		out.emit(MOV, IR::BYTE, mem(RDX), reg(RCX));
+		out.emit(ADD, IR::WORD, reg(RAX), imm(1));
+		out.emit(MOV, IR::WORD, used, reg(RAX));
+		out.emit(CMP, IR::WORD, reg(RAX), imm(BUFFER_SIZE));
+		out.jump(AE, flushLabel);
+		out.emit(RET, IR::DWORD);
+
+		// getc: read a byte into the cell, or zero at the end of the input
+		{
+			Label done = out.label();
+
+			out.bind(getcLabel);
+			out.call(flushLabel);
+			out.emit(PUSH, IR::DWORD, reg(R11));
+			out.emit(MOV, IR::WORD, reg(RAX), imm(SYS_READ));
+			out.emit(XOR, IR::WORD, reg(RDI), reg(RDI));
+			out.emit(MOV, IR::DWORD, reg(RSI), reg(RBX));
+			out.emit(MOV, IR::WORD, reg(RDX), imm(1));
+			out.emit(SYSCALL, IR::DWORD);
+			out.emit(POP, IR::DWORD, reg(R11));
+			out.emit(TEST, IR::DWORD, reg(RAX), reg(RAX));
+			out.jump(G, done);
+			out.emit(MOV, IR::BYTE, mem(RBX), imm(0));
+			out.bind(done);
+			out.emit(RET, IR::DWORD);
+		}
+
+		// scan: move AR by the signed word in R0 until the cell is zero
+		{
+			Label loop = out.label(), done = out.label();
+
+			out.bind(scanLabel);
+			out.emit(MOVSX, IR::WORD, reg(RAX), reg(REGISTERS[IR::R0]));
+			out.bind(loop);
+			out.emit(CMP, IR::BYTE, mem(RBX), imm(0));
+			out.jump(E, done);
+			out.emit(ADD, IR::DWORD, reg(RBX), reg(RAX));
+			out.jump(ALWAYS, loop);
+			out.bind(done);
+			out.emit(RET, IR::DWORD);
+		}
+
+		// flush: write out and empty the output buffer
+		out.bind(flushLabel);
+		out.emit(loadBuffer, IR::DWORD, reg(RSI), buffer);
+		out.emit(MOV, IR::WORD, reg(RDX), used);
+		out.emit(MOV, IR::WORD, used, imm(0));
+
+		// write: write edx bytes at rsi to stdout. Only clobbers scratch
+		// registers, so r11 is saved from the system call.
+		{
+			Label loop = out.label(), done = out.label();
+
+			out.bind(writeLabel);
+			out.emit(PUSH, IR::DWORD, reg(R11));
+			out.bind(loop);
+			out.emit(TEST, IR::WORD, reg(RDX), reg(RDX));
+			out.jump(E, done);
+			out.emit(MOV, IR::WORD, reg(RAX), imm(SYS_WRITE));
+			out.emit(MOV, IR::WORD, reg(RDI), imm(1));
+			out.emit(SYSCALL, IR::DWORD);
+			out.emit(TEST, IR::DWORD, reg(RAX), reg(RAX));
+			out.jump(LE, done);
+			out.emit(ADD, IR::DWORD, reg(RSI), reg(RAX));
+			out.emit(SUB, IR::WORD, reg(RDX), reg(RAX));
+			out.jump(ALWAYS, loop);
+			out.bind(done);
+			out.emit(POP, IR::DWORD, reg(R11));
+			out.emit(RET, IR::DWORD);
+		}
+	}
+
+	void Lowering::program() {
+		std::span<const std::uint8_t> image = object.image(), output = object.output();
+		Label imageLabel = out.label(), outputLabel = out.label();
+
+		if (!image.empty()) {
+			out.emit(LEA, IR::DWORD, reg(RSI), at(imageLabel));
+			out.emit(MOV, IR::DWORD, reg(RDI), reg(RBX));
+			out.emit(MOV, IR::WORD, reg(RCX), imm(image.size()));
+			out.emit(REP_MOVSB, IR::BYTE);
+		}
+
+		if (!output.empty()) {
+			out.emit(LEA, IR::DWORD, reg(RSI), at(outputLabel));
+			out.emit(MOV, IR::WORD, reg(RDX), imm(output.size()));
+			out.call(writeLabel);
+		}
+
+		for (IR::Register r : {IR::R0, IR::R1, IR::R2, IR::R3, IR::R4, IR::R5, IR::LR}) {
+			out.emit(XOR, IR::WORD, reg(REGISTERS[r]), reg(REGISTERS[r]));
+		}
+
+		std::size_t entry = object.entry() == IR::NO_ENTRY ? 0 : index(object.entry());
+		if (entry != 0) out.jump(ALWAYS, labels[entry]);
+
+		for (std::size_t i=0; i < code.size(); ++i) {
+			lowerInstruction(i);
+		}
+
+		// Running off the end of the program exits
+		dropCell();
+		if (labels[code.size()] != NO_LABEL) out.bind(labels[code.size()]);
+
+		runtime();
+
+		out.section(IEmitter::RODATA);
+		out.bind(imageLabel);
+		out.data(image.data(), image.size());
+		out.bind(outputLabel);
+		out.data(output.data(), output.size());
+
+		out.section(IEmitter::BSS);
+		out.align(64);
+		out.bind(bufferLabel);
+		out.reserve(BUFFER_SIZE);
+		out.bind(bufferUsedLabel);
+		out.reserve(8);
+	}
+
+	Label Lowering::executable(std::size_t tapeSize) {
+		if (object.image().size() > tapeSize) {
+			throw std::runtime_error("x86_64: the image is larger than the tape");
+		}
+
+		Label start = out.label("_start"), tapeLabel = out.label();
+
+		out.section(IEmitter::TEXT);
+		out.bind(start);
+		out.emit(LEA, IR::DWORD, reg(RBX), at(tapeLabel));
+
+		program();
+
+		out.align(64);
+		out.bind(tapeLabel);
+		out.reserve(tapeSize);
+
+		return start;
+	}
+
+	Label Lowering::function() {
+		Label start = out.label();
+
+		out.section(IEmitter::TEXT);
+		out.bind(start);
+
+		// The registers the caller expects to be kept, which exit restores
+		for (Register r : {RBX, R12, R13, R14, R15}) {
+			out.emit(PUSH, IR::DWORD, reg(r));
+		}
+
+		out.emit(MOV, IR::DWORD, reg(RBX), reg(RDI));
+
+		hosted = true;
+		program();
+
+		return start;
+	}
+
+	bool Lowering::loopable() const {
+		for (const IR::DecodedInstruction &instr : code) {
+			if (instr.opcode == IR::JMP && instr.cc != IR::NV && !isLocalJump(instr)) return false;
+			if (instr.opcode == IR::CALL && !(instr.op2.type == IR::SYMBOL && instr.op2.external)) return false;
+
+			// The address of a label used as a value
+			if (instr.opcode != IR::JMP && instr.opcode != IR::CALL && instr.hasOp2
+				&& instr.op2.type == IR::SYMBOL && !instr.op2.external) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	Label Lowering::loop() {
+		Label function = out.label(), leave = out.label();
+
+		out.section(IEmitter::TEXT);
+		out.bind(function);
+
+		// Keep what the caller expects kept, and enter the loop with the
+		// registers and flags the interpreter left
+		for (Register r : {RBX, RBP, R12, R13, R14, R15}) {
+			out.emit(PUSH, IR::DWORD, reg(r));
+		}
+
+		out.emit(MOV, IR::DWORD, reg(RBP), reg(RDI));
+
+		for (int r=0; r < 8; ++r) {
+			out.emit(MOV, IR::DWORD, reg(REGISTERS[r]), mem(RBP, offsetof(LoopState, registers) + 8 * r));
+		}
+
+		out.emit(MOV, IR::DWORD, reg(RAX), mem(RBP, offsetof(LoopState, rflags)));
+		out.emit(PUSH, IR::DWORD, reg(RAX));
+		out.emit(POPF, IR::DWORD);
+
+		for (std::size_t i=0; i < code.size(); ++i) {
+			lowerInstruction(i);
+		}
+
+		// Falling out of the bottom leaves too
+		dropCell();
+		out.jump(ALWAYS, target(end));
+
+		// Each exit returns where it was going. None of them touch the flags.
+		for (const auto &[address, label] : exits) {
+			out.bind(label);
+			out.emit(MOV, IR::WORD, reg(RAX), imm(address));
+			out.jump(ALWAYS, leave);
+		}
+
+		out.bind(leave);
+		out.emit(PUSHF, IR::DWORD);
+		out.emit(POP, IR::DWORD, reg(RCX));
+		out.emit(MOV, IR::DWORD, mem(RBP, offsetof(LoopState, rflags)), reg(RCX));
+
+		for (int r=0; r < 8; ++r) {
+			out.emit(MOV, IR::DWORD, mem(RBP, offsetof(LoopState, registers) + 8 * r), reg(REGISTERS[r]));
+		}
+
+		for (Register r : {R15, R14, R13, R12, RBP, RBX}) {
+			out.emit(POP, IR::DWORD, reg(r));
+		}
+
+		out.emit(RET, IR::DWORD);
+
+		runtime();
+
+		return function;
+	}
+
+	std::size_t Lowering::size() const {
+		return code.size();
+	}
+}
+
+
+/*****************
+ * X86_64Backend *
+ *****************/
+void X86_64Backend::applyOptions(char option, std::vector<std::string> &values) {
+	if (option != 'f') return;
+
+	for (const std::string &value : values) {
+		if (value.starts_with("tape-size=")) {
+			try {
+				tapeSize = std::stoull(value.substr(10));
+			} catch (std::exception &e) {
+				throw std::invalid_argument("Invalid tape size " + value.substr(10));
+			}
+		} else if (value.starts_with("jit-threshold=")) {
+			try {
+				jitThreshold = std::stoul(value.substr(14));
+			} catch (std::exception &e) {
+				throw std::invalid_argument("Invalid JIT threshold " + value.substr(14));
+			}
+		} else if (value.starts_with("format=")) {
+			std::string name = value.substr(7);
+
+			if (name == "exe") {
+				format = EXECUTABLE;
+			} else if (name == "obj") {
+				format = OBJECT;
+			} else if (name == "asm") {
+				format = ASSEMBLY;
+			} else {
+				throw std::invalid_argument("Invalid output format " + name);
+			}
+		}
+	}
+}
+
+std::string X86_64Backend::helpStr() {
+	return "x86-64 backend. Writes programs for Linux.\n"
+		"Options:\n"
+		"  -fformat=<format>      What to write: exe for a static executable (the\n"
+		"                         default), obj for an ELF object to link with ld, or\n"
+		"                         asm for GNU assembly to assemble with as\n"
+		"  -fjit-threshold=<n>    With --run, how many times a loop goes round in the\n"
+		"                         interpreter before it is compiled. 0 compiles the\n"
+		"                         whole program before running it. Defaults to 1000\n"
+		"  -ftape-size=<bytes>    The size of the tape. Defaults to 1 MiB";
+}
+
+std::string X86_64Backend::name() {
+	return "x86_64";
+}
+
+std::string X86_64Backend::extension() {
+	switch (format) {
+		case EXECUTABLE: return "";
+		case OBJECT: return ".o";
+		default: return ".s";
+	}
+}
+
+bool X86_64Backend::executable() {
+	return format == EXECUTABLE;
+}
+
+void X86_64Backend::setVerbosity(bool verbosity) {
+	verbose = verbosity;
+}
+
+std::vector<std::uint8_t> X86_64Backend::compile(const std::vector<std::uint8_t> &object) {
+	IR::ObjectView view(object);
+
+	if (format == ASSEMBLY) {
+		X86_64::AsmEmitter emitter;
+		X86_64::Lowering lowering(view, emitter);
+
+		lowering.executable(tapeSize);
+
+		const std::string &text = emitter.str();
+
+		if (verbose) {
+			std::cout << "x86_64: lowered " << lowering.size() << " instructions to " << text.size()
+				<< " bytes of assembly" << std::endl;
+		}
+
+		return std::vector<std::uint8_t>(text.begin(), text.end());
+	}
+
+	X86_64::Encoder encoder;
+	X86_64::Lowering lowering(view, encoder);
+
+	X86_64::Label start = lowering.executable(tapeSize);
+
+	const std::vector<std::uint8_t> &text = encoder.getText(), &rodata = encoder.getRodata();
+	ElfWriter writer(text, rodata, encoder.getBssSize());
+
+	for (const X86_64::Encoder::Symbol &symbol : encoder.symbols()) {
+		writer.addSymbol({symbol.name, static_cast<ElfWriter::Section>(symbol.section), symbol.offset});
+	}
+
+	std::vector<std::uint8_t> file;
+
+	if (format == EXECUTABLE) {
+		std::array<std::uint64_t, 3> addresses = ElfWriter::addresses(text.size(), rodata.size());
+
+		encoder.resolve(addresses);
+		file = writer.executable(addresses[ElfWriter::TEXT] + encoder.labelOffset(start));
+	} else {
+		// Jumps within the text are resolved here; only references to the
+		// data are left to the linker
+		for (const X86_64::Encoder::Fixup &fixup : encoder.resolveLocal()) {
+			writer.addRelocation({fixup.offset, static_cast<ElfWriter::Section>(encoder.labelSection(fixup.label)),
+								  static_cast<std::int64_t>(encoder.labelOffset(fixup.label)) + fixup.disp
+								  - (fixup.end - fixup.offset)});
+		}
+
+		file = writer.object();
+	}
+
+	if (verbose) {
+		std::cout << "x86_64: lowered " << lowering.size() << " instructions to " << text.size()
+			<< " bytes of code in a " << file.size() << " byte " << (format == EXECUTABLE ? "executable" : "object")
+			<< std::endl;
+	}
+
+	return file;
+}
+
+void X86_64Backend::run(const std::vector<std::uint8_t> &object) {
+	IR::ObjectView view(object);
+
+	// Interpret, compiling loops once they are hot. If nothing can be mapped
+	// executable, the interpreter carries on by itself.
+	if (jitThreshold > 0) {
+		X86_64::LoopCompiler compiler(view);
+		Interpreter interpreter(view, &compiler, jitThreshold);
+
+		if (verbose) {
+			std::cout << "x86_64: interpreting " << interpreter.size() << " instructions, compiling loops after "
+				<< jitThreshold << " iterations" << std::endl;
+		}
+
+		std::cout.flush();
+		interpreter.run(tapeSize);
+
+		if (verbose) {
+			std::cout << "x86_64: compiled " << interpreter.compiled() << " loops" << std::endl;
+		}
+
+		return;
+	}
+
+	std::optional<X86_64::Jit> jit;
+
+	// Where code can't be mapped executable, interpret it instead
+	try {
+		jit.emplace(view);
+	} catch (std::system_error &e) {
+		if (verbose) {
+			std::cout << e.what() << "; interpreting instead" << std::endl;
+		}
+
+		InterpreterBackend interpreter;
+		std::vector<std::string> options = {"tape-size=" + std::to_string(tapeSize)};
+
+		interpreter.applyOptions('f', options);
+		interpreter.setVerbosity(verbose);
+		interpreter.run(object);
+		return;
+	}
+
+	if (verbose) {
+		std::cout << "x86_64: compiled " << jit->size() << " bytes of code in memory" << std::endl;
+	}
+
+	// The program writes straight to the file descriptor, so anything still
+	// buffered must go first
+	std::cout.flush();
+
+	jit->run(tapeSize);
+}
@@ -0,0 +1,194 @@
+#include <string>
+
+#include "x86_64.hpp"
+
+namespace X86_64 {
+	namespace {
+		// Register names, by size and then by register
+		const char *const REGISTER_NAMES[4][16] = {
+			{"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+			 "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"},
+			{"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+			 "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+			{"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+			 "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+			{"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+			 "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"}
+		};
+
+		const char *const SIZE_NAMES[4] = {"BYTE PTR", "WORD PTR", "DWORD PTR", "QWORD PTR"};
+
+		const char *const CONDITION_NAMES[16] = {
+			"o", "no", "b", "ae", "e", "ne", "be", "a",
+			"s", "ns", "p", "np", "l", "ge", "le", "g"
+		};
+
+		const char *const OPCODE_NAMES[] = {
+			"mov", "movzx", "movsx", "lea",
+			"add", "sub", "and", "or", "xor", "cmp", "test",
+			"imul", "div", "not",
+			"shl", "shr", "sar",
+			"push", "pop", "jmp", "call",
+			"ret", "syscall", "stc", "pushfq", "popfq", "rep movsb"
+		};
+	}
+
+	/**************
+	 * AsmEmitter *
+	 **************/
+	AsmEmitter::AsmEmitter() {
+		text = "\t.intel_syntax noprefix\n";
+	}
+
+	void AsmEmitter::printLabel(Label label) {
+		if (names[label].empty()) {
+			text += ".LX" + std::to_string(label);
+		} else {
+			text += names[label];
+		}
+	}
+
+	void AsmEmitter::printOperand(const Operand &operand, IR::OperandSize size) {
+		switch (operand.kind) {
+			case Operand::REG:
+				text += REGISTER_NAMES[size][operand.reg];
+				break;
+			case Operand::MEM:
+				text += SIZE_NAMES[size];
+				text += " [";
+				text += REGISTER_NAMES[IR::DWORD][operand.reg];
+				if (operand.disp > 0) text += '+';
+				if (operand.disp) text += std::to_string(operand.disp);
+				text += ']';
+				break;
+			case Operand::LABEL:
+				text += SIZE_NAMES[size];
+				text += " [rip+";
+				printLabel(operand.label);
+				if (operand.disp > 0) text += '+';
+				if (operand.disp) text += std::to_string(operand.disp);
+				text += ']';
+				break;
+			case Operand::IMM:
+				text += std::to_string(operand.imm);
+				break;
+			case Operand::NONE:
+				break;
+		}
+	}
+
+	Label AsmEmitter::label(const std::string &name) {
+		names.push_back(name);
+
+		if (!name.empty()) {
+			text += "\t.globl " + name + '\n';
+		}
+
+		return names.size() - 1;
+	}
+
+	void AsmEmitter::bind(Label label) {
+		printLabel(label);
+		text += ":\n";
+	}
+
+	void AsmEmitter::section(Section section) {
+		switch (section) {
+			case TEXT: text += "\t.text\n"; break;
+			case RODATA: text += "\t.section .rodata\n"; break;
+			case BSS: text += "\t.bss\n"; break;
+		}
+	}
+
+	void AsmEmitter::align(std::size_t alignment) {
+		text += "\t.balign " + std::to_string(alignment) + '\n';
+	}
+
+	void AsmEmitter::emit(Opcode opcode, IR::OperandSize size, Operand dst, Operand src) {
+		text += '\t';
+
+		// movsxd is its own mnemonic, and a 64-bit source needs no extending
+		if (opcode == MOVSX && size == IR::WORD) {
+			text += "movsxd ";
+		} else if (opcode == MOVSX && size == IR::DWORD) {
+			text += "mov ";
+		} else {
+			text += OPCODE_NAMES[opcode];
+			if (dst.kind != Operand::NONE) text += ' ';
+		}
+
+		switch (opcode) {
+			case MOVZX:
+				printOperand(dst, IR::WORD);
+				text += ", ";
+				printOperand(src, size);
+				break;
+			case MOVSX:
+			case LEA:
+				printOperand(dst, IR::DWORD);
+				text += ", ";
+				printOperand(src, opcode == LEA ? IR::DWORD : size);
+				break;
+			case SHL:
+			case SHR:
+			case SAR:
+				printOperand(dst, size);
+				text += ", ";
+				printOperand(src, IR::BYTE);
+				break;
+			case IMUL:
+				printOperand(dst, size);
+				text += ", ";
+				if (src.kind == Operand::IMM) {
+					printOperand(dst, size);
+					text += ", ";
+				}
+				printOperand(src, size);
+				break;
+			case PUSH:
+			case POP:
+			case JMP:
+			case CALL:
+				printOperand(dst, IR::DWORD);
+				break;
+			default:
+				printOperand(dst, size);
+				if (src.kind != Operand::NONE) {
+					text += ", ";
+					printOperand(src, size);
+				}
+				break;
+		}
+
+		text += '\n';
+	}
+
+	void AsmEmitter::jump(Condition cc, Label target) {
+		text += cc == ALWAYS ? "\tjmp " : std::string("\tj") + CONDITION_NAMES[cc] + ' ';
+		printLabel(target);
+		text += '\n';
+	}
+
+	void AsmEmitter::call(Label target) {
+		text += "\tcall ";
+		printLabel(target);
+		text += '\n';
+	}
+
+	void AsmEmitter::data(const std::uint8_t *bytes, std::size_t size) {
+		for (std::size_t i=0; i < size; ++i) {
+			text += (i % 16 == 0) ? "\t.byte " : ",";
+			text += std::to_string(bytes[i]);
+
+			if (i % 16 == 15 || i + 1 == size) text += '\n';
+		}
+	}
+
+	void AsmEmitter::reserve(std::size_t size) {
+		text += "\t.zero " + std::to_string(size) + '\n';
+	}
+
+	const std::string &AsmEmitter::str() const {
+		return text;
+	}
+}
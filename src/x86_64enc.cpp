@@ -0,0 +1,408 @@
+#include <array>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "x86_64.hpp"
+
+namespace X86_64 {
+	namespace {
+		bool fitsInt8(std::int64_t value) {
+			return value >= INT8_MIN && value <= INT8_MAX;
+		}
+
+		bool fitsInt32(std::int64_t value) {
+			return value >= INT32_MIN && value <= INT32_MAX;
+		}
+
+		/*
+		 * Returns the value of an immediate as the instruction sees it, sign
+		 * extended from the operand size
+		 */
+		std::int64_t immediateValue(std::int64_t value, IR::OperandSize size) {
+			int shift = 64 - (8 << size);
+
+			return static_cast<std::int64_t>(static_cast<std::uint64_t>(value) << shift) >> shift;
+		}
+
+		/*
+		 * Returns the size of a full immediate for an operand size. 64-bit
+		 * operations take 32-bit immediates, sign extended.
+		 */
+		int immediateBytes(IR::OperandSize size) {
+			return size == IR::DWORD ? 4 : 1 << size;
+		}
+
+		// The opcode extensions of the ALU instructions, which also pick out
+		// their register forms
+		int aluExtension(Opcode opcode) {
+			switch (opcode) {
+				case ADD: return 0;
+				case OR: return 1;
+				case AND: return 4;
+				case SUB: return 5;
+				case XOR: return 6;
+				default: return 7;	// CMP
+			}
+		}
+	}
+
+	/***********
+	 * Encoder *
+	 ***********/
+	std::uint64_t Encoder::size(Section section) const {
+		switch (section) {
+			case TEXT: return text.size();
+			case RODATA: return rodata.size();
+			default: return bssSize;
+		}
+	}
+
+	void Encoder::immediate(std::int64_t value, int bytes) {
+		for (int i=0; i < bytes; ++i) {
+			text.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+		}
+	}
+
+	void Encoder::modrm(IR::OperandSize size, std::initializer_list<std::uint8_t> opcode, Register reg,
+						const Operand &rm, int immBytes, std::int64_t value) {
+		modrm(size, opcode, reg, true, rm, immBytes, value);
+	}
+
+	void Encoder::modrm(IR::OperandSize size, std::initializer_list<std::uint8_t> opcode, int extension,
+						const Operand &rm, int immBytes, std::int64_t value) {
+		modrm(size, opcode, extension, false, rm, immBytes, value);
+	}
+
+	void Encoder::modrm(IR::OperandSize size, std::initializer_list<std::uint8_t> opcode, int reg,
+						bool isRegister, const Operand &rm, int immBytes, std::int64_t value) {
+		std::uint8_t rex = 0;
+
+		if (size == IR::DWORD) rex |= 0x08;
+		if (reg & 8) rex |= 0x04;
+		if (rm.kind != Operand::LABEL && (rm.reg & 8)) rex |= 0x01;
+
+		// Without a REX prefix, byte registers 4-7 are ah, ch, dh and bh
+		// rather than spl, bpl, sil and dil
+		bool byteRegisters = size == IR::BYTE && ((isRegister && reg >= 4 && reg < 8)
+												  || (rm.kind == Operand::REG && rm.reg >= 4 && rm.reg < 8));
+
+		if (size == IR::HWORD) text.push_back(0x66);
+		if (rex || byteRegisters) text.push_back(0x40 | rex);
+		text.insert(text.end(), opcode);
+
+		std::uint8_t regBits = (reg & 7) << 3;
+
+		switch (rm.kind) {
+			case Operand::REG:
+				text.push_back(0xC0 | regBits | (rm.reg & 7));
+				break;
+			case Operand::MEM:
+				{
+					std::uint8_t base = rm.reg & 7;
+
+					// rbp and r13 as a base with no displacement would mean rip
+					// relative, so they always take one
+					int mod = rm.disp == 0 && base != 5 ? 0 : fitsInt8(rm.disp) ? 1 : 2;
+
+					text.push_back((mod << 6) | regBits | base);
+
+					// rsp and r12 as a base need a SIB byte
+					if (base == 4) text.push_back(0x24);
+
+					immediate(rm.disp, mod == 1 ? 1 : mod == 2 ? 4 : 0);
+				}
+				break;
+			case Operand::LABEL:
+				text.push_back(regBits | 0x05);
+				fixups.push_back({static_cast<std::uint32_t>(text.size()), 0, rm.label, rm.disp});
+				immediate(0, 4);
+				break;
+			default:
+				throw std::invalid_argument("x86_64: instruction needs a register or memory operand");
+		}
+
+		immediate(value, immBytes);
+
+		if (rm.kind == Operand::LABEL) {
+			fixups.back().end = text.size();
+		}
+	}
+
+	void Encoder::branch(std::initializer_list<std::uint8_t> opcode, Label target) {
+		text.insert(text.end(), opcode);
+		fixups.push_back({static_cast<std::uint32_t>(text.size()), static_cast<std::uint32_t>(text.size() + 4), target, 0});
+		immediate(0, 4);
+	}
+
+	Label Encoder::label(const std::string &name) {
+		labels.emplace_back().name = name;
+
+		return labels.size() - 1;
+	}
+
+	void Encoder::bind(Label label) {
+		LabelInfo &info = labels[label];
+
+		info.section = current;
+		info.offset = size(current);
+		info.bound = true;
+	}
+
+	void Encoder::section(Section section) {
+		current = section;
+	}
+
+	void Encoder::align(std::size_t alignment) {
+		std::uint64_t padding = (alignment - size(current) % alignment) % alignment;
+
+		switch (current) {
+			case TEXT: text.insert(text.end(), padding, 0x90); break;	// nop
+			case RODATA: rodata.insert(rodata.end(), padding, 0); break;
+			case BSS: bssSize += padding; break;
+		}
+	}
+
+	void Encoder::emit(Opcode opcode, IR::OperandSize size, Operand dst, Operand src) {
+		bool isByte = size == IR::BYTE;
+		std::uint8_t wide = isByte ? 0 : 1;
+
+		switch (opcode) {
+			case MOV:
+				if (src.kind == Operand::IMM && dst.kind == Operand::REG
+					&& size == IR::DWORD && !fitsInt32(src.imm)) {
+					// mov r64,imm64
+					text.push_back(0x48 | (dst.reg >> 3));
+					text.push_back(0xB8 | (dst.reg & 7));
+					immediate(src.imm, 8);
+				} else if (src.kind == Operand::IMM) {
+					modrm(size, {static_cast<std::uint8_t>(0xC6 | wide)}, 0, dst, immediateBytes(size), src.imm);
+				} else if (src.kind == Operand::REG) {
+					modrm(size, {static_cast<std::uint8_t>(0x88 | wide)}, src.reg, dst);
+				} else {
+					modrm(size, {static_cast<std::uint8_t>(0x8A | wide)}, dst.reg, src);
+				}
+				break;
+			case ADD:
+			case SUB:
+			case AND:
+			case OR:
+			case XOR:
+			case CMP:
+				{
+					int ext = aluExtension(opcode);
+
+					if (src.kind == Operand::IMM) {
+						if (isByte) {
+							modrm(size, {0x80}, ext, dst, 1, src.imm);
+						} else if (fitsInt8(immediateValue(src.imm, size))) {
+							modrm(size, {0x83}, ext, dst, 1, src.imm);
+						} else {
+							modrm(size, {0x81}, ext, dst, immediateBytes(size), src.imm);
+						}
+					} else if (src.kind == Operand::REG) {
+						modrm(size, {static_cast<std::uint8_t>((ext << 3) | wide)}, src.reg, dst);
+					} else {
+						modrm(size, {static_cast<std::uint8_t>((ext << 3) | 0x02 | wide)}, dst.reg, src);
+					}
+				}
+				break;
+			case TEST:
+				if (src.kind == Operand::IMM) {
+					modrm(size, {static_cast<std::uint8_t>(0xF6 | wide)}, 0, dst, immediateBytes(size), src.imm);
+				} else if (src.kind == Operand::REG) {
+					modrm(size, {static_cast<std::uint8_t>(0x84 | wide)}, src.reg, dst);
+				} else {
+					modrm(size, {static_cast<std::uint8_t>(0x84 | wide)}, dst.reg, src);
+				}
+				break;
+			case IMUL:
+				if (src.kind == Operand::IMM) {
+					if (fitsInt8(immediateValue(src.imm, size))) {
+						modrm(size, {0x6B}, dst.reg, dst, 1, src.imm);
+					} else {
+						modrm(size, {0x69}, dst.reg, dst, immediateBytes(size), src.imm);
+					}
+				} else {
+					modrm(size, {0x0F, 0xAF}, dst.reg, src);
+				}
+				break;
+			case DIV:
+				modrm(size, {static_cast<std::uint8_t>(0xF6 | wide)}, 6, dst);
+				break;
+			case NOT:
+				modrm(size, {static_cast<std::uint8_t>(0xF6 | wide)}, 2, dst);
+				break;
+			case SHL:
+			case SHR:
+			case SAR:
+				{
+					int ext = opcode == SHL ? 4 : opcode == SHR ? 5 : 7;
+
+					if (src.kind == Operand::REG) {
+						modrm(size, {static_cast<std::uint8_t>(0xD2 | wide)}, ext, dst);
+					} else if (src.imm == 1) {
+						modrm(size, {static_cast<std::uint8_t>(0xD0 | wide)}, ext, dst);
+					} else {
+						modrm(size, {static_cast<std::uint8_t>(0xC0 | wide)}, ext, dst, 1, src.imm);
+					}
+				}
+				break;
+			case MOVZX:
+				// the destination is 32 bits, but a byte source still needs
+				// REX to reach sil and dil
+				if (isByte && src.kind == Operand::REG && src.reg >= 4 && src.reg < 8 && !(dst.reg & 8)) {
+					text.push_back(0x40);
+				}
+				modrm(IR::WORD, {0x0F, static_cast<std::uint8_t>(isByte ? 0xB6 : 0xB7)}, dst.reg, src);
+				break;
+			case MOVSX:
+				switch (size) {
+					case IR::BYTE: modrm(IR::DWORD, {0x0F, 0xBE}, dst.reg, src); break;
+					case IR::HWORD: modrm(IR::DWORD, {0x0F, 0xBF}, dst.reg, src); break;
+					case IR::WORD: modrm(IR::DWORD, {0x63}, dst.reg, src); break;
+					case IR::DWORD: modrm(IR::DWORD, {0x8B}, dst.reg, src); break;
+				}
+				break;
+			case LEA:
+				modrm(IR::DWORD, {0x8D}, dst.reg, src);
+				break;
+			case PUSH:
+			case POP:
+				if (dst.reg & 8) text.push_back(0x41);
+				text.push_back((opcode == PUSH ? 0x50 : 0x58) | (dst.reg & 7));
+				break;
+			case JMP:
+				modrm(IR::WORD, {0xFF}, 4, dst);
+				break;
+			case CALL:
+				modrm(IR::WORD, {0xFF}, 2, dst);
+				break;
+			case RET:
+				text.push_back(0xC3);
+				break;
+			case SYSCALL:
+				text.insert(text.end(), {0x0F, 0x05});
+				break;
+			case STC:
+				text.push_back(0xF9);
+				break;
+			case PUSHF:
+				text.push_back(0x9C);
+				break;
+			case POPF:
+				text.push_back(0x9D);
+				break;
+			case REP_MOVSB:
+				text.insert(text.end(), {0xF3, 0xA4});
+				break;
+		}
+	}
+
+	void Encoder::jump(Condition cc, Label target) {
+		const LabelInfo &info = labels[target];
+
+		// Backward jumps within reach of a byte
+		if (info.bound && info.section == TEXT) {
+			std::int64_t rel = static_cast<std::int64_t>(info.offset) - static_cast<std::int64_t>(text.size() + 2);
+
+			if (fitsInt8(rel)) {
+				text.push_back(cc == ALWAYS ? 0xEB : 0x70 | cc);
+				text.push_back(static_cast<std::uint8_t>(rel));
+				return;
+			}
+		}
+
+		if (cc == ALWAYS) {
+			branch({0xE9}, target);
+		} else {
+			branch({0x0F, static_cast<std::uint8_t>(0x80 | cc)}, target);
+		}
+	}
+
+	void Encoder::call(Label target) {
+		branch({0xE8}, target);
+	}
+
+	void Encoder::data(const std::uint8_t *bytes, std::size_t size) {
+		std::vector<std::uint8_t> &section = current == TEXT ? text : rodata;
+
+		section.insert(section.end(), bytes, bytes + size);
+	}
+
+	void Encoder::reserve(std::size_t size) {
+		bssSize += size;
+	}
+
+	const std::vector<std::uint8_t> &Encoder::getText() const {
+		return text;
+	}
+
+	const std::vector<std::uint8_t> &Encoder::getRodata() const {
+		return rodata;
+	}
+
+	std::uint64_t Encoder::getBssSize() const {
+		return bssSize;
+	}
+
+	IEmitter::Section Encoder::labelSection(Label label) const {
+		return labels[label].section;
+	}
+
+	std::uint64_t Encoder::labelOffset(Label label) const {
+		return labels[label].offset;
+	}
+
+	std::vector<Encoder::Symbol> Encoder::symbols() const {
+		std::vector<Symbol> result;
+
+		for (const LabelInfo &info : labels) {
+			if (!info.name.empty()) {
+				result.push_back({info.name, info.section, info.offset});
+			}
+		}
+
+		return result;
+	}
+
+	void Encoder::resolve(const std::array<std::uint64_t, 3> &addresses) {
+		for (const Fixup &fixup : fixups) {
+			const LabelInfo &info = labels[fixup.label];
+
+			if (!info.bound) {
+				throw std::runtime_error("x86_64: jump to a label which was never placed");
+			}
+
+			std::int64_t rel = static_cast<std::int64_t>(addresses[info.section] + info.offset + fixup.disp)
+				- static_cast<std::int64_t>(addresses[TEXT] + fixup.end);
+
+			if (!fitsInt32(rel)) {
+				throw std::runtime_error("x86_64: label out of reach of a 32-bit displacement");
+			}
+
+			for (int i=0; i < 4; ++i) {
+				text[fixup.offset + i] = static_cast<std::uint8_t>(rel >> (8 * i));
+			}
+		}
+
+		fixups.clear();
+	}
+
+	std::vector<Encoder::Fixup> Encoder::resolveLocal() {
+		std::vector<Fixup> local, rest;
+
+		for (const Fixup &fixup : fixups) {
+			(labels[fixup.label].section == TEXT ? local : rest).push_back(fixup);
+		}
+
+		fixups = std::move(local);
+		resolve({0, 0, 0});
+
+		return rest;
+	}
+}
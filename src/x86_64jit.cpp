@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "x86_64.hpp"
+
+namespace X86_64 {
+	namespace {
+		std::size_t alignUp(std::size_t value, std::size_t alignment) {
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		/*
+		 * Map what has been encoded into memory, with the code and read-only
+		 * data made read-only and executable
+		 *
+		 * size		Set to the size of the mapping
+		 * Returns the mapping. Throws std::system_error if memory cannot be
+		 * mapped or protected.
+		 */
+		std::uint8_t *load(Encoder &encoder, std::size_t &size) {
+			const std::vector<std::uint8_t> &text = encoder.getText(), &rodata = encoder.getRodata();
+			std::size_t pageSize = sysconf(_SC_PAGESIZE);
+
+			// Everything goes in one mapping so that it is all within reach of
+			// a 32-bit displacement. The writable data gets pages of its own.
+			std::size_t rodataOffset = alignUp(text.size(), 16);
+			std::size_t bssOffset = alignUp(rodataOffset + rodata.size(), pageSize);
+			size = bssOffset + alignUp(encoder.getBssSize(), pageSize);
+
+			void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (addr == MAP_FAILED) {
+				throw std::system_error(errno, std::generic_category(), "x86_64: could not map code");
+			}
+
+			std::uint8_t *memory = static_cast<std::uint8_t *>(addr);
+
+			try {
+				std::uint64_t base = reinterpret_cast<std::uintptr_t>(memory);
+				encoder.resolve({base, base + rodataOffset, base + bssOffset});
+			} catch (...) {
+				munmap(memory, size);
+				throw;
+			}
+
+			std::memcpy(memory, text.data(), text.size());
+			std::memcpy(memory + rodataOffset, rodata.data(), rodata.size());
+
+			// The anonymous mapping is already zeroed, which is all .bss needs
+			if (mprotect(memory, bssOffset, PROT_READ | PROT_EXEC) < 0) {
+				int err = errno;
+				munmap(memory, size);
+				throw std::system_error(err, std::generic_category(), "x86_64: could not protect code");
+			}
+
+			return memory;
+		}
+
+		// The flags the interpreter keeps, as bits of rflags. IR carry means
+		// no borrow, which is the opposite of x86 carry.
+		constexpr std::uint64_t CF = 1 << 0, ZF = 1 << 6, SF = 1 << 7, OF = 1 << 11;
+
+		// rflags with only the bits which are always set: the reserved bit 1
+		// and the interrupt flag
+		constexpr std::uint64_t RFLAGS = 0x202;
+	}
+
+	/*******
+	 * Jit *
+	 *******/
+	Jit::Jit(const IR::ObjectView &object) : imageSize(object.image().size()) {
+		Encoder encoder;
+		Lowering lowering(object, encoder);
+		Label start = lowering.function();
+
+		memory = load(encoder, mapped);
+		codeSize = encoder.getText().size();
+		entry = reinterpret_cast<void (*)(std::uint8_t *)>(memory + encoder.labelOffset(start));
+	}
+
+	void Jit::run(std::size_t tapeSize) const {
+		if (imageSize > tapeSize) {
+			throw std::runtime_error("x86_64: the image is larger than the tape");
+		}
+
+		// Pages of the tape the program never touches cost nothing. The page
+		// below it is left inaccessible, since programs must never go there.
+		std::size_t guard = sysconf(_SC_PAGESIZE);
+		void *mapping = mmap(nullptr, guard + tapeSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+							 -1, 0);
+
+		if (mapping == MAP_FAILED) {
+			throw std::system_error(errno, std::generic_category(), "x86_64: could not map the tape");
+		}
+
+		std::uint8_t *tape = static_cast<std::uint8_t *>(mapping) + guard;
+
+		if (mprotect(tape, tapeSize, PROT_READ | PROT_WRITE) < 0) {
+			int err = errno;
+			munmap(mapping, guard + tapeSize);
+			throw std::system_error(err, std::generic_category(), "x86_64: could not map the tape");
+		}
+
+		entry(tape);
+
+		munmap(mapping, guard + tapeSize);
+	}
+
+	std::size_t Jit::size() const {
+		return codeSize;
+	}
+
+	Jit::~Jit() {
+		munmap(memory, mapped);
+	}
+
+	/****************
+	 * CompiledLoop *
+	 ****************/
+	CompiledLoop::CompiledLoop(Encoder &encoder, Label function) {
+		memory = load(encoder, mapped);
+		entry = reinterpret_cast<std::uint32_t (*)(LoopState *)>(memory + encoder.labelOffset(function));
+	}
+
+	std::uint32_t CompiledLoop::run(Interpreter::State &state) {
+		LoopState loop;
+
+		// The interpreter keeps Z, N, C and V from the lowest bit up
+		std::copy(state.registers, state.registers + 8, loop.registers);
+		loop.rflags = RFLAGS | (state.flags & 1 ? ZF : 0) | (state.flags & 2 ? SF : 0)
+			| (state.flags & 4 ? 0 : CF) | (state.flags & 8 ? OF : 0);
+		loop.buffer = state.buffer;
+		loop.used = state.used;
+
+		std::uint32_t address = entry(&loop);
+
+		std::copy(loop.registers, loop.registers + 8, state.registers);
+		state.flags = (loop.rflags & ZF ? 1 : 0) | (loop.rflags & SF ? 2 : 0)
+			| (loop.rflags & CF ? 0 : 4) | (loop.rflags & OF ? 8 : 0);
+		state.used = loop.used;
+
+		return address;
+	}
+
+	CompiledLoop::~CompiledLoop() {
+		munmap(memory, mapped);
+	}
+
+	/****************
+	 * LoopCompiler *
+	 ****************/
+	LoopCompiler::LoopCompiler(const IR::ObjectView &object) : object(object) {}
+
+	Interpreter::ICompiledLoop *LoopCompiler::compile(std::uint32_t start, std::uint32_t end) {
+		if (!scanned) {
+			carry = Lowering::testsCarry(object);
+			scanned = true;
+		}
+
+		Encoder encoder;
+		Lowering lowering(object, encoder, start, end, carry);
+
+		if (!lowering.loopable()) return nullptr;
+
+		Label function = lowering.loop();
+
+		return new CompiledLoop(encoder, function);
+	}
+}